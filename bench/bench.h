@@ -0,0 +1,69 @@
+/*
+ * bench.h
+ * -------
+ * Timing helpers shared by the benchmark programs. Times are wall clock times from
+ * CLOCK_MONOTONIC, not the CPU time clock() reports summed over all threads.
+ */
+
+#ifndef PPS_BENCH_H
+#define PPS_BENCH_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Summary of the repetitions of one measurement, in seconds
+typedef struct bench_stats {
+  double median;
+  double p99;
+  double min;
+} bench_stats;
+
+// Current wall clock time in seconds
+static inline double bench_now (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline int bench_compare (const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+// Sorts "times" and summarises them
+static inline bench_stats bench_summarise (double *times, int reps) {
+  bench_stats stats;
+  int p99;
+
+  qsort(times, reps, sizeof(double), bench_compare);
+  p99 = (int) (0.99 * (reps - 1) + 0.5);
+  stats.median = reps % 2 ? times[reps / 2] : (times[reps / 2 - 1] + times[reps / 2]) / 2;
+  stats.p99 = times[p99];
+  stats.min = times[0];
+  return stats;
+}
+
+// Parses a comma separated list of sizes ("1000,1e6,2^20") into "list",
+// returning how many were read
+static inline int bench_parse_sizes (const char *text, size_t *list, int max) {
+  char buffer[1024], *token, *save;
+  int count = 0;
+  double value;
+
+  strncpy(buffer, text, sizeof(buffer) - 1);
+  buffer[sizeof(buffer) - 1] = '\0';
+  for (token = strtok_r(buffer, ",", &save); token != NULL && count < max; token = strtok_r(NULL, ",", &save)) {
+    if (strncmp(token, "2^", 2) == 0) {
+      value = (double) ((size_t) 1 << atoi(token + 2));
+    } else {
+      value = strtod(token, NULL);
+    }
+    if (value > 0) list[count++] = (size_t) value;
+  }
+  return count;
+}
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * prefix-sum-bench.c
+ * ------------------
+ * Benchmark of libprefixsum. Sweeps array sizes, thread counts and engines, and
+ * prints one CSV line per combination:
+ *
+ *      engine,isa,mode,stores,nitems,nthreads,reps,median_us,p99_us,gbps,speedup
+ *
+ * Every measurement starts with warm-up runs (page faults, waking the pool), then
+ * the scan is repeated and timed with CLOCK_MONOTONIC. "gbps" counts one read and
+ * one write of every element at the median time and "speedup" is relative to
+ * "pps_sequential" on the same size. The data is reset from a pristine copy before
+ * every repetition so that sums don't drift; the copy isn't timed.
+ *
+ * Usage: bench [-n sizes] [-t threads] [-e engines] [-i isa] [-b barrier] [-a affinity]
+ *              [-S stores] [-x] [-r reps] [-w warmup] [-c tuning]
+ *
+ * -n: comma separated array lengths, e.g. 1e4,1e5,2^20 (default 1e3 to 1e8)
+ * -t: comma separated thread counts (default 1,2,4,... up to the online CPUs)
+ * -e: comma separated engines: threephase, lookback, blocked, dynamic (default all)
+ * -S: auto (default), cached or streaming stores in the final write pass
+ * -c: calibrate the crossovers of the library (with -e's first engine and the
+ *     other options) and write them to this tuning file instead of benchmarking
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prefixsum.h"
+#include "bench.h"
+
+#define MAX_LIST 64
+
+static const char *engine_names[] = { "threephase", "lookback", "blocked", "dynamic" };
+
+#define NENGINES ((int) (sizeof(engine_names) / sizeof(engine_names[0])))
+static const char *isa_names[] = { "auto", "scalar", "sse2", "avx2", "avx512" };
+static const char *barrier_names[] = { "default", "pthread", "spin", "hybrid" };
+static const char *affinity_names[] = { "none", "compact", "numa" };
+static const char *stores_names[] = { "auto", "cached", "streaming" };
+
+// Index of "name" in "names", or -1
+static int lookup (const char *name, const char **names, int count) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (strcmp(name, names[i]) == 0) return i;
+  }
+  return -1;
+}
+
+/*
+ * Function:  time_scan
+ * --------------------
+ * Times "reps" scans of an array after "warmup" untimed ones
+ *
+ * opts: options of the scan, NULL to time pps_sequential
+ */
+static bench_stats time_scan (pps_pool *pool, const int *pristine, int *data, size_t n,
+                              const pps_options *opts, int reps, int warmup) {
+  double times[reps], start;
+  int r;
+
+  for (r = -warmup; r < reps; r++) {
+    memcpy(data, pristine, n * sizeof(int));
+    start = bench_now();
+    if (opts == NULL) {
+      pps_sequential(data, n);
+    } else if (pps_scan_opts(pool, data, n, opts) != 0) {
+      perror("pps_scan_opts");
+      exit(EXIT_FAILURE);
+    }
+    if (r >= 0) times[r] = bench_now() - start;
+  }
+  return bench_summarise(times, reps);
+}
+
+int main (int argc, char *argv[]) {
+  size_t sizes[MAX_LIST], maxn = 0, i, threads_list[MAX_LIST];
+  int nsizes = 0, nthreads = 0, engines[NENGINES];
+  int reps = 51, warmup = 5, opt, s, t, e, maxthreads = 1;
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  bench_stats seq, par;
+  pps_options opts;
+  int *pristine, *data;
+  char *token, *save;
+  pps_affinity affinity = PPS_AFFINITY_NONE;
+  const char *tuning = NULL;
+  pps_pool *pool;
+
+  for (e = 0; e < NENGINES; e++) engines[e] = 1;
+  pps_options_init(&opts);
+  while ((opt = getopt(argc, argv, "n:t:e:i:b:a:S:xr:w:c:")) != -1) {
+    switch (opt) {
+    case 'n':
+      nsizes = bench_parse_sizes(optarg, sizes, MAX_LIST);
+      break;
+    case 't':
+      nthreads = bench_parse_sizes(optarg, threads_list, MAX_LIST);
+      break;
+    case 'e':
+      for (e = 0; e < NENGINES; e++) engines[e] = 0;
+      for (token = strtok_r(optarg, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+        if ((e = lookup(token, engine_names, NENGINES)) < 0) {
+          fprintf(stderr, "Unknown engine \"%s\"\n", token);
+          return EXIT_FAILURE;
+        }
+        engines[e] = 1;
+      }
+      break;
+    case 'i':
+      if ((e = lookup(optarg, isa_names, 5)) < 0) {
+        fprintf(stderr, "Unknown instruction set \"%s\"\n", optarg);
+        return EXIT_FAILURE;
+      }
+      opts.isa = (pps_isa) e;
+      break;
+    case 'b':
+      if ((e = lookup(optarg, barrier_names, 4)) < 0) {
+        fprintf(stderr, "Unknown barrier \"%s\"\n", optarg);
+        return EXIT_FAILURE;
+      }
+      opts.barrier = (pps_barrier) e;
+      break;
+    case 'a':
+      if ((e = lookup(optarg, affinity_names, 3)) < 0) {
+        fprintf(stderr, "Unknown affinity \"%s\"\n", optarg);
+        return EXIT_FAILURE;
+      }
+      affinity = (pps_affinity) e;
+      break;
+    case 'S':
+      if ((e = lookup(optarg, stores_names, 3)) < 0) {
+        fprintf(stderr, "Unknown stores \"%s\"\n", optarg);
+        return EXIT_FAILURE;
+      }
+      opts.stores = (pps_stores) e;
+      break;
+    case 'x':
+      opts.mode = PPS_EXCLUSIVE;
+      break;
+    case 'r':
+      reps = atoi(optarg) > 0 ? atoi(optarg) : 1;
+      break;
+    case 'w':
+      warmup = atoi(optarg) >= 0 ? atoi(optarg) : 0;
+      break;
+    case 'c':
+      tuning = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n sizes] [-t threads] [-e engines] [-i isa] [-b barrier] [-a affinity] [-S stores] [-x] [-r reps] [-w warmup] [-c tuning]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (nsizes == 0) { // Powers of ten from 1e3 to 1e8
+    for (sizes[0] = 1000, nsizes = 1; nsizes < 6; nsizes++) sizes[nsizes] = sizes[nsizes - 1] * 10;
+  }
+  if (nthreads == 0) { // Powers of two up to the online CPUs
+    for (t = 1; t <= (ncpus > 0 ? ncpus : 1); t *= 2) threads_list[nthreads++] = t;
+    if (threads_list[nthreads - 1] != (size_t) ncpus && ncpus > 1) threads_list[nthreads++] = ncpus;
+  }
+  for (s = 0; s < nsizes; s++) if (sizes[s] > maxn) maxn = sizes[s];
+  for (t = 0; t < nthreads; t++) if ((int) threads_list[t] > maxthreads) maxthreads = (int) threads_list[t];
+
+  pool = pps_pool_create(maxthreads);
+  if (pool != NULL && affinity != PPS_AFFINITY_NONE && pps_pool_set_affinity(pool, affinity) != 0) {
+    perror("pps_pool_set_affinity");
+  }
+
+  if (tuning != NULL) { // Calibrate and save instead of benchmarking
+    for (e = 0; e < NENGINES && !engines[e]; e++);
+    opts.engine = (pps_engine) (e < NENGINES ? e : 0);
+    if (pps_pool_calibrate(pool, &opts) != 0 || pps_pool_save_tuning(pool, tuning) != 0) {
+      perror(tuning);
+      return EXIT_FAILURE;
+    }
+    pps_pool_destroy(pool);
+    return 0;
+  }
+
+  pristine = (int *) malloc(maxn * sizeof(int));
+  data = pool != NULL ? pps_alloc(pool, maxn, maxthreads) : NULL;
+  if (pool == NULL || pristine == NULL || data == NULL) {
+    perror("setup");
+    return EXIT_FAILURE;
+  }
+  srand(1);
+  for (i = 0; i < maxn; i++) pristine[i] = rand() % 5;
+
+  printf("engine,isa,mode,stores,nitems,nthreads,reps,median_us,p99_us,gbps,speedup\n");
+  for (s = 0; s < nsizes; s++) {
+    seq = time_scan(pool, pristine, data, sizes[s], NULL, reps, warmup);
+    printf("sequential,scalar,inclusive,cached,%zu,1,%d,%.3f,%.3f,%.3f,1.000\n", sizes[s], reps,
+           seq.median * 1e6, seq.p99 * 1e6, 2.0 * sizes[s] * sizeof(int) / seq.median * 1e-9);
+
+    for (e = 0; e < NENGINES; e++) {
+      if (!engines[e]) continue;
+      for (t = 0; t < nthreads; t++) {
+        opts.engine = (pps_engine) e;
+        opts.nthreads = (int) threads_list[t];
+        par = time_scan(pool, pristine, data, sizes[s], &opts, reps, warmup);
+        printf("%s,%s,%s,%s,%zu,%d,%d,%.3f,%.3f,%.3f,%.3f\n", engine_names[e], isa_names[opts.isa],
+               opts.mode == PPS_EXCLUSIVE ? "exclusive" : "inclusive", stores_names[opts.stores], sizes[s], opts.nthreads, reps,
+               par.median * 1e6, par.p99 * 1e6, 2.0 * sizes[s] * sizeof(int) / par.median * 1e-9,
+               seq.median / par.median);
+        fflush(stdout);
+      }
+    }
+  }
+
+  pps_pool_destroy(pool);
+  free(pristine); pps_free(data);
+  return 0;
+}
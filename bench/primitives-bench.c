@@ -0,0 +1,256 @@
+/*
+ * primitives-bench.c
+ * ------------------
+ * Benchmark of the primitives built on the scan: radix sort, histogram, bucketing
+ * and compaction. Sweeps array sizes and thread counts and prints one CSV line per
+ * combination:
+ *
+ *      primitive,nitems,nthreads,reps,median_us,p99_us,mitems_per_s,speedup
+ *
+ * Keys are random 32 bit ints; the histogram and the bucketing use their low byte
+ * as the bucket (256 buckets), the compaction keeps the odd ones. "speedup" is
+ * relative to the sequential code on the same size, shown with nthreads 0: qsort
+ * for the sort and single loops for the others. Every result is checked against
+ * the sequential one. Sorted keys are reset from a pristine copy before every
+ * repetition; the copy isn't timed.
+ *
+ * Usage: primitives-bench [-n sizes] [-t threads] [-p primitives] [-r reps] [-w warmup]
+ *
+ * -n: comma separated array lengths, e.g. 1e4,1e5,2^20 (default 1e4 to 1e7)
+ * -t: comma separated thread counts (default 1,2,4,... up to the online CPUs)
+ * -p: comma separated primitives: sort, histogram, bucket, compact (default all)
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prefixsum.h"
+#include "bench.h"
+
+#define MAX_LIST 64
+#define NBUCKETS 256
+
+enum { SORT, HISTOGRAM, BUCKET, COMPACT, NPRIMITIVES };
+
+static const char *primitive_names[] = { "sort", "histogram", "bucket", "compact" };
+
+// Buffers of one size, shared by the sequential and the parallel runs
+typedef struct bench_arrays {
+  const int *pristine; // Keys as generated
+  int *data; // Keys sorted in place
+  int *out; // Output of the bucketing and the compaction
+  size_t counts[NBUCKETS + 1]; // Histogram, or bucket starts
+  size_t kept; // Elements kept by the compaction
+} bench_arrays;
+
+static inline size_t low_byte (int value) {
+  return (unsigned) value & (NBUCKETS - 1);
+}
+
+static void low_bytes (const int *values, unsigned *buckets, size_t count, void *ctx) {
+  size_t i;
+
+  (void) ctx;
+  for (i = 0; i < count; i++) buckets[i] = (unsigned) low_byte(values[i]);
+}
+
+static int odd (int value, void *ctx) {
+  (void) ctx;
+  return value & 1;
+}
+
+static int compare_ints (const void *a, const void *b) {
+  int x = *(const int *) a, y = *(const int *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * Function:  sequential
+ * ---------------------
+ * Reference implementation of a primitive on one thread
+ */
+static void sequential (int primitive, bench_arrays *arrays, size_t n) {
+  size_t i, b, sum;
+
+  switch (primitive) {
+  case SORT:
+    qsort(arrays->data, n, sizeof(int), compare_ints);
+    break;
+  case HISTOGRAM:
+  case BUCKET:
+    memset(arrays->counts, 0, sizeof(arrays->counts));
+    for (i = 0; i < n; i++) arrays->counts[low_byte(arrays->pristine[i])]++;
+    if (primitive == HISTOGRAM) break;
+    for (b = 0, sum = 0; b <= NBUCKETS; b++) { // Bucket starts
+      i = arrays->counts[b];
+      arrays->counts[b] = sum;
+      sum += i;
+    }
+    arrays->counts[NBUCKETS] = n;
+    for (i = 0; i < n; i++) arrays->out[arrays->counts[low_byte(arrays->pristine[i])]++] = arrays->pristine[i];
+    for (b = NBUCKETS; b > 0; b--) arrays->counts[b] = arrays->counts[b - 1]; // Back to the starts
+    arrays->counts[0] = 0;
+    arrays->counts[NBUCKETS] = n;
+    break;
+  default:
+    for (i = 0, arrays->kept = 0; i < n; i++) {
+      if (odd(arrays->pristine[i], NULL)) arrays->out[arrays->kept++] = arrays->pristine[i];
+    }
+  }
+}
+
+/*
+ * Function:  parallel
+ * -------------------
+ * A primitive on the pool
+ *
+ * returns: 0, -1 with errno set on failure
+ */
+static int parallel (int primitive, pps_pool *pool, bench_arrays *arrays, size_t n, const pps_options *opts) {
+  switch (primitive) {
+  case SORT:
+    return pps_radix_sort(pool, arrays->data, n, opts);
+  case HISTOGRAM:
+    return pps_histogram(pool, arrays->pristine, n, low_bytes, NULL, NBUCKETS, arrays->counts, opts);
+  case BUCKET:
+    return pps_bucket(pool, arrays->pristine, arrays->out, n, low_bytes, NULL, NBUCKETS, arrays->counts, opts);
+  default:
+    return pps_compact(pool, arrays->pristine, arrays->out, n, odd, NULL, &arrays->kept, opts);
+  }
+}
+
+/*
+ * Function:  time_primitive
+ * -------------------------
+ * Times "reps" runs of a primitive after "warmup" untimed ones
+ *
+ * opts: options of the primitive, NULL to time the sequential code
+ */
+static bench_stats time_primitive (int primitive, pps_pool *pool, bench_arrays *arrays, size_t n,
+                                   const pps_options *opts, int reps, int warmup) {
+  double times[reps], start;
+  int r;
+
+  for (r = -warmup; r < reps; r++) {
+    if (primitive == SORT) memcpy(arrays->data, arrays->pristine, n * sizeof(int));
+    start = bench_now();
+    if (opts == NULL) {
+      sequential(primitive, arrays, n);
+    } else if (parallel(primitive, pool, arrays, n, opts) != 0) {
+      perror(primitive_names[primitive]);
+      exit(EXIT_FAILURE);
+    }
+    if (r >= 0) times[r] = bench_now() - start;
+  }
+  return bench_summarise(times, reps);
+}
+
+int main (int argc, char *argv[]) {
+  size_t sizes[MAX_LIST], maxn = 0, i, n, threads_list[MAX_LIST], expected_counts[NBUCKETS + 1], expected_kept = 0;
+  int nsizes = 0, nthreads = 0, primitives[NPRIMITIVES];
+  int reps = 21, warmup = 3, opt, s, t, p, maxthreads = 1, status = 0;
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int *pristine, *data, *out, *expected;
+  bench_stats seq, par;
+  bench_arrays arrays;
+  pps_options opts;
+  char *token, *save;
+  pps_pool *pool;
+
+  for (p = 0; p < NPRIMITIVES; p++) primitives[p] = 1;
+  pps_options_init(&opts);
+  while ((opt = getopt(argc, argv, "n:t:p:r:w:")) != -1) {
+    switch (opt) {
+    case 'n':
+      nsizes = bench_parse_sizes(optarg, sizes, MAX_LIST);
+      break;
+    case 't':
+      nthreads = bench_parse_sizes(optarg, threads_list, MAX_LIST);
+      break;
+    case 'p':
+      for (p = 0; p < NPRIMITIVES; p++) primitives[p] = 0;
+      for (token = strtok_r(optarg, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+        for (p = 0; p < NPRIMITIVES && strcmp(token, primitive_names[p]) != 0; p++);
+        if (p == NPRIMITIVES) {
+          fprintf(stderr, "Unknown primitive \"%s\"\n", token);
+          return EXIT_FAILURE;
+        }
+        primitives[p] = 1;
+      }
+      break;
+    case 'r':
+      reps = atoi(optarg) > 0 ? atoi(optarg) : 1;
+      break;
+    case 'w':
+      warmup = atoi(optarg) >= 0 ? atoi(optarg) : 0;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n sizes] [-t threads] [-p primitives] [-r reps] [-w warmup]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (nsizes == 0) { // Powers of ten from 1e4 to 1e7
+    for (sizes[0] = 10000, nsizes = 1; nsizes < 4; nsizes++) sizes[nsizes] = sizes[nsizes - 1] * 10;
+  }
+  if (nthreads == 0) { // Powers of two up to the online CPUs
+    for (t = 1; t <= (ncpus > 0 ? ncpus : 1); t *= 2) threads_list[nthreads++] = t;
+    if (threads_list[nthreads - 1] != (size_t) ncpus && ncpus > 1) threads_list[nthreads++] = ncpus;
+  }
+  for (s = 0; s < nsizes; s++) if (sizes[s] > maxn) maxn = sizes[s];
+  for (t = 0; t < nthreads; t++) if ((int) threads_list[t] > maxthreads) maxthreads = (int) threads_list[t];
+
+  pool = pps_pool_create(maxthreads);
+  pristine = (int *) malloc(maxn * sizeof(int));
+  expected = (int *) malloc(maxn * sizeof(int));
+  data = pool != NULL ? pps_alloc(pool, maxn, maxthreads) : NULL;
+  out = pool != NULL ? pps_alloc(pool, maxn, maxthreads) : NULL;
+  if (pool == NULL || pristine == NULL || expected == NULL || data == NULL || out == NULL) {
+    perror("setup");
+    return EXIT_FAILURE;
+  }
+  srand(1);
+  for (i = 0; i < maxn; i++) pristine[i] = (int) ((unsigned) rand() << 16 ^ (unsigned) rand());
+  arrays.pristine = pristine;
+  arrays.data = data;
+  arrays.out = out;
+
+  printf("primitive,nitems,nthreads,reps,median_us,p99_us,mitems_per_s,speedup\n");
+  for (s = 0; s < nsizes; s++) {
+    n = sizes[s];
+    for (p = 0; p < NPRIMITIVES; p++) {
+      if (!primitives[p]) continue;
+      seq = time_primitive(p, pool, &arrays, n, NULL, reps, warmup);
+      memcpy(expected, p == SORT ? data : out, n * sizeof(int));
+      memcpy(expected_counts, arrays.counts, sizeof(expected_counts));
+      expected_kept = arrays.kept;
+      printf("%s,%zu,0,%d,%.3f,%.3f,%.3f,1.000\n", primitive_names[p], n, reps, seq.median * 1e6, seq.p99 * 1e6,
+             n / seq.median * 1e-6);
+
+      for (t = 0; t < nthreads; t++) {
+        opts.nthreads = (int) threads_list[t];
+        par = time_primitive(p, pool, &arrays, n, &opts, reps, warmup);
+        if ((p == SORT && memcmp(data, expected, n * sizeof(int)) != 0) ||
+            (p == HISTOGRAM && memcmp(arrays.counts, expected_counts, NBUCKETS * sizeof(size_t)) != 0) ||
+            (p == BUCKET && (memcmp(out, expected, n * sizeof(int)) != 0 ||
+                             memcmp(arrays.counts, expected_counts, sizeof(expected_counts)) != 0)) ||
+            (p == COMPACT && (arrays.kept != expected_kept || memcmp(out, expected, expected_kept * sizeof(int)) != 0))) {
+          fprintf(stderr, "Error: %s result differs at %zu items and %d threads\n", primitive_names[p], n,
+                  opts.nthreads);
+          status = EXIT_FAILURE;
+        }
+        printf("%s,%zu,%d,%d,%.3f,%.3f,%.3f,%.3f\n", primitive_names[p], n, opts.nthreads, reps, par.median * 1e6,
+               par.p99 * 1e6, n / par.median * 1e-6, seq.median / par.median);
+        fflush(stdout);
+      }
+    }
+  }
+
+  pps_pool_destroy(pool);
+  free(pristine); free(expected); pps_free(data); pps_free(out);
+  return status;
+}
@@ -0,0 +1,169 @@
+/*
+ * prefix-sum-gpu-bench.c
+ * ----------------------
+ * Compares the prefix sums of the worker pool and of the OpenCL device and prints
+ * one CSV line per size and backend:
+ *
+ *      backend,mode,nitems,nthreads,reps,median_us,p99_us,gbps
+ *
+ * "pool" is "pps_scan_into" on the pool, "gpu" the device scan of a host array,
+ * transfers included, and "gpu-resident" the device scan of an array already in
+ * device memory. Every result is checked against the sequential scan. The smallest
+ * size from which "gpu" stays faster than "pool" is reported on stderr, as the
+ * "min_items" to give "pps_gpu_attach" on this machine.
+ *
+ * Usage: prefix-sum-gpu-bench [-n sizes] [-t threads] [-x] [-r reps] [-w warmup]
+ *
+ * -n: comma separated array lengths (default 1e5,1e6,1e7,1e8)
+ * -t: worker threads of the pool (default the online CPUs)
+ * -x: exclusive instead of inclusive prefix sum
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefixsum-gpu.h"
+#include "bench.h"
+
+#define MAX_LIST 64
+
+enum { POOL, GPU, RESIDENT, NBACKENDS };
+
+static const char *backend_names[] = { "pool", "gpu", "gpu-resident" };
+
+int main (int argc, char *argv[]) {
+  size_t sizes[MAX_LIST], n, maxn = 0, i, crossover = 0;
+  int nsizes = 0, reps = 21, warmup = 3, nthreads = 0, opt, s, r, b, status = 0;
+  double start, *times, best[NBACKENDS];
+  int *input, *expected, *output;
+  pps_options opts;
+  bench_stats stats;
+  pps_pool *pool;
+  pps_gpu *gpu;
+  cl_mem buffers[2];
+  cl_int err, err2;
+
+  pps_options_init(&opts);
+  while ((opt = getopt(argc, argv, "n:t:xr:w:")) != -1) {
+    switch (opt) {
+    case 'n':
+      nsizes = bench_parse_sizes(optarg, sizes, MAX_LIST);
+      break;
+    case 't':
+      nthreads = atoi(optarg);
+      break;
+    case 'x':
+      opts.mode = PPS_EXCLUSIVE;
+      break;
+    case 'r':
+      reps = atoi(optarg) > 0 ? atoi(optarg) : 1;
+      break;
+    case 'w':
+      warmup = atoi(optarg) >= 0 ? atoi(optarg) : 0;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n sizes] [-t threads] [-x] [-r reps] [-w warmup]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (nsizes == 0) {
+    sizes[nsizes++] = 100000;
+    sizes[nsizes++] = 1000000;
+    sizes[nsizes++] = 10000000;
+    sizes[nsizes++] = 100000000;
+  }
+  for (s = 0; s < nsizes; s++) {
+    if (sizes[s] > maxn) maxn = sizes[s];
+  }
+
+  pool = pps_pool_create(nthreads);
+  gpu = pps_gpu_create(NULL);
+  if (pool == NULL || gpu == NULL) {
+    perror(pool == NULL ? "pps_pool_create" : "pps_gpu_create");
+    return EXIT_FAILURE;
+  }
+  input = pps_alloc(pool, maxn, 0);
+  expected = (int *) malloc(maxn * sizeof(int));
+  output = pps_alloc(pool, maxn, 0);
+  times = (double *) malloc(reps * sizeof(double));
+  if (input == NULL || expected == NULL || output == NULL || times == NULL) {
+    perror("malloc");
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < maxn; i++) input[i] = (int) (i % 7) - 3;
+
+  // Device resident copy of the input, scanned out of place so it stays intact
+  buffers[0] = clCreateBuffer(pps_gpu_context(gpu), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, maxn * sizeof(int),
+                              input, &err);
+  buffers[1] = clCreateBuffer(pps_gpu_context(gpu), CL_MEM_READ_WRITE, maxn * sizeof(int), NULL, &err2);
+  if (err != CL_SUCCESS || err2 != CL_SUCCESS) {
+    fprintf(stderr, "Out of device memory\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("backend,mode,nitems,nthreads,reps,median_us,p99_us,gbps\n");
+  for (s = 0; s < nsizes; s++) {
+    n = sizes[s];
+    memcpy(expected, input, n * sizeof(int));
+    pps_sequential(expected, n);
+    if (opts.mode == PPS_EXCLUSIVE && n > 0) {
+      memmove(expected + 1, expected, (n - 1) * sizeof(int));
+      expected[0] = 0;
+    }
+
+    for (b = 0; b < NBACKENDS; b++) {
+      memset(output, 0, n * sizeof(int));
+      for (r = -warmup; r < reps; r++) {
+        start = bench_now();
+        switch (b) {
+        case POOL:
+          err = pps_scan_into(pool, input, output, n, &opts);
+          break;
+        case GPU:
+          err = pps_gpu_scan_into(gpu, input, output, n, &opts);
+          break;
+        default:
+          err = pps_gpu_scan_buffer(gpu, buffers[0], buffers[1], n, &opts);
+        }
+        if (r >= 0) times[r] = bench_now() - start;
+        if (err != 0) {
+          perror(backend_names[b]);
+          return EXIT_FAILURE;
+        }
+      }
+      if (b == RESIDENT && n > 0) { // Fetched for the check, not timed
+        clEnqueueReadBuffer(pps_gpu_queue(gpu), buffers[1], CL_TRUE, 0, n * sizeof(int), output, 0, NULL, NULL);
+      }
+      if (memcmp(output, expected, n * sizeof(int)) != 0) {
+        fprintf(stderr, "Error: %s result differs at %zu items\n", backend_names[b], n);
+        status = EXIT_FAILURE;
+      }
+
+      stats = bench_summarise(times, reps);
+      best[b] = stats.median;
+      printf("%s,%s,%zu,%d,%d,%.3f,%.3f,%.3f\n", backend_names[b],
+             opts.mode == PPS_EXCLUSIVE ? "exclusive" : "inclusive", n, pps_pool_size(pool), reps,
+             stats.median * 1e6, stats.p99 * 1e6, 2.0 * n * sizeof(int) / stats.median * 1e-9);
+      fflush(stdout);
+    }
+    if (best[GPU] >= best[POOL]) {
+      crossover = 0;
+    } else if (crossover == 0) {
+      crossover = n;
+    }
+  }
+
+  if (crossover > 0) {
+    fprintf(stderr, "The device wins from %zu items, use it as min_items of pps_gpu_attach\n", crossover);
+  } else {
+    fprintf(stderr, "The device doesn't win at any of the sizes measured\n");
+  }
+
+  clReleaseMemObject(buffers[0]); clReleaseMemObject(buffers[1]);
+  pps_free(input); pps_free(output); free(expected); free(times);
+  pps_gpu_destroy(gpu);
+  pps_pool_destroy(pool);
+  return status;
+}
@@ -0,0 +1,374 @@
+/*
+ * prefix-sum-gpu.c
+ * ----------------
+ * Prefix sums on an OpenCL device, the three phase algorithm of prefix-sum.c over
+ * work-groups instead of threads, tile by tile:
+ *
+ *      Phase 1 - "reduce_tiles": every work-group sums a tile of WG * ITEMS
+ *                elements, read coalesced, into the tile sums
+ *      Phase 2 - "scan_sums": a single work-group turns the tile sums into the
+ *                carry-ins of the tiles, starting from the running total of the
+ *                slabs before, which it then advances
+ *      Phase 3 - "scan_tiles": every work-group loads its tile into local memory,
+ *                scans it from its carry-in and stores it back coalesced
+ *
+ * So the device reads the array twice and writes it once, with no synchronisation
+ * between work-groups but the kernel boundaries. Decoupled look-back (lookback.c)
+ * would save one read, but OpenCL doesn't promise that a work-group spinning on its
+ * predecessor's status lets that predecessor run.
+ *
+ * A slab is as many tiles as Phase 2 scans in one work-group (up to 16M elements).
+ * Host arrays go through two staging buffers on three in-order queues, with events
+ * between them: the upload of slab s + 1 and the download of slab s - 1 overlap
+ * the scan of slab s, and a staging buffer is only refilled once it is downloaded.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "prefixsum-gpu.h"
+
+#define MAX_WG 256 // Work-items per work-group, less if the device can't
+#define ITEMS 16 // Elements per work-item and tile
+#define MAX_PLATFORMS 16
+
+// Device code, built with -DWG and -DITEMS
+static const char *kernel_source =
+  "#define TILE (WG * ITEMS)\n"
+  "\n"
+  "// Inclusive scan of one value per work-item of the group, through \"scratch\"\n"
+  "static int group_scan (int value, __local int *scratch) {\n"
+  "  int lid = get_local_id(0), offset, other;\n"
+  "\n"
+  "  scratch[lid] = value;\n"
+  "  barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);\n"
+  "  for (offset = 1; offset < WG; offset <<= 1) {\n"
+  "    other = lid >= offset ? scratch[lid - offset] : 0;\n"
+  "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+  "    scratch[lid] += other;\n"
+  "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+  "  }\n"
+  "  return scratch[lid];\n"
+  "}\n"
+  "\n"
+  "__kernel void reduce_tiles (__global const int *in, ulong offset, ulong n, __global int *sums) {\n"
+  "  __local int scratch[WG];\n"
+  "  ulong base = (ulong) get_group_id(0) * TILE, i;\n"
+  "  int lid = get_local_id(0), sum = 0, k;\n"
+  "\n"
+  "  for (k = 0; k < ITEMS; k++) {\n"
+  "    i = base + (ulong) k * WG + lid;\n"
+  "    if (i < n) sum += in[offset + i];\n"
+  "  }\n"
+  "  sum = group_scan(sum, scratch);\n"
+  "  if (lid == WG - 1) sums[get_group_id(0)] = sum;\n"
+  "}\n"
+  "\n"
+  "__kernel void scan_sums (__global int *sums, uint ntiles, __global int *carry) {\n"
+  "  __local int scratch[WG];\n"
+  "  int lid = get_local_id(0), values[ITEMS], prior = carry[0], total = 0, before, k;\n"
+  "  uint first = lid * ITEMS;\n"
+  "\n"
+  "  for (k = 0; k < ITEMS; k++) {\n"
+  "    values[k] = first + k < ntiles ? sums[first + k] : 0;\n"
+  "    total += values[k];\n"
+  "  }\n"
+  "  before = prior + group_scan(total, scratch) - total; // Every carry read before the write below\n"
+  "  for (k = 0; k < ITEMS; k++) {\n"
+  "    if (first + k < ntiles) sums[first + k] = before;\n"
+  "    before += values[k];\n"
+  "  }\n"
+  "  if (lid == WG - 1) carry[0] = before;\n"
+  "}\n"
+  "\n"
+  "__kernel void scan_tiles (__global const int *in, __global int *out, ulong offset, ulong n,\n"
+  "                          __global const int *sums, int exclusive) {\n"
+  "  __local int tile[TILE];\n"
+  "  __local int scratch[WG];\n"
+  "  ulong base = (ulong) get_group_id(0) * TILE, i;\n"
+  "  int lid = get_local_id(0), total = 0, before, value, k;\n"
+  "\n"
+  "  for (k = 0; k < ITEMS; k++) {\n"
+  "    i = base + (ulong) k * WG + lid;\n"
+  "    tile[k * WG + lid] = i < n ? in[offset + i] : 0;\n"
+  "  }\n"
+  "  barrier(CLK_LOCAL_MEM_FENCE);\n"
+  "  for (k = 0; k < ITEMS; k++) total += tile[lid * ITEMS + k];\n"
+  "  before = sums[get_group_id(0)] + group_scan(total, scratch) - total;\n"
+  "  for (k = 0; k < ITEMS; k++) {\n"
+  "    value = tile[lid * ITEMS + k];\n"
+  "    tile[lid * ITEMS + k] = exclusive ? before : before + value;\n"
+  "    before += value;\n"
+  "  }\n"
+  "  barrier(CLK_LOCAL_MEM_FENCE);\n"
+  "  for (k = 0; k < ITEMS; k++) {\n"
+  "    i = base + (ulong) k * WG + lid;\n"
+  "    if (i < n) out[offset + i] = tile[k * WG + lid];\n"
+  "  }\n"
+  "}\n";
+
+struct pps_gpu {
+  cl_device_id device; // Device running the kernels
+  cl_context context; // Its context
+  cl_command_queue upload; // Host to device copies
+  cl_command_queue compute; // Kernels, in order, so slabs follow each other
+  cl_command_queue download; // Device to host copies
+  cl_program program; // The kernels above
+  cl_kernel reduce; // Phase 1
+  cl_kernel scan_sums; // Phase 2
+  cl_kernel scan; // Phase 3
+  size_t wg; // Work-items per work-group
+  size_t tile; // Elements per tile, wg * ITEMS
+  size_t slab; // Elements per slab, a multiple of "tile"
+  cl_mem staging[2]; // Slabs of host arrays
+  cl_mem sums; // Tile sums of the slab being scanned
+  cl_mem carry; // Sum of the slabs before it
+  pthread_mutex_t lock; // One scan at a time, they share the buffers above
+};
+
+/*
+ * Function:  first_gpu
+ * --------------------
+ * returns: the first GPU of the first platform having one, NULL if none
+ */
+static cl_device_id first_gpu (void) {
+  cl_platform_id platforms[MAX_PLATFORMS];
+  cl_device_id device;
+  cl_uint count, i;
+
+  if (clGetPlatformIDs(MAX_PLATFORMS, platforms, &count) != CL_SUCCESS) return NULL;
+  if (count > MAX_PLATFORMS) count = MAX_PLATFORMS;
+  for (i = 0; i < count; i++) {
+    if (clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU, 1, &device, NULL) == CL_SUCCESS) return device;
+  }
+  return NULL;
+}
+
+pps_gpu *pps_gpu_create (cl_device_id device) {
+  size_t max_wg, tiles;
+  cl_ulong max_alloc;
+  char options[64];
+  pps_gpu *gpu;
+  cl_int err;
+
+  if (device == NULL) device = first_gpu();
+  if (device == NULL) {
+    errno = ENODEV;
+    return NULL;
+  }
+  gpu = (pps_gpu *) calloc(1, sizeof(pps_gpu));
+  if (gpu == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&gpu->lock, NULL);
+  gpu->device = device;
+
+  // Largest power of two work-group, and slabs small enough for one allocation
+  if (clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_wg), &max_wg, NULL) != CL_SUCCESS ||
+      clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL) != CL_SUCCESS) {
+    pps_gpu_destroy(gpu);
+    errno = EIO;
+    return NULL;
+  }
+  for (gpu->wg = MAX_WG; gpu->wg > max_wg && gpu->wg > 1; gpu->wg /= 2);
+  gpu->tile = gpu->wg * ITEMS;
+  tiles = max_alloc / sizeof(int) / gpu->tile; // Phase 2 scans up to "tile" tile sums
+  gpu->slab = (tiles < gpu->tile ? (tiles > 0 ? tiles : 1) : gpu->tile) * gpu->tile;
+
+  gpu->context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+  if (err == CL_SUCCESS) gpu->upload = clCreateCommandQueue(gpu->context, device, 0, &err);
+  if (err == CL_SUCCESS) gpu->compute = clCreateCommandQueue(gpu->context, device, 0, &err);
+  if (err == CL_SUCCESS) gpu->download = clCreateCommandQueue(gpu->context, device, 0, &err);
+  if (err == CL_SUCCESS) gpu->program = clCreateProgramWithSource(gpu->context, 1, &kernel_source, NULL, &err);
+  if (err == CL_SUCCESS) {
+    snprintf(options, sizeof(options), "-DWG=%zu -DITEMS=%d", gpu->wg, ITEMS);
+    err = clBuildProgram(gpu->program, 1, &device, options, NULL, NULL);
+  }
+  if (err == CL_SUCCESS) gpu->reduce = clCreateKernel(gpu->program, "reduce_tiles", &err);
+  if (err == CL_SUCCESS) gpu->scan_sums = clCreateKernel(gpu->program, "scan_sums", &err);
+  if (err == CL_SUCCESS) gpu->scan = clCreateKernel(gpu->program, "scan_tiles", &err);
+  if (err == CL_SUCCESS) gpu->staging[0] = clCreateBuffer(gpu->context, CL_MEM_READ_WRITE, gpu->slab * sizeof(int), NULL, &err);
+  if (err == CL_SUCCESS) gpu->staging[1] = clCreateBuffer(gpu->context, CL_MEM_READ_WRITE, gpu->slab * sizeof(int), NULL, &err);
+  if (err == CL_SUCCESS) gpu->sums = clCreateBuffer(gpu->context, CL_MEM_READ_WRITE, gpu->tile * sizeof(int), NULL, &err);
+  if (err == CL_SUCCESS) gpu->carry = clCreateBuffer(gpu->context, CL_MEM_READ_WRITE, sizeof(int), NULL, &err);
+  if (err != CL_SUCCESS) {
+    pps_gpu_destroy(gpu);
+    errno = err == CL_OUT_OF_HOST_MEMORY || err == CL_MEM_OBJECT_ALLOCATION_FAILURE ? ENOMEM : EIO;
+    return NULL;
+  }
+  return gpu;
+}
+
+void pps_gpu_destroy (pps_gpu *gpu) {
+  int i;
+
+  if (gpu == NULL) return;
+
+  for (i = 0; i < 2; i++) {
+    if (gpu->staging[i] != NULL) clReleaseMemObject(gpu->staging[i]);
+  }
+  if (gpu->sums != NULL) clReleaseMemObject(gpu->sums);
+  if (gpu->carry != NULL) clReleaseMemObject(gpu->carry);
+  if (gpu->reduce != NULL) clReleaseKernel(gpu->reduce);
+  if (gpu->scan_sums != NULL) clReleaseKernel(gpu->scan_sums);
+  if (gpu->scan != NULL) clReleaseKernel(gpu->scan);
+  if (gpu->program != NULL) clReleaseProgram(gpu->program);
+  if (gpu->upload != NULL) clReleaseCommandQueue(gpu->upload);
+  if (gpu->compute != NULL) clReleaseCommandQueue(gpu->compute);
+  if (gpu->download != NULL) clReleaseCommandQueue(gpu->download);
+  if (gpu->context != NULL) clReleaseContext(gpu->context);
+  pthread_mutex_destroy(&gpu->lock);
+  free(gpu);
+}
+
+cl_context pps_gpu_context (const pps_gpu *gpu) {
+  return gpu->context;
+}
+
+cl_command_queue pps_gpu_queue (const pps_gpu *gpu) {
+  return gpu->compute;
+}
+
+/*
+ * Function:  reset_carry
+ * ----------------------
+ * Queues the reset of the running total before the first slab of a scan
+ */
+static cl_int reset_carry (pps_gpu *gpu) {
+  static const int zero = 0; // Must outlive the non-blocking write
+
+  return clEnqueueWriteBuffer(gpu->compute, gpu->carry, CL_FALSE, 0, sizeof(int), &zero, 0, NULL, NULL);
+}
+
+/*
+ * Function:  scan_slab
+ * --------------------
+ * Queues the three phases of the slab [offset, offset + count) of "in" into "out"
+ * on the compute queue
+ *
+ * wait: event to wait for before the first phase, NULL if none
+ * done: receives the event of the last phase, NULL if not needed
+ */
+static cl_int scan_slab (pps_gpu *gpu, cl_mem in, cl_mem out, size_t offset, size_t count, int exclusive,
+                         cl_event wait, cl_event *done) {
+  cl_ulong first = offset, n = count;
+  cl_uint ntiles = (cl_uint) ((count + gpu->tile - 1) / gpu->tile);
+  size_t global = ntiles * gpu->wg, local = gpu->wg;
+  cl_int err, flag = exclusive;
+
+  // Kernel arguments are captured when the kernel is queued
+  err = clSetKernelArg(gpu->reduce, 0, sizeof(cl_mem), &in);
+  err |= clSetKernelArg(gpu->reduce, 1, sizeof(cl_ulong), &first);
+  err |= clSetKernelArg(gpu->reduce, 2, sizeof(cl_ulong), &n);
+  err |= clSetKernelArg(gpu->reduce, 3, sizeof(cl_mem), &gpu->sums);
+  err |= clSetKernelArg(gpu->scan_sums, 0, sizeof(cl_mem), &gpu->sums);
+  err |= clSetKernelArg(gpu->scan_sums, 1, sizeof(cl_uint), &ntiles);
+  err |= clSetKernelArg(gpu->scan_sums, 2, sizeof(cl_mem), &gpu->carry);
+  err |= clSetKernelArg(gpu->scan, 0, sizeof(cl_mem), &in);
+  err |= clSetKernelArg(gpu->scan, 1, sizeof(cl_mem), &out);
+  err |= clSetKernelArg(gpu->scan, 2, sizeof(cl_ulong), &first);
+  err |= clSetKernelArg(gpu->scan, 3, sizeof(cl_ulong), &n);
+  err |= clSetKernelArg(gpu->scan, 4, sizeof(cl_mem), &gpu->sums);
+  err |= clSetKernelArg(gpu->scan, 5, sizeof(cl_int), &flag);
+  if (err != CL_SUCCESS) return CL_INVALID_KERNEL_ARGS;
+
+  err = clEnqueueNDRangeKernel(gpu->compute, gpu->reduce, 1, NULL, &global, &local,
+                               wait != NULL, wait != NULL ? &wait : NULL, NULL);
+  if (err == CL_SUCCESS) err = clEnqueueNDRangeKernel(gpu->compute, gpu->scan_sums, 1, NULL, &local, &local, 0, NULL, NULL);
+  if (err == CL_SUCCESS) err = clEnqueueNDRangeKernel(gpu->compute, gpu->scan, 1, NULL, &global, &local, 0, NULL, done);
+  return err;
+}
+
+int pps_gpu_scan_into (pps_gpu *gpu, const int *in, int *out, size_t n, const pps_options *opts) {
+  cl_event downloaded[2] = { NULL, NULL }, uploaded, scanned;
+  int exclusive = opts != NULL && opts->mode == PPS_EXCLUSIVE;
+  size_t start, count, s;
+  cl_int err;
+
+  if (gpu == NULL || ((in == NULL || out == NULL) && n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (n == 0) return 0;
+
+  pthread_mutex_lock(&gpu->lock);
+  err = reset_carry(gpu);
+  for (s = 0, start = 0; start < n && err == CL_SUCCESS; s++, start += count) {
+    count = n - start < gpu->slab ? n - start : gpu->slab;
+
+    // Upload into the staging buffer once its previous slab is downloaded
+    err = clEnqueueWriteBuffer(gpu->upload, gpu->staging[s % 2], CL_FALSE, 0, count * sizeof(int), in + start,
+                               downloaded[s % 2] != NULL, downloaded[s % 2] != NULL ? &downloaded[s % 2] : NULL,
+                               &uploaded);
+    if (downloaded[s % 2] != NULL) clReleaseEvent(downloaded[s % 2]);
+    downloaded[s % 2] = NULL;
+    if (err != CL_SUCCESS) break;
+
+    err = scan_slab(gpu, gpu->staging[s % 2], gpu->staging[s % 2], 0, count, exclusive, uploaded, &scanned);
+    clReleaseEvent(uploaded);
+    if (err != CL_SUCCESS) break;
+
+    err = clEnqueueReadBuffer(gpu->download, gpu->staging[s % 2], CL_FALSE, 0, count * sizeof(int), out + start,
+                              1, &scanned, &downloaded[s % 2]);
+    clReleaseEvent(scanned);
+  }
+
+  // Whatever was queued finishes before the buffers are used again
+  clFinish(gpu->upload);
+  clFinish(gpu->compute);
+  if (clFinish(gpu->download) != CL_SUCCESS && err == CL_SUCCESS) err = CL_OUT_OF_RESOURCES;
+  for (s = 0; s < 2; s++) {
+    if (downloaded[s] != NULL) clReleaseEvent(downloaded[s]);
+  }
+  pthread_mutex_unlock(&gpu->lock);
+
+  if (err != CL_SUCCESS) {
+    errno = EIO;
+    return -1;
+  }
+  return 0;
+}
+
+int pps_gpu_scan_buffer (pps_gpu *gpu, cl_mem in, cl_mem out, size_t n, const pps_options *opts) {
+  int exclusive = opts != NULL && opts->mode == PPS_EXCLUSIVE;
+  size_t start, count;
+  cl_int err;
+
+  if (gpu == NULL || ((in == NULL || out == NULL) && n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (n == 0) return 0;
+
+  pthread_mutex_lock(&gpu->lock);
+  err = reset_carry(gpu);
+  for (start = 0; start < n && err == CL_SUCCESS; start += count) {
+    count = n - start < gpu->slab ? n - start : gpu->slab;
+    err = scan_slab(gpu, in, out, start, count, exclusive, NULL, NULL);
+  }
+  if (clFinish(gpu->compute) != CL_SUCCESS && err == CL_SUCCESS) err = CL_OUT_OF_RESOURCES;
+  pthread_mutex_unlock(&gpu->lock);
+
+  if (err != CL_SUCCESS) {
+    errno = EIO;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Function:  offload
+ * ------------------
+ * Offload function of the pools the device is attached to
+ */
+static int offload (void *ctx, const int *in, int *out, size_t n, const pps_options *opts) {
+  return pps_gpu_scan_into((pps_gpu *) ctx, in, out, n, opts);
+}
+
+int pps_gpu_attach (pps_pool *pool, pps_gpu *gpu, size_t min_items) {
+  if (gpu == NULL) return pps_pool_set_offload(pool, NULL, NULL, 0);
+  return pps_pool_set_offload(pool, offload, gpu, min_items > 0 ? min_items : PPS_GPU_MIN_ITEMS);
+}
@@ -0,0 +1,175 @@
+/*
+ * prefixsum-generic.h
+ * -------------------
+ * Prefix sums over any element type and any associative operator.
+ *
+ * PPS_DEFINE_SCAN instantiates a scan-then-propagate algorithm for one element
+ * type and one operator: every thread scans its chunk in place, the chunk totals
+ * go through the two-level exchange of carry.c in padded slots of the element
+ * type, and every thread combines its chunk with the carry it got back. Everything
+ * is expanded at compile time, so the operator is inlined into the loops: there
+ * is no indirect call per element. The operator only has to be associative, not
+ * commutative, since the left operand is always the earlier part of the array,
+ * and it needs no identity element: empty chunks are skipped.
+ *
+ * libprefixsum ships the usual combinations (see the end of prefixsum.h), this
+ * header is only needed for user defined operators. For instance a segmented sum,
+ * where a set flag starts a new running total:
+ *
+ *      typedef struct seg_pair { int flag; long value; } seg_pair;
+ *
+ *      static inline seg_pair seg_add (seg_pair a, seg_pair b) {
+ *        seg_pair r = { a.flag | b.flag, b.flag ? b.value : a.value + b.value };
+ *        return r;
+ *      }
+ *
+ *      PPS_DEFINE_SCAN(seg_scan, seg_pair, seg_add)
+ *
+ * defines "int seg_scan (pps_pool *pool, seg_pair *data, size_t n, int nthreads)"
+ * with the same semantics as "pps_scan".
+ */
+
+#ifndef PREFIXSUM_GENERIC_H
+#define PREFIXSUM_GENERIC_H
+
+#include <errno.h>
+
+#include "prefixsum.h"
+
+// Built-in operators, usable as the OP argument of PPS_DEFINE_SCAN
+#define PPS_OP_SUM(a, b) ((a) + (b))
+#define PPS_OP_MAX(a, b) ((a) < (b) ? (b) : (a))
+#define PPS_OP_MIN(a, b) ((b) < (a) ? (b) : (a))
+#define PPS_OP_XOR(a, b) ((a) ^ (b))
+
+// Prototype of the function defined by PPS_DEFINE_SCAN
+#define PPS_DECLARE_SCAN(name, T) \
+  int name (pps_pool *pool, T *data, size_t n, int nthreads)
+
+/*
+ * Macro:  PPS_DEFINE_SCAN
+ * -----------------------
+ * Defines an inclusive, in place parallel prefix sum. The thread count follows the
+ * pool's crossovers ("pps_pool_threads") and the phases are synchronised with the
+ * pool's barrier ("pps_pool_set_barrier")
+ *
+ * name: name of the function to define, helpers get it as a prefix
+ * T: element type
+ * OP: function or function-like macro combining two elements, OP(earlier, later)
+ */
+#define PPS_DEFINE_SCAN(name, T, OP) \
+                                                                                        \
+  /* Total of a chunk or a group of chunks, in its own cache line. "valid" is 0 for */  \
+  /* an empty range, as there is no identity element to stand for it */                 \
+  typedef struct name##_slot {                                                          \
+    T value;                                                                            \
+    int valid;                                                                          \
+  } __attribute__((aligned(64))) name##_slot;                                           \
+                                                                                        \
+  /* Data structure describing one prefix sum, shared by all threads */                 \
+  typedef struct name##_job {                                                           \
+    pps_pool *pool; /* Pool running the job */                                          \
+    T *data; /* Global array pointer */                                                 \
+    size_t n; /* Number of elements in "data" */                                        \
+    const size_t *bounds; /* Chunk boundaries, see "pps_pool_partition" */              \
+    int group_size; /* Threads per group of the carry exchange */                       \
+    name##_slot *totals; /* Chunk total of every thread */                              \
+    name##_slot *group_totals; /* Total of every group of threads */                    \
+  } name##_job;                                                                         \
+                                                                                        \
+  /* Phase 1 - Prefix sum of own chunk in place */                                      \
+  static void name##_thread_prefix_sum (T *data, size_t start_index, size_t end_index) {\
+    size_t i;                                                                           \
+    for (i = start_index + 1; i < end_index; i++) {                                     \
+      data[i] = OP(data[i-1], data[i]);                                                 \
+    }                                                                                   \
+  }                                                                                     \
+                                                                                        \
+  /* Appends the range of "x" to the range of "acc", which comes before it */           \
+  static inline void name##_append (name##_slot *acc, const name##_slot *x) {           \
+    if (!x->valid) return;                                                              \
+    acc->value = acc->valid ? OP(acc->value, x->value) : x->value;                      \
+    acc->valid = 1;                                                                     \
+  }                                                                                     \
+                                                                                        \
+  /* Phase 2 - Two-level scan of the chunk totals, as in carry.c: within the group */   \
+  /* of the thread, then over the groups before it */                                   \
+  static name##_slot name##_carry_exchange (name##_job *job, int id, int nthreads,      \
+                                            const name##_slot *total) {                 \
+    int group = id / job->group_size;                                                   \
+    int first = group * job->group_size; /* First thread of own group */                \
+    int last = first + job->group_size - 1; /* Last thread of own group */              \
+    name##_slot prefix, carry;                                                          \
+    int i;                                                                              \
+                                                                                        \
+    if (last > nthreads - 1) last = nthreads - 1;                                       \
+    prefix.valid = 0;                                                                   \
+    carry.valid = 0;                                                                    \
+                                                                                        \
+    job->totals[id] = *total;                                                           \
+    pps_pool_barrier(job->pool); /* All chunk totals are published */                   \
+                                                                                        \
+    for (i = first; i < id; i++) name##_append(&prefix, &job->totals[i]);               \
+    if (id == last) {                                                                   \
+      job->group_totals[group] = prefix;                                                \
+      name##_append(&job->group_totals[group], total);                                  \
+    }                                                                                   \
+    pps_pool_barrier(job->pool); /* All group totals are published */                   \
+                                                                                        \
+    for (i = 0; i < group; i++) name##_append(&carry, &job->group_totals[i]);           \
+    name##_append(&carry, &prefix);                                                     \
+    return carry;                                                                       \
+  }                                                                                     \
+                                                                                        \
+  /* Phase 3 - Combine own chunk with the carry of the chunks before */                 \
+  static void name##_update_local_values (T *data, size_t start_index, size_t end_index,\
+                                          T carry) {                                    \
+    size_t i;                                                                           \
+    for (i = start_index; i < end_index; i++) {                                         \
+      data[i] = OP(carry, data[i]);                                                     \
+    }                                                                                   \
+  }                                                                                     \
+                                                                                        \
+  static void name##_thread_function (void *ctx, int id, int nthreads) {                \
+    name##_job *job = (name##_job *) ctx;                                               \
+    size_t start_index, end_index;                                                      \
+    name##_slot total, carry;                                                           \
+                                                                                        \
+    pps_chunk_bounds(job->bounds, id, &start_index, &end_index);                        \
+    name##_thread_prefix_sum(job->data, start_index, end_index);                        \
+    total.valid = end_index > start_index;                                              \
+    if (total.valid) total.value = job->data[end_index - 1];                            \
+    carry = name##_carry_exchange(job, id, nthreads, &total);                           \
+    if (carry.valid) {                                                                  \
+      name##_update_local_values(job->data, start_index, end_index, carry.value);       \
+    }                                                                                   \
+  }                                                                                     \
+                                                                                        \
+  PPS_DECLARE_SCAN(name, T) {                                                           \
+    name##_job job;                                                                     \
+                                                                                        \
+    if (pool == NULL || (data == NULL && n > 0)) {                                      \
+      errno = EINVAL;                                                                   \
+      return -1;                                                                        \
+    }                                                                                   \
+    nthreads = pps_pool_threads(pool, n, nthreads);                                     \
+    if (nthreads == 1) { /* Not worth waking anybody up */                              \
+      name##_thread_prefix_sum(data, 0, n);                                             \
+      return 0;                                                                         \
+    }                                                                                   \
+                                                                                        \
+    name##_slot slots[2 * nthreads]; /* Scratch space of Phase 2 */                     \
+    size_t bounds[nthreads + 1];                                                        \
+                                                                                        \
+    job.pool = pool;                                                                    \
+    job.data = data;                                                                    \
+    job.n = n;                                                                          \
+    pps_pool_partition(pool, n, nthreads, data, sizeof(T), bounds);                     \
+    job.bounds = bounds;                                                                \
+    job.group_size = pps_carry_group_size(pool, nthreads);                              \
+    job.totals = slots;                                                                 \
+    job.group_totals = slots + nthreads;                                                \
+    return pps_pool_run(pool, nthreads, name##_thread_function, &job);                  \
+  }
+
+#endif
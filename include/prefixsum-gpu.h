@@ -0,0 +1,99 @@
+/*
+ * prefixsum-gpu.h
+ * ---------------
+ * Prefix sums on an OpenCL device (libprefixsum-gpu, "make gpu").
+ *
+ * The device runs the three phase algorithm over tiles of 4096 elements: every
+ * work-group sums its tile, one work-group scans the tile sums, and every
+ * work-group scans its tile from its carry. Host arrays go through in slabs of up
+ * to 16M elements, double buffered on three queues, so the upload of a slab, the
+ * scan of the one before and the download of the one before that overlap. Arrays
+ * already in device memory are scanned where they are.
+ *
+ * "pps_gpu_attach" makes a pool route its large scans to the device, so that
+ * callers of "pps_scan_into" don't need to know where a scan runs.
+ */
+
+#ifndef PREFIXSUM_GPU_H
+#define PREFIXSUM_GPU_H
+
+#define CL_TARGET_OPENCL_VERSION 120
+#include <CL/cl.h>
+
+#include "prefixsum.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Default smallest scan "pps_gpu_attach" routes to the device, below which the
+// transfers cost more than the pool's scan
+#define PPS_GPU_MIN_ITEMS ((size_t) 1 << 24)
+
+typedef struct pps_gpu pps_gpu; // Opaque handle of a device with its queues and kernels
+
+/*
+ * Function:  pps_gpu_create
+ * -------------------------
+ * Builds the kernels for a device
+ *
+ * device: the device to use, NULL for the first GPU of the first platform having one
+ *
+ * returns: the handle, NULL with errno set on failure (ENODEV without a device)
+ */
+pps_gpu *pps_gpu_create (cl_device_id device);
+
+/*
+ * Function:  pps_gpu_destroy
+ * --------------------------
+ * Releases the device resources of a handle (NULL is ignored)
+ */
+void pps_gpu_destroy (pps_gpu *gpu);
+
+/*
+ * Function:  pps_gpu_scan_into
+ * ----------------------------
+ * Prefix sum of the host array [in, in + n) into "out" (may be "in") on the device,
+ * with the transfers pipelined with the scan. opts->mode applies, the other
+ * options are for the pool and ignored.
+ */
+int pps_gpu_scan_into (pps_gpu *gpu, const int *in, int *out, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_gpu_scan_buffer
+ * ------------------------------
+ * Prefix sum of n ints of the device buffer "in" into "out" (may be "in"), both
+ * created in the context of "pps_gpu_context", without any transfer. Returns once
+ * the scan has completed.
+ */
+int pps_gpu_scan_buffer (pps_gpu *gpu, cl_mem in, cl_mem out, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_gpu_context
+ * --------------------------
+ * returns: the OpenCL context of the handle, for creating buffers of its device
+ */
+cl_context pps_gpu_context (const pps_gpu *gpu);
+
+/*
+ * Function:  pps_gpu_queue
+ * ------------------------
+ * returns: the in-order queue running the scans of "pps_gpu_scan_buffer", for
+ *          transfers that must come before or after them
+ */
+cl_command_queue pps_gpu_queue (const pps_gpu *gpu);
+
+/*
+ * Function:  pps_gpu_attach
+ * -------------------------
+ * Routes the scans of "pool" of at least "min_items" elements (0 for
+ * PPS_GPU_MIN_ITEMS) to the device, see "pps_pool_set_offload". The handle must
+ * outlive the route, NULL removes it.
+ */
+int pps_gpu_attach (pps_pool *pool, pps_gpu *gpu, size_t min_items);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * prefixsum-mpi.h
+ * ---------------
+ * Distributed prefix sums over MPI ranks (libprefixsum-mpi, "make mpi").
+ *
+ * A global array is split into one shard per rank, in rank order. Every rank scans
+ * its shard on its own pool, as "pps_scan_into" does, and the ranks exchange the
+ * totals of their shards; each rank then adds the sum of the shards before its own.
+ * It is the three phase algorithm of prefix-sum.c one level up, with MPI_Exscan as
+ * Phase 2.
+ *
+ * All ranks of "comm" must call these functions collectively, with the same number
+ * of arrays and the same options. Only the calling thread makes MPI calls, so
+ * MPI_THREAD_FUNNELED is enough.
+ */
+
+#ifndef PREFIXSUM_MPI_H
+#define PREFIXSUM_MPI_H
+
+#include <mpi.h>
+
+#include "prefixsum.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Function:  pps_mpi_scan_into
+ * ----------------------------
+ * Prefix sum of the global array made of the shards [in, in + n) of all ranks,
+ * written to "out" (may be "in"). "n" may differ from rank to rank and be 0.
+ * "opts" as for "pps_scan_into".
+ */
+int pps_mpi_scan_into (pps_pool *pool, MPI_Comm comm, const int *in, int *out, size_t n,
+                       const pps_options *opts);
+
+/*
+ * Function:  pps_mpi_scan
+ * -----------------------
+ * In place version of "pps_mpi_scan_into"
+ */
+int pps_mpi_scan (pps_pool *pool, MPI_Comm comm, int *data, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_mpi_scan_batch
+ * -----------------------------
+ * Distributed prefix sums of "count" global arrays, arrays[i] being this rank's
+ * shard of array i. The exchange of the totals of array i runs while the shards
+ * of array i + 1 are scanned, so the network latency hides behind local work.
+ * A rank whose local work fails keeps taking part in the exchanges, so the others
+ * never hang; it and the ranks after it return -1 once they are done.
+ */
+int pps_mpi_scan_batch (pps_pool *pool, MPI_Comm comm, const pps_array *arrays, size_t count,
+                        const pps_options *opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1010 @@
+/*
+ * prefixsum.h
+ * -----------
+ * Public interface of the parallel prefix sum library (libprefixsum).
+ *
+ * A pool of worker threads is created once with "pps_pool_create" and reused by
+ * every call to "pps_scan". The array length and the number of threads are given
+ * at runtime; the thread count is only an upper bound, small arrays are scanned
+ * with fewer threads (or sequentially) so that they don't pay for the whole pool.
+ *
+ * Unless stated otherwise, functions returning int return 0 on success and -1 on
+ * failure with errno set.
+ */
+
+#ifndef PREFIXSUM_H
+#define PREFIXSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Minimum number of elements worth giving to a thread of its own
+#define PPS_MIN_ITEMS_PER_THREAD 16384
+
+typedef struct pps_pool pps_pool; // Opaque handle of a persistent worker pool
+
+// Algorithm used to compute a parallel prefix sum
+typedef enum pps_engine {
+  PPS_ENGINE_THREE_PHASE, // Local scan, thread 0 fixes chunk tails, local update (2 barriers)
+  PPS_ENGINE_LOOKBACK, // Single pass over tiles with decoupled look-back (no barriers)
+  PPS_ENGINE_BLOCKED, // Three phases over L2 sized tiles, reduce then scan (one write pass)
+  PPS_ENGINE_DYNAMIC // Look-back over tiles pulled from a shared counter, for noisy hosts
+} pps_engine;
+
+// Instruction set used by the inner loops of every engine
+typedef enum pps_isa {
+  PPS_ISA_AUTO, // Best one reported by CPUID
+  PPS_ISA_SCALAR, // Plain C loops
+  PPS_ISA_SSE2, // 4 elements per vector
+  PPS_ISA_AVX2, // 8 elements per vector
+  PPS_ISA_AVX512 // 16 elements per vector
+} pps_isa;
+
+// Whether element i of the result includes element i of the input
+typedef enum pps_mode {
+  PPS_INCLUSIVE, // out[i] = in[0] + ... + in[i]
+  PPS_EXCLUSIVE // out[i] = in[0] + ... + in[i-1], out[0] = 0
+} pps_mode;
+
+// Barrier used between the phases of the chunked engines
+typedef enum pps_barrier {
+  PPS_BARRIER_DEFAULT, // The pool's, see "pps_pool_set_barrier"
+  PPS_BARRIER_PTHREAD, // pthread_barrier_t (mutex and futex on every crossing)
+  PPS_BARRIER_SPIN, // Sense-reversing atomic barrier, spins with backoff
+  PPS_BARRIER_HYBRID // Atomic barrier that spins for a while, then sleeps on a futex
+} pps_barrier;
+
+// How the final write pass of a scan stores its results
+typedef enum pps_stores {
+  PPS_STORES_AUTO, // Streaming once the arrays outgrow the last level cache
+  PPS_STORES_CACHED, // Ordinary stores, the result stays in cache for whoever reads it next
+  PPS_STORES_STREAMING // Non-temporal stores, no read for ownership, no cache pollution
+} pps_stores;
+
+// Placement of the worker threads of a pool on the CPUs
+typedef enum pps_affinity {
+  PPS_AFFINITY_NONE, // Workers may run on any allowed CPU, placed by the OS
+  PPS_AFFINITY_COMPACT, // Worker i pinned to the i-th allowed CPU, node after node
+  PPS_AFFINITY_NUMA // Workers spread over the NUMA nodes, consecutive ids on the same node
+} pps_affinity;
+
+// Tuning knobs of a prefix sum, set to defaults by "pps_options_init"
+typedef struct pps_options {
+  int nthreads; // Upper bound on the number of threads, 0 for the whole pool
+  pps_engine engine; // Algorithm to use
+  size_t tile_size; // Elements per tile for tiled engines, 0 to derive it from the caches
+  pps_isa isa; // Kernels to use, forcing one the CPU lacks fails with ENOTSUP
+  pps_mode mode; // Inclusive or exclusive prefix sum
+  pps_barrier barrier; // Phase synchronisation of the chunked engines
+  size_t chunk_align; // Alignment of chunk starts in bytes, 0 for a line (a page with NUMA pinning)
+  pps_stores stores; // Stores of the final write pass (three phase, look-back and blocked engines)
+} pps_options;
+
+/*
+ * Function:  pps_pool_create
+ * --------------------------
+ * Creates a pool of parked worker threads
+ *
+ * nthreads: number of worker threads, or 0 to use one per online CPU
+ *
+ * returns: the pool, or NULL on failure
+ */
+pps_pool *pps_pool_create (int nthreads);
+
+/*
+ * Function:  pps_pool_destroy
+ * ---------------------------
+ * Releases the worker threads, waits for them to exit and frees the pool
+ *
+ * pool: pool returned by "pps_pool_create" (NULL is ignored)
+ */
+void pps_pool_destroy (pps_pool *pool);
+
+/*
+ * Function:  pps_pool_set_barrier
+ * -------------------------------
+ * Sets the barrier used by jobs asking for PPS_BARRIER_DEFAULT (PPS_BARRIER_PTHREAD
+ * unless changed). PPS_BARRIER_SPIN is fastest when every worker has a core of its
+ * own, PPS_BARRIER_HYBRID is the safe choice on shared or oversubscribed hosts.
+ */
+void pps_pool_set_barrier (pps_pool *pool, pps_barrier barrier);
+
+/*
+ * Function:  pps_pool_set_affinity
+ * --------------------------------
+ * Pins the workers of a pool to CPUs (Linux only, ENOTSUP elsewhere). With
+ * PPS_AFFINITY_NUMA the workers are dealt out to the nodes in proportion to their
+ * CPUs, so that the contiguous chunks of neighbouring workers live on one node, and
+ * Phase 2 groups its threads by node. PPS_AFFINITY_NONE removes the pinning.
+ *
+ * Pages are placed on the node of the thread touching them first, so arrays should
+ * come from "pps_alloc" (or be initialised with "pps_init") on the same pool.
+ */
+int pps_pool_set_affinity (pps_pool *pool, pps_affinity affinity);
+
+/*
+ * Function:  pps_pool_set_weights
+ * -------------------------------
+ * Sets the relative speed of every worker, for machines mixing fast and slow cores
+ * (P-cores and E-cores). The chunked engines then give every worker a share of the
+ * array proportional to its weight. Only meaningful with pinned workers.
+ *
+ * weights: pps_pool_size(pool) positive values, NULL to make all workers equal
+ */
+int pps_pool_set_weights (pps_pool *pool, const double *weights);
+
+/*
+ * Function:  pps_pool_calibrate
+ * -----------------------------
+ * Measures at which array sizes the vector kernels beat the scalar loop and each
+ * thread count beats the smaller ones, with the engine and options in "opts", and
+ * makes the pool's scans follow this crossover table instead of
+ * PPS_MIN_ITEMS_PER_THREAD. Takes about a second, and should run before the pool
+ * is used by other threads.
+ */
+int pps_pool_calibrate (pps_pool *pool, const pps_options *opts);
+
+/*
+ * Function:  pps_pool_save_tuning
+ * -------------------------------
+ * Writes the crossover table of a calibrated pool to a text file
+ */
+int pps_pool_save_tuning (pps_pool *pool, const char *path);
+
+/*
+ * Function:  pps_pool_load_tuning
+ * -------------------------------
+ * Loads a crossover table written by "pps_pool_save_tuning" (or the benchmark's -c
+ * option), instead of calibrating
+ */
+int pps_pool_load_tuning (pps_pool *pool, const char *path);
+
+// Scan run elsewhere than on the workers (an accelerator), same contract as
+// "pps_scan_into"
+typedef int (*pps_offload_fn) (void *ctx, const int *in, int *out, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_pool_set_offload
+ * -------------------------------
+ * Routes the scans of the pool ("pps_scan_into" and everything built on it) of at
+ * least "min_items" elements to "fn" instead of the workers, e.g. the GPU backend
+ * of include/prefixsum-gpu.h. NULL removes the route.
+ */
+int pps_pool_set_offload (pps_pool *pool, pps_offload_fn fn, void *ctx, size_t min_items);
+
+/*
+ * Function:  pps_pool_size
+ * ------------------------
+ * returns: the number of worker threads owned by the pool
+ */
+int pps_pool_size (const pps_pool *pool);
+
+// Function executed by each active worker of a pool job
+// ctx: job specific data, id: worker id, nthreads: number of active workers
+typedef void (*pps_task_fn) (void *ctx, int id, int nthreads);
+
+/*
+ * Function:  pps_pool_run
+ * -----------------------
+ * Wakes up the first "nthreads" workers of the pool, runs "fn" on each of them and
+ * waits until all of them have returned. Concurrent callers are serialised.
+ */
+int pps_pool_run (pps_pool *pool, int nthreads, pps_task_fn fn, void *ctx);
+
+/*
+ * Function:  pps_pool_barrier
+ * ---------------------------
+ * Barrier across the active workers of the job currently running on the pool.
+ * Must only be called from inside a "pps_task_fn".
+ *
+ * These two functions, with "pps_carry_group_size", are what the typed scans of
+ * prefixsum-generic.h are built on, they can also be used to run any other data
+ * parallel job on the pool.
+ */
+void pps_pool_barrier (pps_pool *pool);
+
+/*
+ * Function:  pps_carry_group_size
+ * -------------------------------
+ * returns: the number of consecutive workers whose chunk totals are added up
+ *          together in the first level of the carry exchange of a job of nthreads
+ *          workers: one NUMA node when the pool is pinned that way, about
+ *          sqrt(nthreads) otherwise
+ */
+int pps_carry_group_size (const pps_pool *pool, int nthreads);
+
+/*
+ * Function:  pps_pool_partition
+ * -----------------------------
+ * Splits n elements of "size" bytes into the contiguous chunks of nthreads workers
+ * the way the built-in engines do: the remainder of the division is spread over
+ * the workers, chunk sizes follow the worker weights ("pps_pool_set_weights") and
+ * chunk starts fall on cache lines of "base" (pages when pinned by NUMA node)
+ *
+ * base: array the chunks are written to (only its address is used)
+ * bounds: receives nthreads + 1 indices, chunk i is [bounds[i], bounds[i + 1])
+ */
+void pps_pool_partition (const pps_pool *pool, size_t n, int nthreads, const void *base, size_t size,
+                         size_t *bounds);
+
+/*
+ * Function:  pps_chunk_bounds
+ * ---------------------------
+ * Computes the chunk of a thread as [start_index, end_index) from the bounds set by
+ * "pps_pool_partition"
+ */
+static inline void pps_chunk_bounds (const size_t *bounds, int id, size_t *start_index, size_t *end_index) {
+  *start_index = bounds[id];
+  *end_index = bounds[id + 1];
+}
+
+/*
+ * Function:  pps_choose_threads
+ * -----------------------------
+ * Picks the number of threads used to scan an array, so that every thread gets
+ * at least PPS_MIN_ITEMS_PER_THREAD elements
+ *
+ * n: number of elements in the array
+ * max_threads: upper bound on the number of threads
+ *
+ * returns: a thread count between 1 and max_threads
+ */
+int pps_choose_threads (size_t n, int max_threads);
+
+/*
+ * Function:  pps_pool_threads
+ * ---------------------------
+ * Picks the number of threads the pool scans an array with, from its crossover
+ * table once calibrated ("pps_pool_calibrate", "pps_pool_load_tuning"), with
+ * "pps_choose_threads" otherwise
+ *
+ * n: number of elements in the array
+ * nthreads: upper bound on the number of threads, 0 (or too large) for the pool
+ *
+ * returns: a thread count between 1 and the bound
+ */
+int pps_pool_threads (const pps_pool *pool, size_t n, int nthreads);
+
+// Function filling "count" elements of an array, the first of them at index
+// "start", called in parallel by "pps_init"
+typedef void (*pps_fill_fn) (int *data, size_t start, size_t count, void *ctx);
+
+/*
+ * Function:  pps_init
+ * -------------------
+ * Initialises an array on the worker pool, every worker writing the chunk it will
+ * get in a scan of the same length and thread count (three phase and blocked
+ * engines, default chunk alignment). Used on fresh memory this puts every chunk
+ * on the NUMA node of its worker.
+ *
+ * nthreads: the bound that will be given to the scans, 0 for the whole pool
+ * fill: function writing a chunk, or NULL to zero it
+ */
+int pps_init (pps_pool *pool, int *data, size_t n, int nthreads, pps_fill_fn fill, void *ctx);
+
+/*
+ * Function:  pps_alloc
+ * --------------------
+ * Allocates a page aligned array of n ints and zeroes it with "pps_init", so the
+ * pages are first touched by the workers that will scan them. Arrays of 2MB or
+ * more are 2MB aligned and backed by transparent huge pages where available.
+ *
+ * returns: the array, to be released with "pps_free", or NULL on failure
+ */
+int *pps_alloc (pps_pool *pool, size_t n, int nthreads);
+
+/*
+ * Function:  pps_free
+ * -------------------
+ * Releases an array returned by "pps_alloc" (NULL is ignored)
+ */
+void pps_free (int *data);
+
+typedef struct pps_arena pps_arena; // Opaque bump allocator of aligned buffers
+
+/*
+ * Function:  pps_arena_create
+ * ---------------------------
+ * Creates an arena handing out 64 byte aligned buffers, 2MB aligned and huge page
+ * backed from 2MB on. The arena isn't thread safe.
+ *
+ * capacity: bytes to allocate up front, 0 to grow on demand
+ */
+pps_arena *pps_arena_create (size_t capacity);
+
+/*
+ * Function:  pps_arena_alloc
+ * --------------------------
+ * returns: a buffer of "bytes" bytes valid until the next reset, NULL on failure
+ */
+void *pps_arena_alloc (pps_arena *arena, size_t bytes);
+
+/*
+ * Function:  pps_arena_reset
+ * --------------------------
+ * Makes all the buffers of the arena available again. If they took more than one
+ * block, the blocks are merged so that the same buffers fit without allocating.
+ */
+void pps_arena_reset (pps_arena *arena);
+
+/*
+ * Function:  pps_arena_destroy
+ * ----------------------------
+ * Frees the arena and all its buffers (NULL is ignored)
+ */
+void pps_arena_destroy (pps_arena *arena);
+
+/*
+ * Function:  pps_best_isa
+ * -----------------------
+ * returns: the widest instruction set this CPU supports, which PPS_ISA_AUTO picks
+ */
+pps_isa pps_best_isa (void);
+
+/*
+ * Function:  pps_sequential
+ * -------------------------
+ * Computes the inclusive prefix sum of an array **in place** sequentially
+ */
+void pps_sequential (int *data, size_t n);
+
+/*
+ * Function:  pps_scan
+ * -------------------
+ * Computes the inclusive prefix sum of an array **in place** on the worker pool.
+ * Calls from several threads on the same pool are serialised.
+ *
+ * pool: worker pool
+ * data: array with elements whose prefix sum we want to calculate
+ * n: number of elements in "data" array
+ * nthreads: upper bound on the number of threads to use, or 0 for the whole pool
+ */
+int pps_scan (pps_pool *pool, int *data, size_t n, int nthreads);
+
+/*
+ * Function:  pps_options_init
+ * ---------------------------
+ * Fills in the default options (whole pool, three phase engine, default tile size,
+ * kernels picked from CPUID, inclusive, the pool's barrier, default chunk alignment)
+ */
+void pps_options_init (pps_options *opts);
+
+/*
+ * Function:  pps_scan_opts
+ * ------------------------
+ * Same as "pps_scan", with the algorithm and its tuning given by "opts"
+ * (NULL means the defaults of "pps_options_init")
+ */
+int pps_scan_opts (pps_pool *pool, int *data, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_scan_into
+ * ------------------------
+ * Out of place prefix sum: "in" is left untouched and the result goes to "out".
+ * Reading the input and writing the output are fused into the phases of every
+ * engine, so this costs no more memory traffic than the in place scan. "in" and
+ * "out" may be the same array, but must not overlap otherwise.
+ */
+int pps_scan_into (pps_pool *pool, const int *in, int *out, size_t n, const pps_options *opts);
+
+// One array of a batch, scanned from "in" to "out" (which may be the same array)
+typedef struct pps_array {
+  const int *in;
+  int *out;
+  size_t n;
+} pps_array;
+
+/*
+ * Function:  pps_scan_batch
+ * -------------------------
+ * Prefix sums of "count" independent arrays in a single pool job. Arrays of up to
+ * a tile (opts->tile_size, half the L2 by default) are scanned by one thread each,
+ * longer ones are split into tiles across threads. All threads pull from one tile
+ * schedule, so there is no synchronisation between the arrays. "opts" as for
+ * "pps_scan_into", the engine is ignored.
+ */
+int pps_scan_batch (pps_pool *pool, const pps_array *arrays, size_t count, const pps_options *opts);
+
+// Function receiving final prefix sums: sums[0 .. count - 1] are those of the
+// elements start to start + count - 1 (inclusive or exclusive, as asked for) and
+// "carry" the sum of all mapped values before element "start", in both modes
+typedef void (*pps_consume_fn) (const int *sums, size_t start, size_t count, int carry, void *ctx);
+
+// Predicate of the compaction functions, non zero to keep a value
+typedef int (*pps_predicate_fn) (int value, void *ctx);
+
+/*
+ * Function:  pps_scan_transform
+ * -----------------------------
+ * Fused map, scan and consume pipeline: the prefix sum of the values written by
+ * "map" (called on cache sized ranges of [0, n), like the fill function of
+ * "pps_init"), handed to "consume" range by range as they are computed. The mapped
+ * values are never stored, and the sums only if "out" isn't NULL. "map" is called
+ * twice on every range, from any worker, and "consume" once, from the worker
+ * computing the range. "opts" as for "pps_scan_into", the engine is ignored.
+ *
+ * out: receives the n prefix sums, may be NULL
+ * consume: called with every range of sums, may be NULL
+ * total: receives the sum of all mapped values, may be NULL
+ */
+int pps_scan_transform (pps_pool *pool, size_t n, pps_fill_fn map, void *map_ctx, int *out,
+                        pps_consume_fn consume, void *consume_ctx, int *total, const pps_options *opts);
+
+/*
+ * Function:  pps_compact
+ * ----------------------
+ * Stream compaction: copies the elements of "in" for which "keep" holds (non zero
+ * elements if "keep" is NULL) to the front of "out", in order, in one fused
+ * flag - scan - scatter pipeline. "in" and "out" must not overlap. n is at most
+ * INT_MAX.
+ *
+ * kept: receives the number of elements copied, may be NULL
+ */
+int pps_compact (pps_pool *pool, const int *in, int *out, size_t n, pps_predicate_fn keep, void *ctx,
+                 size_t *kept, const pps_options *opts);
+
+/*
+ * Function:  pps_split
+ * --------------------
+ * Stable partition: same as "pps_compact", followed in "out" by the other elements
+ * in order, so all n elements are copied
+ */
+int pps_split (pps_pool *pool, const int *in, int *out, size_t n, pps_predicate_fn keep, void *ctx,
+               size_t *kept, const pps_options *opts);
+
+// Function writing the buckets of values[0 .. count - 1] to "buckets", below the
+// bucket count, called on short ranges from any worker by "pps_histogram" and
+// "pps_bucket" so that the call costs little per element
+typedef void (*pps_bucket_fn) (const int *values, unsigned *buckets, size_t count, void *ctx);
+
+/*
+ * Function:  pps_histogram
+ * ------------------------
+ * Counts the elements of "in" falling in every bucket, with a private count table
+ * per worker merged in parallel, so workers never share a counter. "bucket" may be
+ * NULL for the values themselves; indices past the last bucket (negative values
+ * included) count in the last one. n is at most INT_MAX. "opts" as for
+ * "pps_scan_into", the engine is ignored.
+ *
+ * counts: receives the "nbuckets" counts
+ */
+int pps_histogram (pps_pool *pool, const int *in, size_t n, pps_bucket_fn bucket, void *ctx, size_t nbuckets,
+                   size_t *counts, const pps_options *opts);
+
+/*
+ * Function:  pps_bucket
+ * ---------------------
+ * Stable bucketing (counting sort by bucket): copies the elements of "in" to "out"
+ * bucket after bucket, in their order within every bucket, from the histogram of
+ * every worker's chunk and an exclusive scan of the counts, calling "bucket" twice
+ * on every element. "in" and "out" must not overlap. Buckets as for
+ * "pps_histogram".
+ *
+ * starts: receives the nbuckets + 1 indices of "out" where the buckets start, the
+ *         last one n, may be NULL
+ */
+int pps_bucket (pps_pool *pool, const int *in, int *out, size_t n, pps_bucket_fn bucket, void *ctx,
+                size_t nbuckets, size_t *starts, const pps_options *opts);
+
+/*
+ * Function:  pps_radix_sort
+ * -------------------------
+ * Sorts n ints in ascending order, in place, with a parallel LSD radix sort of four
+ * 8 bit digits, each a "pps_bucket" pass between the array and a buffer of the
+ * pool's scratch arena. Passes where all keys have the same digit are skipped. n is
+ * at most INT_MAX. "opts" as for "pps_scan_into", the engine is ignored.
+ */
+int pps_radix_sort (pps_pool *pool, int *data, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_scan_u8
+ * ----------------------
+ * Prefix sum of n uint8 elements into "out", decoded on the fly: the elements are
+ * summed at their own width and widened tile by tile into the output, so no int copy
+ * of the input is ever made. "opts" as for "pps_scan_into", the engine and the
+ * stores are ignored. A sum past INT_MAX wraps, the "_i64" variants don't.
+ */
+int pps_scan_u8 (pps_pool *pool, const uint8_t *in, int *out, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_scan_u16
+ * -----------------------
+ * Same as "pps_scan_u8" for uint16 elements
+ */
+int pps_scan_u16 (pps_pool *pool, const uint16_t *in, int *out, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_scan_packed
+ * --------------------------
+ * Same as "pps_scan_u8" for unsigned elements of "bits" bits (1 to 16) packed
+ * without gaps: element i is bits [i * bits, (i + 1) * bits) of "in", least
+ * significant bit first, so "in" holds (n * bits + 7) / 8 bytes
+ */
+int pps_scan_packed (pps_pool *pool, const uint8_t *in, int bits, int *out, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_scan_u8_i64
+ * --------------------------
+ * Same as "pps_scan_u8" with int64 sums, which don't wrap
+ */
+int pps_scan_u8_i64 (pps_pool *pool, const uint8_t *in, int64_t *out, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_scan_u16_i64
+ * ---------------------------
+ * Same as "pps_scan_u16" with int64 sums
+ */
+int pps_scan_u16_i64 (pps_pool *pool, const uint16_t *in, int64_t *out, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_scan_packed_i64
+ * ------------------------------
+ * Same as "pps_scan_packed" with int64 sums
+ */
+int pps_scan_packed_i64 (pps_pool *pool, const uint8_t *in, int bits, int64_t *out, size_t n,
+                         const pps_options *opts);
+
+/*
+ * Function:  pps_scan_segmented_flags
+ * -----------------------------------
+ * Segmented prefix sum: an independent prefix sum restarts at every element whose
+ * flag is non zero (element 0 always starts a segment). All segments are done in
+ * one parallel pass, however many there are. "opts" as for "pps_scan_into", the
+ * engine is ignored.
+ */
+int pps_scan_segmented_flags (pps_pool *pool, const int *in, int *out, size_t n, const uint8_t *flags,
+                              const pps_options *opts);
+
+/*
+ * Function:  pps_scan_segmented_offsets
+ * -------------------------------------
+ * Same as "pps_scan_segmented_flags", with the segments starting at the sorted
+ * indices offsets[0 .. nsegments-1], e.g. the row pointers of a CSR matrix
+ * (offsets past the end are ignored)
+ */
+int pps_scan_segmented_offsets (pps_pool *pool, const int *in, int *out, size_t n, const size_t *offsets,
+                                size_t nsegments, const pps_options *opts);
+
+/*
+ * Function:  pps_scan_2d
+ * ----------------------
+ * Summed-area table of a grid of "height" rows of "width" ints: element (r, c) of
+ * "out" receives the sum of all elements (r', c') of "in" with r' <= r and c' <= c.
+ * Rows are split across threads in bands and the column pass adds whole rows with
+ * SIMD, so nothing strides down a column. "out" may be "in" with the same pitch,
+ * but must not overlap it otherwise. "opts" as for "pps_scan_into", the engine is
+ * ignored and the mode must be PPS_INCLUSIVE.
+ *
+ * in_pitch, out_pitch: elements from the start of one row to the next, at least
+ *                      "width", e.g. for tiles of a larger image or padded rows
+ */
+int pps_scan_2d (pps_pool *pool, const int *in, size_t in_pitch, int *out, size_t out_pitch, size_t width,
+                 size_t height, const pps_options *opts);
+
+/*
+ * Function:  pps_scan_file
+ * ------------------------
+ * Prefix sum of a file holding a flat array of native ints, through memory
+ * mappings (no read/write copies). Chunk starts default to page boundaries, so each
+ * worker only touches the pages of its own chunk.
+ *
+ * input: file to read, scanned in place when "output" is NULL
+ * output: file created (or truncated) to receive the result, or NULL. A name of
+ *         the input file itself (the same path, a hard link or a symbolic link)
+ *         scans it in place.
+ * opts: as for "pps_scan_into", NULL for the defaults
+ */
+int pps_scan_file (pps_pool *pool, const char *input, const char *output, const pps_options *opts);
+
+typedef struct pps_index pps_index; // Opaque prefix sums maintained under point updates
+
+/*
+ * Incremental prefix sums
+ * -----------------------
+ * A "pps_index" keeps the prefix sums of an array that changes element by element,
+ * without scanning it again after every change. The array is cut into blocks
+ * (opts->tile_size elements, 1024 by default) scanned on their own, and the block
+ * totals go into a Fenwick tree:
+ *
+ *      update (pps_index_add, pps_index_set)       O(log(n / block))
+ *      query (pps_index_prefix, pps_index_range)   O(log(n / block)), plus a sum of
+ *                                                  up to one block in a block
+ *                                                  updated since the last flush
+ *
+ * "pps_index_flush" rescans the updated blocks in one pool job; call it once updates
+ * have piled up and queries follow. "pps_index_rebuild" replaces all values in one
+ * parallel pass. An index is not thread safe, except for concurrent queries.
+ */
+
+/*
+ * Function:  pps_index_create
+ * ---------------------------
+ * Creates the index of n elements copied from "values" (NULL for zeros). "opts"
+ * (copied, NULL for the defaults) sets the block size and the thread count,
+ * instruction set and barrier of the scans, and the mode of "pps_index_export"
+ *
+ * returns: the index, or NULL with errno set on failure
+ */
+pps_index *pps_index_create (pps_pool *pool, const int *values, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_index_rebuild
+ * ----------------------------
+ * Replaces every element by "values" (NULL to keep them) and rescans all blocks
+ */
+int pps_index_rebuild (pps_index *index, const int *values);
+
+/*
+ * Function:  pps_index_add
+ * ------------------------
+ * Adds "delta" to element i (EINVAL if i is out of range)
+ */
+int pps_index_add (pps_index *index, size_t i, int delta);
+
+/*
+ * Function:  pps_index_set
+ * ------------------------
+ * Sets element i to "value" (EINVAL if i is out of range)
+ */
+int pps_index_set (pps_index *index, size_t i, int value);
+
+/*
+ * Function:  pps_index_get
+ * ------------------------
+ * returns: element i, which must be in range
+ */
+int pps_index_get (const pps_index *index, size_t i);
+
+/*
+ * Function:  pps_index_prefix
+ * ---------------------------
+ * returns: the inclusive prefix sum of the elements 0 to i, i must be in range
+ */
+int pps_index_prefix (const pps_index *index, size_t i);
+
+/*
+ * Function:  pps_index_range
+ * --------------------------
+ * returns: the sum of the elements in [first, last), 0 if empty
+ */
+int pps_index_range (const pps_index *index, size_t first, size_t last);
+
+/*
+ * Function:  pps_index_flush
+ * --------------------------
+ * Rescans the blocks updated since the last flush, as one batch job on the pool
+ */
+int pps_index_flush (pps_index *index);
+
+/*
+ * Function:  pps_index_pending
+ * ----------------------------
+ * returns: the number of blocks updated since the last flush
+ */
+size_t pps_index_pending (const pps_index *index);
+
+/*
+ * Function:  pps_index_size
+ * -------------------------
+ * returns: the number of elements
+ */
+size_t pps_index_size (const pps_index *index);
+
+/*
+ * Function:  pps_index_export
+ * ---------------------------
+ * Writes the full prefix sums of the current elements to "out", with the engine and
+ * mode of the index's options
+ */
+int pps_index_export (const pps_index *index, int *out);
+
+/*
+ * Function:  pps_index_destroy
+ * ----------------------------
+ * Frees an index (NULL is ignored)
+ */
+void pps_index_destroy (pps_index *index);
+
+typedef struct pps_future pps_future; // Opaque handle of a scan running asynchronously
+
+// Function called once a scan has completed
+typedef void (*pps_future_fn) (pps_future *future, void *ctx);
+
+/*
+ * Asynchronous scans
+ * ------------------
+ * "pps_scan_async" queues a scan and returns at once; a dispatcher thread of the
+ * pool runs the queued scans in order on its workers, with the same result as
+ * "pps_scan_into". Consecutive scans too short for more than one thread each are
+ * merged into one batch job ("pps_scan_batch") as long as none of them reads or
+ * writes the output of an earlier one, so dependent scans still run in order.
+ *
+ *      pps_future *f = pps_scan_async(pool, in, out, n, NULL);
+ *      ...                                        // other work, more submissions
+ *      if (pps_future_wait(f) != 0) perror("scan");
+ *      pps_future_release(f);
+ *
+ * The buffers of a scan must stay valid and untouched until it has completed.
+ * Callbacks run on the dispatcher thread and hold up the scans queued after
+ * theirs, so they should only hand the completion on (post to an event loop,
+ * resume a coroutine, see include/prefixsum.hpp). They may release the future and
+ * submit more scans, but not wait for a scan still queued. "pps_pool_destroy"
+ * completes every queued scan first.
+ */
+
+/*
+ * Function:  pps_scan_async
+ * -------------------------
+ * Queues the prefix sum of [in, in + n) into "out", "opts" as for "pps_scan_into"
+ * (copied, NULL for the defaults)
+ *
+ * returns: the future of the scan, to be released by "pps_future_release", or NULL
+ *          with errno set on failure
+ */
+pps_future *pps_scan_async (pps_pool *pool, const int *in, int *out, size_t n, const pps_options *opts);
+
+/*
+ * Function:  pps_future_poll
+ * --------------------------
+ * returns: 1 if the scan has completed, 0 if it is still queued or running
+ */
+int pps_future_poll (pps_future *future);
+
+/*
+ * Function:  pps_future_wait
+ * --------------------------
+ * Blocks until the scan has completed
+ *
+ * returns: 0, or -1 with errno set as the scan failed
+ */
+int pps_future_wait (pps_future *future);
+
+/*
+ * Function:  pps_future_then
+ * --------------------------
+ * Registers the callback of a scan, called with "ctx" on completion (one per future)
+ *
+ * returns: 0 if registered, 1 if the scan has already completed and "fn" won't be
+ *          called (the caller continues itself), -1 with errno set to EBUSY if the
+ *          future has a callback already
+ */
+int pps_future_then (pps_future *future, pps_future_fn fn, void *ctx);
+
+/*
+ * Function:  pps_future_release
+ * -----------------------------
+ * Lets go of a future. A scan still pending runs all the same, its future is freed
+ * once it has completed (NULL is ignored)
+ */
+void pps_future_release (pps_future *future);
+
+typedef struct pps_stream pps_stream; // Opaque state of a streaming prefix sum
+
+/*
+ * Streaming scans
+ * ---------------
+ * Prefix sum of a sequence of blocks, with the running total carried from block to
+ * block, for data too large to hold in memory. Every block is scanned on the pool,
+ * and the summing of a block overlaps with the writing of the one pushed before it.
+ * A push therefore hands back the previous block, and "pps_stream_finish" the last
+ * one. Memory use does not grow with the length of the stream.
+ *
+ *      pps_stream *s = pps_stream_create(pool, NULL);
+ *      while (read_block(in, out, &n)) {
+ *        pps_stream_push(s, in, out, n, &done);   // done: block pushed before (or NULL)
+ *        ...
+ *      }
+ *      pps_stream_finish(s, &done);               // done: last block
+ *      pps_stream_destroy(s);
+ *
+ * The buffers of a block must stay valid and unchanged until they are handed back,
+ * so callers alternate between (at least) two pairs of buffers. "in" and "out" may
+ * be the same buffer. The engine in "opts" is ignored, mode, thread count,
+ * instruction set, barrier and chunk alignment apply to every block.
+ */
+
+/*
+ * Function:  pps_stream_create
+ * ----------------------------
+ * returns: a stream scanning on "pool" with "opts" (NULL for the defaults), or NULL
+ *          on failure
+ */
+pps_stream *pps_stream_create (pps_pool *pool, const pps_options *opts);
+
+/*
+ * Function:  pps_stream_push
+ * --------------------------
+ * Appends a block of n elements to the stream
+ *
+ * done: set to the "out" buffer of the block completed by this call, NULL when no
+ *       block was pending (first push)
+ */
+int pps_stream_push (pps_stream *stream, const int *in, int *out, size_t n, int **done);
+
+/*
+ * Function:  pps_stream_finish
+ * ----------------------------
+ * Completes the last block pushed. Pushing afterwards continues the same stream.
+ *
+ * done: set to the "out" buffer of the completed block, NULL if there was none
+ */
+int pps_stream_finish (pps_stream *stream, int **done);
+
+/*
+ * Function:  pps_stream_total
+ * ---------------------------
+ * returns: the sum of every element pushed so far
+ */
+int pps_stream_total (const pps_stream *stream);
+
+/*
+ * Function:  pps_stream_destroy
+ * -----------------------------
+ * Frees a stream, dropping a block still pending (NULL is ignored)
+ */
+void pps_stream_destroy (pps_stream *stream);
+
+/*
+ * Instrumentation
+ * ---------------
+ * A library built with "make TRACE=1" (-DPPS_TRACE) times every phase of every
+ * worker and keeps the most recent phases of every worker as a timeline. Otherwise
+ * the hooks are compiled out and the functions below fail with ENOTSUP. They must
+ * be called between scans, not while one is running.
+ */
+
+// Phases of a pool job that are timed
+typedef enum pps_phase {
+  PPS_PHASE_WAKE, // From the job's submission until the worker starts on it
+  PPS_PHASE_LOCAL, // Phase 1: local scan, chunk sums or look-back tiles
+  PPS_PHASE_CARRY, // Phase 2: carry exchange, barrier waits included
+  PPS_PHASE_BARRIER, // Waiting in a barrier
+  PPS_PHASE_FINAL, // Phase 3: adding the carries or scanning the tiles
+  PPS_NPHASES
+} pps_phase;
+
+// Hardware events counted per phase after "pps_pool_enable_counters"
+typedef enum pps_counter {
+  PPS_COUNTER_CACHE_MISSES, // Misses of the cache nearest to memory
+  PPS_COUNTER_LLC_LOADS, // Read accesses to the last level cache
+  PPS_COUNTER_LLC_MISSES, // Reads missing the last level cache
+  PPS_NCOUNTERS
+} pps_counter;
+
+// Accumulated measurements of one worker
+typedef struct pps_thread_stats {
+  double seconds[PPS_NPHASES]; // Time spent in every phase
+  uint64_t count[PPS_NPHASES]; // Number of times every phase was entered
+  uint64_t counters[PPS_NPHASES][PPS_NCOUNTERS]; // Events since the worker's previous phase ended
+} pps_thread_stats;
+
+/*
+ * Function:  pps_pool_stats
+ * -------------------------
+ * Copies the measurements of every worker since the pool was created or last reset
+ *
+ * stats: receives pps_pool_size(pool) entries, indexed by worker id
+ */
+int pps_pool_stats (pps_pool *pool, pps_thread_stats *stats);
+
+/*
+ * Function:  pps_pool_reset_stats
+ * -------------------------------
+ * Clears the measurements and the timeline of the pool
+ */
+int pps_pool_reset_stats (pps_pool *pool);
+
+/*
+ * Function:  pps_pool_enable_counters
+ * -----------------------------------
+ * Starts (or stops) counting hardware events through perf_event, fails with the
+ * error of perf_event_open when the kernel doesn't allow it
+ */
+int pps_pool_enable_counters (pps_pool *pool, int enable);
+
+/*
+ * Function:  pps_pool_dump_trace
+ * ------------------------------
+ * Writes the timeline of the pool in Chrome trace JSON (chrome://tracing, Perfetto),
+ * one row per worker
+ */
+int pps_pool_dump_trace (pps_pool *pool, const char *path);
+
+/*
+ * Function:  pps_phase_name
+ * -------------------------
+ * returns: the printable name of a phase
+ */
+const char *pps_phase_name (pps_phase phase);
+
+/*
+ * Typed scans
+ * -----------
+ * Inclusive, in place prefix sums for other element types and operators, with the
+ * same arguments and semantics as "pps_scan". They are instantiations of
+ * PPS_DEFINE_SCAN (prefixsum-generic.h), which also takes user defined operators.
+ * The int32_t sum is "pps_scan" itself.
+ */
+int pps_scan_i64_sum (pps_pool *pool, int64_t *data, size_t n, int nthreads);
+int pps_scan_u64_sum (pps_pool *pool, uint64_t *data, size_t n, int nthreads);
+int pps_scan_f32_sum (pps_pool *pool, float *data, size_t n, int nthreads);
+int pps_scan_f64_sum (pps_pool *pool, double *data, size_t n, int nthreads);
+
+int pps_scan_i32_max (pps_pool *pool, int32_t *data, size_t n, int nthreads);
+int pps_scan_i64_max (pps_pool *pool, int64_t *data, size_t n, int nthreads);
+int pps_scan_u64_max (pps_pool *pool, uint64_t *data, size_t n, int nthreads);
+int pps_scan_f32_max (pps_pool *pool, float *data, size_t n, int nthreads);
+int pps_scan_f64_max (pps_pool *pool, double *data, size_t n, int nthreads);
+
+int pps_scan_i32_min (pps_pool *pool, int32_t *data, size_t n, int nthreads);
+int pps_scan_i64_min (pps_pool *pool, int64_t *data, size_t n, int nthreads);
+int pps_scan_u64_min (pps_pool *pool, uint64_t *data, size_t n, int nthreads);
+int pps_scan_f32_min (pps_pool *pool, float *data, size_t n, int nthreads);
+int pps_scan_f64_min (pps_pool *pool, double *data, size_t n, int nthreads);
+
+int pps_scan_i32_xor (pps_pool *pool, int32_t *data, size_t n, int nthreads);
+int pps_scan_i64_xor (pps_pool *pool, int64_t *data, size_t n, int nthreads);
+int pps_scan_u64_xor (pps_pool *pool, uint64_t *data, size_t n, int nthreads);
+
+// Rounding of the floating point sums of "pps_scan_f32_sum_with" and
+// "pps_scan_f64_sum_with"
+typedef enum pps_fp_mode {
+  PPS_FP_FAST, // Chunked by thread like "pps_scan_f64_sum", the rounding changes with the thread count
+  PPS_FP_REPRODUCIBLE, // Fixed tiles, the same bits for any thread count
+  PPS_FP_COMPENSATED // Same, with compensated sums whose error doesn't grow with n
+} pps_fp_mode;
+
+#define PPS_FP_TILE ((size_t) 2048) // Elements per tile of the reproducible modes
+
+/*
+ * Function:  pps_scan_f64_sum_with
+ * --------------------------------
+ * Same as "pps_scan_f64_sum", rounded as "mode" says. The reproducible modes sum
+ * every tile of PPS_FP_TILE elements left to right and chain the tile totals left
+ * to right, so the result only depends on the data, not on the thread count or the
+ * host, as long as the library isn't built with -ffast-math. Both read the array
+ * twice and write it once, like the fast mode. The plain one adds the tile carry to
+ * every element on top and takes about 1.2x the time of the fast mode, the
+ * compensated one does about four times the floating point work and takes about
+ * 3.5x (20M doubles, one core), a gap that shrinks with threads once the scan is
+ * bound by memory bandwidth. See src/reproducible.c.
+ */
+int pps_scan_f64_sum_with (pps_pool *pool, double *data, size_t n, int nthreads, pps_fp_mode mode);
+
+/*
+ * Function:  pps_scan_f32_sum_with
+ * --------------------------------
+ * Same as "pps_scan_f64_sum_with" for floats
+ */
+int pps_scan_f32_sum_with (pps_pool *pool, float *data, size_t n, int nthreads, pps_fp_mode mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+// Type generic front end, picks the typed scan from the type of "data"
+#if !defined(__cplusplus) && __STDC_VERSION__ >= 201112L
+
+#define pps_scan_sum(pool, data, n, nthreads) _Generic((data), \
+    int32_t *: pps_scan, int64_t *: pps_scan_i64_sum, uint64_t *: pps_scan_u64_sum, \
+    float *: pps_scan_f32_sum, double *: pps_scan_f64_sum)(pool, data, n, nthreads)
+
+#define pps_scan_max(pool, data, n, nthreads) _Generic((data), \
+    int32_t *: pps_scan_i32_max, int64_t *: pps_scan_i64_max, uint64_t *: pps_scan_u64_max, \
+    float *: pps_scan_f32_max, double *: pps_scan_f64_max)(pool, data, n, nthreads)
+
+#define pps_scan_min(pool, data, n, nthreads) _Generic((data), \
+    int32_t *: pps_scan_i32_min, int64_t *: pps_scan_i64_min, uint64_t *: pps_scan_u64_min, \
+    float *: pps_scan_f32_min, double *: pps_scan_f64_min)(pool, data, n, nthreads)
+
+#define pps_scan_xor(pool, data, n, nthreads) _Generic((data), \
+    int32_t *: pps_scan_i32_xor, int64_t *: pps_scan_i64_xor, \
+    uint64_t *: pps_scan_u64_xor)(pool, data, n, nthreads)
+
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * prefixsum.hpp
+ * -------------
+ * C++20 coroutine interface to the asynchronous scans of libprefixsum, header only.
+ *
+ *      task handle (pps_pool *pool, int *data, size_t n) {
+ *        co_await pps::scan_async(pool, data, data, n);    // throws std::system_error
+ *        ...
+ *      }
+ *
+ * The coroutine suspends until the scan has completed, without blocking its thread,
+ * and resumes on the dispatcher thread of the pool (see "pps_scan_async" in
+ * prefixsum.h), so it should hand itself back to its event loop before doing much
+ * work. It doesn't suspend at all for a scan that has completed already.
+ */
+
+#ifndef PREFIXSUM_HPP
+#define PREFIXSUM_HPP
+
+#include <cerrno>
+#include <coroutine>
+#include <system_error>
+#include <utility>
+
+#include "prefixsum.h"
+
+namespace pps {
+
+// Awaitable owning the future of one asynchronous scan
+class scan_awaitable {
+public:
+  explicit scan_awaitable (pps_future *future) noexcept : future_(future) {}
+  scan_awaitable (scan_awaitable &&other) noexcept : future_(std::exchange(other.future_, nullptr)) {}
+  scan_awaitable (const scan_awaitable &) = delete;
+  scan_awaitable &operator= (const scan_awaitable &) = delete;
+  ~scan_awaitable () { pps_future_release(future_); } // Never awaited: the scan runs detached
+
+  bool await_ready () const noexcept { return pps_future_poll(future_) != 0; }
+
+  // Suspends unless the scan completes before the callback is in place
+  bool await_suspend (std::coroutine_handle<> handle) {
+    handle_ = handle;
+    switch (pps_future_then(future_, resume, this)) {
+    case 0:
+      return true;
+    case 1:
+      return false;
+    default:
+      throw std::system_error(errno, std::generic_category(), "pps_future_then");
+    }
+  }
+
+  void await_resume () const {
+    if (pps_future_wait(future_) != 0) throw std::system_error(errno, std::generic_category(), "pps_scan_async");
+  }
+
+private:
+  static void resume (pps_future *, void *ctx) { static_cast<scan_awaitable *>(ctx)->handle_.resume(); }
+
+  pps_future *future_;
+  std::coroutine_handle<> handle_;
+};
+
+/*
+ * Function:  scan_async
+ * ---------------------
+ * Submits "pps_scan_async" and returns the awaitable of its completion
+ *
+ * throws: std::system_error if the scan can't be submitted
+ */
+inline scan_awaitable scan_async (pps_pool *pool, const int *in, int *out, size_t n,
+                                  const pps_options *opts = nullptr) {
+  pps_future *future = pps_scan_async(pool, in, out, n, opts);
+
+  if (future == nullptr) throw std::system_error(errno, std::generic_category(), "pps_scan_async");
+  return scan_awaitable(future);
+}
+
+} // namespace pps
+
+#endif
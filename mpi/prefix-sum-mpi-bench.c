@@ -0,0 +1,184 @@
+/*
+ * prefix-sum-mpi-bench.c
+ * ----------------------
+ * Scaling benchmark of the distributed prefix sum. Every rank owns a shard of
+ * every array and the time of a repetition is the slowest rank's, between two
+ * MPI_Barriers. Rank 0 prints one CSV line per size:
+ *
+ *      scaling,ranks,nthreads,batch,nitems_per_rank,nitems_total,reps,median_us,p99_us,gbps
+ *
+ * In weak scaling (-n, the default) the sizes are per rank, so the ideal is a
+ * constant time as ranks are added; in strong scaling (-g) they are global sizes
+ * split over the ranks, so the ideal is a time inversely proportional to the
+ * ranks. "gbps" counts one read and one write of every element of the global
+ * arrays. Run it at several rank counts, e.g. "make mpi-bench RANKS='1 2 4 8'".
+ * The result is checked against the closed form of the input after warm-up.
+ *
+ * Usage: mpirun -np R prefix-sum-mpi-bench [-n sizes | -g sizes] [-t threads] [-e engine]
+ *                                          [-k batch] [-r reps] [-w warmup] [-H]
+ *
+ * -n: comma separated shard lengths per rank (weak scaling, default 1e6,1e7)
+ * -g: comma separated global lengths split over the ranks (strong scaling)
+ * -t: worker threads per rank (default the online CPUs)
+ * -e: threephase (default), lookback, blocked or dynamic
+ * -k: arrays per batch, > 1 overlaps the exchange of one with the scan of the next
+ * -H: leave out the CSV header, for appending runs at other rank counts
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefixsum-mpi.h"
+#include "bench.h"
+
+#define MAX_LIST 64
+
+static const char *engine_names[] = { "threephase", "lookback", "blocked", "dynamic" };
+
+#define NENGINES ((int) (sizeof(engine_names) / sizeof(engine_names[0])))
+
+// Element "g" of the input of every global array
+static int input_at (size_t g) {
+  return (int) (g % 5);
+}
+
+// Inclusive prefix sum of the input up to global index "g", wrapping like int adds
+static int expected_at (size_t g) {
+  unsigned long long q = (g + 1) / 5, r = (g + 1) % 5;
+
+  return (int) (unsigned) (q * 10 + r * (r - 1) / 2);
+}
+
+int main (int argc, char *argv[]) {
+  size_t sizes[MAX_LIST], n, first, i, maxn = 0, total;
+  int nsizes = 0, strong = 0, header = 1, reps = 21, warmup = 3, batch = 1, nthreads = 0;
+  int rank, ranks, opt, s, r, b, e, errors = 0;
+  double start, elapsed, slowest, *times;
+  int **shards;
+  pps_array *arrays;
+  pps_options opts;
+  pps_pool *pool;
+  bench_stats stats;
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+  pps_options_init(&opts);
+
+  while ((opt = getopt(argc, argv, "n:g:t:e:k:r:w:H")) != -1) {
+    switch (opt) {
+    case 'g':
+      strong = 1;
+      // Fall through
+    case 'n':
+      nsizes = bench_parse_sizes(optarg, sizes, MAX_LIST);
+      break;
+    case 't':
+      nthreads = atoi(optarg);
+      break;
+    case 'e':
+      for (e = 0; e < NENGINES && strcmp(optarg, engine_names[e]) != 0; e++);
+      if (e == NENGINES) {
+        if (rank == 0) fprintf(stderr, "Unknown engine \"%s\"\n", optarg);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+      }
+      opts.engine = (pps_engine) e;
+      break;
+    case 'k':
+      batch = atoi(optarg) > 0 ? atoi(optarg) : 1;
+      break;
+    case 'r':
+      reps = atoi(optarg) > 0 ? atoi(optarg) : 1;
+      break;
+    case 'w':
+      warmup = atoi(optarg) >= 0 ? atoi(optarg) : 0;
+      break;
+    case 'H':
+      header = 0;
+      break;
+    default:
+      if (rank == 0) {
+        fprintf(stderr, "Usage: %s [-n sizes | -g sizes] [-t threads] [-e engine] [-k batch] [-r reps] [-w warmup] [-H]\n", argv[0]);
+      }
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+  }
+  if (nsizes == 0) {
+    sizes[nsizes++] = 1000000;
+    sizes[nsizes++] = 10000000;
+  }
+
+  // Shard lengths of this rank, the first ranks take the remainder of a strong split
+  for (s = 0; s < nsizes; s++) {
+    n = strong ? sizes[s] / ranks + ((size_t) rank < sizes[s] % ranks) : sizes[s];
+    if (n > maxn) maxn = n;
+  }
+
+  pool = pps_pool_create(nthreads);
+  shards = (int **) calloc(batch, sizeof(int *));
+  arrays = (pps_array *) malloc(batch * sizeof(pps_array));
+  times = (double *) malloc(reps * sizeof(double));
+  if (pool == NULL || shards == NULL || arrays == NULL || times == NULL) {
+    perror("setup");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  opts.nthreads = pps_pool_size(pool);
+  for (b = 0; b < batch; b++) {
+    shards[b] = pps_alloc(pool, maxn, 0);
+    if (shards[b] == NULL && maxn > 0) {
+      perror("pps_alloc");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+  }
+
+  if (rank == 0 && header) {
+    printf("scaling,ranks,nthreads,batch,nitems_per_rank,nitems_total,reps,median_us,p99_us,gbps\n");
+  }
+  for (s = 0; s < nsizes; s++) {
+    n = strong ? sizes[s] / ranks + ((size_t) rank < sizes[s] % ranks) : sizes[s];
+    first = strong ? rank * (sizes[s] / ranks) + ((size_t) rank < sizes[s] % ranks ? (size_t) rank : sizes[s] % ranks)
+                   : rank * sizes[s];
+    total = strong ? sizes[s] : sizes[s] * ranks;
+
+    for (r = -warmup; r < reps; r++) {
+      for (b = 0; b < batch; b++) { // Reset the shards, not timed
+        for (i = 0; i < n; i++) shards[b][i] = input_at(first + i);
+        arrays[b].in = arrays[b].out = shards[b];
+        arrays[b].n = n;
+      }
+      MPI_Barrier(MPI_COMM_WORLD);
+      start = bench_now();
+      if (pps_mpi_scan_batch(pool, MPI_COMM_WORLD, arrays, batch, &opts) != 0) {
+        perror("pps_mpi_scan_batch");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+      }
+      elapsed = bench_now() - start;
+      MPI_Reduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+      if (r >= 0) times[r] = slowest;
+    }
+
+    for (b = 0; b < batch; b++) { // Check the last repetition
+      for (i = 0; i < n && shards[b][i] == expected_at(first + i); i++);
+      errors += i < n;
+    }
+
+    if (rank == 0) {
+      stats = bench_summarise(times, reps);
+      printf("%s,%d,%d,%d,%zu,%zu,%d,%.3f,%.3f,%.3f\n", strong ? "strong" : "weak", ranks, opts.nthreads, batch,
+             strong ? sizes[s] / ranks : sizes[s], total, reps, stats.median * 1e6, stats.p99 * 1e6,
+             2.0 * total * batch * sizeof(int) / stats.median * 1e-9);
+      fflush(stdout);
+    }
+  }
+
+  MPI_Allreduce(MPI_IN_PLACE, &errors, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  if (rank == 0 && errors > 0) fprintf(stderr, "Error: %d shards don't hold the global prefix sum\n", errors);
+
+  for (b = 0; b < batch; b++) pps_free(shards[b]);
+  free(shards); free(arrays); free(times);
+  pps_pool_destroy(pool);
+  MPI_Finalize();
+  return errors > 0 ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * prefix-sum-mpi.c
+ * ----------------
+ * Distributed prefix sums over MPI ranks, the three phase algorithm of
+ * prefix-sum.c one level up:
+ *
+ *      Phase 1 - every rank scans its shard on its pool ("pps_scan_into"), SIMD
+ *                kernels and all, and notes the total of the shard
+ *      Phase 2 - MPI_Iexscan of the shard totals gives every rank the sum of the
+ *                shards of the ranks before it
+ *      Phase 3 - every rank but 0 adds that sum to its shard, again on its pool
+ *
+ * A batch of arrays is pipelined: the exchange of array i is started without
+ * waiting and only completed after Phase 1 of array i + 1, so that the latency of
+ * the network is hidden behind local work. The exchange moves a single int per
+ * rank, so whatever progress the MPI library makes in the background is enough.
+ *
+ * Every rank posts every exchange even after a local failure, so that no rank is
+ * left waiting for an exchange another one never posted. The exchanges carry a
+ * failure count next to the total: a rank stops its local work once it or a rank
+ * before it has failed, and returns the failure after the last exchange.
+ */
+
+#include <errno.h>
+
+#include "internal.h"
+#include "prefixsum-mpi.h"
+
+// Data structure describing one Phase 3, shared by all threads
+typedef struct add_job {
+  int *data; // Shard receiving the carry
+  const size_t *bounds; // Chunk boundaries, see "pps_partition"
+  int carry; // Sum of the shards before this rank's
+  const pps_kernels *k; // Inner loops
+} add_job;
+
+/*
+ * Function:  add_thread
+ * ---------------------
+ * Function that each active worker of the pool executes to add the carry to its
+ * chunk of the shard
+ */
+static void add_thread (void *ctx, int id, int nthreads) {
+  add_job *job = (add_job *) ctx;
+  size_t start_index, end_index;
+
+  (void) nthreads;
+  pps_chunk_bounds(job->bounds, id, &start_index, &end_index);
+  job->k->add(job->data + start_index, job->data + start_index, end_index - start_index, job->carry);
+}
+
+/*
+ * Function:  add_carry
+ * --------------------
+ * Phase 3 of one shard: adds "carry" to its n elements on the pool
+ */
+static int add_carry (pps_pool *pool, int *data, size_t n, int carry, const pps_options *opts) {
+  const pps_kernels *k = pps_get_kernels(opts->isa);
+  int nthreads = pps_job_threads(pool, n, opts->nthreads);
+  add_job job;
+
+  if (k == NULL) return -1; // errno set by pps_get_kernels
+  if (carry == 0 || n == 0) return 0;
+
+  size_t bounds[nthreads + 1];
+
+  pps_partition(pool, n, nthreads, data, opts->chunk_align, bounds);
+  job.data = data;
+  job.bounds = bounds;
+  job.carry = carry;
+  job.k = k;
+
+  if (nthreads == 1) { // Not worth waking anybody up
+    add_thread(&job, 0, 1);
+    return 0;
+  }
+  return pps_pool_run_with(pool, nthreads, add_thread, &job, opts->barrier);
+}
+
+/*
+ * Function:  local_scan
+ * ---------------------
+ * Phase 1 of one shard
+ *
+ * returns: 0 and the total of the shard in "total", or -1 with errno set
+ */
+static int local_scan (pps_pool *pool, const pps_array *array, const pps_options *opts, int *total) {
+  int last = array->n > 0 ? array->in[array->n - 1] : 0; // May be overwritten in place
+
+  if (pps_scan_into(pool, array->in, array->out, array->n, opts) != 0) return -1;
+  *total = 0;
+  if (array->n > 0) {
+    *total = array->out[array->n - 1] + (opts->mode == PPS_EXCLUSIVE ? last : 0);
+  }
+  return 0;
+}
+
+int pps_mpi_scan_batch (pps_pool *pool, MPI_Comm comm, const pps_array *arrays, size_t count,
+                        const pps_options *opts) {
+  int totals[2][2], carries[2][2], rank; // (sum, failures) of two exchanges in flight at most
+  int total, failed = 0, error = 0;
+  MPI_Request requests[2];
+  pps_options defaults;
+  size_t i;
+
+  if (pool == NULL || (arrays == NULL && count > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (i = 0; i < count; i++) {
+    if ((arrays[i].in == NULL || arrays[i].out == NULL) && arrays[i].n > 0) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  if (opts == NULL) {
+    pps_options_init(&defaults);
+    opts = &defaults;
+  }
+  if (MPI_Comm_rank(comm, &rank) != MPI_SUCCESS) {
+    errno = EIO;
+    return -1;
+  }
+
+  for (i = 0; i <= count; i++) {
+    // Phase 1 and start of Phase 2 of array i
+    if (i < count) {
+      if (!failed && local_scan(pool, &arrays[i], opts, &total) != 0) {
+        failed = 1;
+        error = errno;
+      }
+      totals[i % 2][0] = failed ? 0 : total;
+      totals[i % 2][1] = failed;
+      if (MPI_Iexscan(totals[i % 2], carries[i % 2], 2, MPI_INT, MPI_SUM, comm, &requests[i % 2]) != MPI_SUCCESS) {
+        errno = EIO;
+        return -1;
+      }
+    }
+
+    // End of Phase 2 and Phase 3 of array i - 1
+    if (i > 0) {
+      if (MPI_Wait(&requests[(i - 1) % 2], MPI_STATUS_IGNORE) != MPI_SUCCESS) {
+        errno = EIO;
+        return -1;
+      }
+      if (rank == 0) { // MPI_Exscan leaves rank 0 undefined
+        carries[(i - 1) % 2][0] = 0;
+        carries[(i - 1) % 2][1] = 0;
+      }
+      if (!failed && carries[(i - 1) % 2][1] != 0) { // The carry of a failed rank is meaningless
+        failed = 1;
+        error = EIO;
+      }
+      if (!failed && add_carry(pool, arrays[i - 1].out, arrays[i - 1].n, carries[(i - 1) % 2][0], opts) != 0) {
+        failed = 1;
+        error = errno;
+      }
+    }
+  }
+  if (failed) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+int pps_mpi_scan_into (pps_pool *pool, MPI_Comm comm, const int *in, int *out, size_t n,
+                       const pps_options *opts) {
+  pps_array array;
+
+  array.in = in;
+  array.out = out;
+  array.n = n;
+  return pps_mpi_scan_batch(pool, comm, &array, 1, opts);
+}
+
+int pps_mpi_scan (pps_pool *pool, MPI_Comm comm, int *data, size_t n, const pps_options *opts) {
+  return pps_mpi_scan_into(pool, comm, data, data, n, opts);
+}
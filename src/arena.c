@@ -0,0 +1,133 @@
+/*
+ * arena.c
+ * -------
+ * Bump allocator for scan buffers and per call scratch space.
+ *
+ * An arena hands out pieces of a few large blocks: 64 byte aligned, so that no two
+ * pieces share a cache line, and 2MB aligned for pieces of 2MB or more, whose
+ * blocks are advised as transparent huge pages (one TLB entry per 2MB instead of
+ * 512). Nothing is freed piece by piece; "pps_arena_reset" makes the whole arena
+ * available again. When a reset finds that the pieces since the last reset didn't
+ * fit in one block, it replaces the blocks by a single one as large as all of them,
+ * so an arena used the same way again and again stops allocating after the first
+ * round.
+ *
+ * Every pool owns one for the scratch space of its scans (tile status, tile sums),
+ * see "pps_pool_scratch".
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "internal.h"
+
+#define LINE ((size_t) 64) // Alignment of every piece
+#define HUGE_PAGE ((size_t) 2 << 20) // Alignment of large pieces and their blocks
+#define MIN_BLOCK ((size_t) 64 << 10) // Smallest block allocated
+
+// Block of memory pieces are cut from
+typedef struct arena_block {
+  struct arena_block *next; // Older block
+  char *data; // The memory itself
+  size_t size; // Bytes at "data"
+} arena_block;
+
+struct pps_arena {
+  arena_block *blocks; // Newest first, pieces are cut from the newest
+  size_t used; // Bytes of the newest block handed out
+};
+
+/*
+ * Function:  block_create
+ * -----------------------
+ * Allocates a block of at least "size" bytes, huge page backed from 2MB on
+ *
+ * returns: the block, NULL with errno set on failure
+ */
+static arena_block *block_create (size_t size) {
+  arena_block *block = (arena_block *) malloc(sizeof(arena_block));
+  size_t align = size >= HUGE_PAGE ? HUGE_PAGE : LINE;
+
+  if (block == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  block->size = (size + align - 1) / align * align; // aligned_alloc wants a multiple
+  block->data = (char *) aligned_alloc(align, block->size);
+  if (block->data == NULL) {
+    free(block);
+    errno = ENOMEM;
+    return NULL;
+  }
+#ifdef MADV_HUGEPAGE
+  if (align == HUGE_PAGE) madvise(block->data, block->size, MADV_HUGEPAGE); // Before the first touch
+#endif
+  block->next = NULL;
+  return block;
+}
+
+pps_arena *pps_arena_create (size_t capacity) {
+  pps_arena *arena = (pps_arena *) calloc(1, sizeof(pps_arena));
+
+  if (arena == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (capacity > 0 && (arena->blocks = block_create(capacity)) == NULL) {
+    free(arena);
+    return NULL;
+  }
+  return arena;
+}
+
+void *pps_arena_alloc (pps_arena *arena, size_t bytes) {
+  size_t align = bytes >= HUGE_PAGE ? HUGE_PAGE : LINE, offset = 0, size;
+  arena_block *block = arena->blocks;
+
+  if (bytes == 0) bytes = 1; // A distinct piece all the same
+
+  if (block != NULL) { // Alignment of the data itself, not just of the offset
+    offset = (size_t) (-(uintptr_t) (block->data + arena->used) & (align - 1)) + arena->used;
+  }
+  if (block == NULL || offset > block->size || bytes > block->size - offset) { // Start a new block
+    size = block != NULL ? 2 * block->size : MIN_BLOCK;
+    if (size < bytes) size = bytes;
+    if (size < MIN_BLOCK) size = MIN_BLOCK;
+    block = block_create(size);
+    if (block == NULL) return NULL;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    offset = 0;
+  }
+  arena->used = offset + bytes;
+  return block->data + offset;
+}
+
+void pps_arena_reset (pps_arena *arena) {
+  arena_block *block, *next;
+  size_t total = 0;
+
+  arena->used = 0;
+  if (arena->blocks == NULL || arena->blocks->next == NULL) return; // Already one block
+
+  for (block = arena->blocks; block != NULL; block = next) { // Merge into one block
+    next = block->next;
+    total += block->size;
+    free(block->data);
+    free(block);
+  }
+  arena->blocks = block_create(total); // On failure the next pieces start afresh
+}
+
+void pps_arena_destroy (pps_arena *arena) {
+  arena_block *block, *next;
+
+  if (arena == NULL) return;
+  for (block = arena->blocks; block != NULL; block = next) {
+    next = block->next;
+    free(block->data);
+    free(block);
+  }
+  free(arena);
+}
@@ -0,0 +1,301 @@
+/*
+ * async.c
+ * -------
+ * Scans submitted without waiting for them.
+ *
+ * Every pool gets a dispatcher thread on its first asynchronous scan. Submitting
+ * appends a future to the dispatcher's queue and returns; the dispatcher takes the
+ * scans in order and runs them on the pool exactly like "pps_scan_into" would from
+ * the caller, then completes their futures. So the caller is never blocked by the
+ * pool, and scans submitted while others run queue up behind them.
+ *
+ * When the dispatcher finds several scans waiting that are each too short for more
+ * than one thread, it hands the consecutive ones with the same options to the pool
+ * as one "pps_scan_batch" job, so a burst of small requests costs a single wake-up
+ * of the workers instead of one per request. The scans of a batch run at the same
+ * time and in no particular order, so a scan only joins one if it doesn't read or
+ * write what an earlier member writes, nor write what one reads: a scan that
+ * depends on the one before it closes the batch and waits for it.
+ *
+ * A future is referenced by its submitter and by the dispatcher until the scan is
+ * done, and freed when both have let go, so it can be released before completion
+ * or from its own callback.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "internal.h"
+
+#define ASYNC_BATCH 64 // Most scans merged into one batch job
+
+struct pps_future {
+  pps_future *next; // Next scan in the queue
+  pps_array array; // What to scan
+  pps_options opts; // How to scan it
+  pthread_mutex_t lock; // Protects the fields below
+  pthread_cond_t done; // Signalled when the scan has completed
+  int completed; // Whether the scan has completed
+  int status; // Return value of the scan
+  int error; // errno of the scan when it failed
+  pps_future_fn fn; // Completion callback, NULL if none
+  void *ctx; // Argument of "fn"
+  int refs; // Submitter and dispatcher references
+};
+
+struct pps_async {
+  pps_pool *pool; // Pool running the scans
+  pthread_t thread; // The dispatcher
+  pthread_mutex_t lock; // Protects the queue and "shutdown"
+  pthread_cond_t wake; // Signalled when a scan is queued or on shutdown
+  pps_future *head; // Oldest queued scan, NULL if none
+  pps_future *tail; // Newest queued scan
+  int shutdown; // Set by pps_async_destroy once the queue is to be drained
+};
+
+/*
+ * Function:  future_unref
+ * -----------------------
+ * Drops one reference to a future, freeing it with the last one
+ */
+static void future_unref (pps_future *future) {
+  int refs;
+
+  pthread_mutex_lock(&future->lock);
+  refs = --future->refs;
+  pthread_mutex_unlock(&future->lock);
+  if (refs > 0) return;
+
+  pthread_cond_destroy(&future->done);
+  pthread_mutex_destroy(&future->lock);
+  free(future);
+}
+
+/*
+ * Function:  complete
+ * -------------------
+ * Publishes the result of a scan, wakes up its waiters and calls its callback
+ * (without holding any lock), then drops the dispatcher's reference
+ */
+static void complete (pps_future *future, int status, int error) {
+  pps_future_fn fn;
+  void *ctx;
+
+  pthread_mutex_lock(&future->lock);
+  future->status = status;
+  future->error = error;
+  future->completed = 1;
+  fn = future->fn;
+  ctx = future->ctx;
+  pthread_cond_broadcast(&future->done);
+  pthread_mutex_unlock(&future->lock);
+
+  if (fn != NULL) fn(future, ctx);
+  future_unref(future);
+}
+
+// Whether the ranges of na and nb ints starting at a and b share an element
+static int overlap (const int *a, size_t na, const int *b, size_t nb) {
+  return na > 0 && nb > 0 && (uintptr_t) a < (uintptr_t) (b + nb) && (uintptr_t) b < (uintptr_t) (a + na);
+}
+
+/*
+ * Function:  batchable
+ * --------------------
+ * returns: whether scan "b" may join the batch job of the "count" scans of
+ *          "group": all are short enough for a single thread and ask for the
+ *          same scan, and "b" doesn't depend on any of them nor overwrite their
+ *          input
+ */
+static int batchable (pps_pool *pool, pps_future *const *group, int count, const pps_future *b) {
+  const pps_options *x = &group[0]->opts, *y = &b->opts;
+  const pps_array *m;
+  int i;
+
+  if (pps_job_threads(pool, b->array.n, y->nthreads) != 1 || x->mode != y->mode || x->isa != y->isa ||
+      x->nthreads != y->nthreads || x->barrier != y->barrier || x->tile_size != y->tile_size ||
+      x->engine != y->engine || x->chunk_align != y->chunk_align || x->stores != y->stores) {
+    return 0;
+  }
+  for (i = 0; i < count; i++) {
+    m = &group[i]->array;
+    if (overlap(b->array.in, b->array.n, m->out, m->n) || overlap(b->array.out, b->array.n, m->out, m->n) ||
+        overlap(b->array.out, b->array.n, m->in, m->n)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Function:  dispatch_loop
+ * ------------------------
+ * Pointer function of the dispatcher thread. Takes the whole queue at once and runs
+ * it in order, merging runs of short scans into batch jobs, until shut down with
+ * an empty queue
+ *
+ * args: the pps_async being served
+ */
+static void *dispatch_loop (void *args) {
+  pps_async *async = (pps_async *) args;
+  pps_future *queue, *first, *group[ASYNC_BATCH];
+  pps_array arrays[ASYNC_BATCH];
+  int count, status, error, i;
+
+  for (;;) {
+    pthread_mutex_lock(&async->lock);
+    while (async->head == NULL && !async->shutdown) {
+      pthread_cond_wait(&async->wake, &async->lock);
+    }
+    queue = async->head;
+    async->head = async->tail = NULL;
+    pthread_mutex_unlock(&async->lock);
+
+    if (queue == NULL) break; // Shut down and nothing left to run
+
+    while (queue != NULL) {
+      first = queue;
+      queue = first->next;
+      group[0] = first;
+      count = 1;
+      if (pps_job_threads(async->pool, first->array.n, first->opts.nthreads) == 1) {
+        while (queue != NULL && count < ASYNC_BATCH && batchable(async->pool, group, count, queue)) {
+          group[count++] = queue;
+          queue = queue->next;
+        }
+      }
+
+      if (count == 1) {
+        status = pps_scan_into(async->pool, first->array.in, first->array.out, first->array.n, &first->opts);
+      } else {
+        for (i = 0; i < count; i++) arrays[i] = group[i]->array;
+        status = pps_scan_batch(async->pool, arrays, count, &first->opts);
+      }
+      error = status != 0 ? errno : 0;
+
+      for (i = 0; i < count; i++) complete(group[i], status, error);
+    }
+  }
+  return NULL;
+}
+
+pps_async *pps_async_create (pps_pool *pool) {
+  pps_async *async = (pps_async *) calloc(1, sizeof(pps_async));
+
+  if (async == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  async->pool = pool;
+  pthread_mutex_init(&async->lock, NULL);
+  pthread_cond_init(&async->wake, NULL);
+  if (pthread_create(&async->thread, NULL, dispatch_loop, async) != 0) {
+    pthread_cond_destroy(&async->wake);
+    pthread_mutex_destroy(&async->lock);
+    free(async);
+    errno = EAGAIN;
+    return NULL;
+  }
+  return async;
+}
+
+void pps_async_destroy (pps_async *async) {
+  if (async == NULL) return;
+
+  pthread_mutex_lock(&async->lock);
+  async->shutdown = 1;
+  pthread_cond_signal(&async->wake);
+  pthread_mutex_unlock(&async->lock);
+
+  pthread_join(async->thread, NULL); // Runs whatever is still queued first
+  pthread_cond_destroy(&async->wake);
+  pthread_mutex_destroy(&async->lock);
+  free(async);
+}
+
+pps_future *pps_scan_async (pps_pool *pool, const int *in, int *out, size_t n, const pps_options *opts) {
+  pps_future *future;
+  pps_async *async;
+
+  if (pool == NULL || ((in == NULL || out == NULL) && n > 0)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  async = pps_pool_async(pool);
+  if (async == NULL) return NULL; // errno set by pps_pool_async
+
+  future = (pps_future *) calloc(1, sizeof(pps_future));
+  if (future == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  future->array.in = in;
+  future->array.out = out;
+  future->array.n = n;
+  if (opts != NULL) {
+    future->opts = *opts;
+  } else {
+    pps_options_init(&future->opts);
+  }
+  future->refs = 2;
+  pthread_mutex_init(&future->lock, NULL);
+  pthread_cond_init(&future->done, NULL);
+
+  pthread_mutex_lock(&async->lock);
+  if (async->tail != NULL) {
+    async->tail->next = future;
+  } else {
+    async->head = future;
+  }
+  async->tail = future;
+  pthread_cond_signal(&async->wake);
+  pthread_mutex_unlock(&async->lock);
+  return future;
+}
+
+int pps_future_poll (pps_future *future) {
+  int completed;
+
+  pthread_mutex_lock(&future->lock);
+  completed = future->completed;
+  pthread_mutex_unlock(&future->lock);
+  return completed;
+}
+
+int pps_future_wait (pps_future *future) {
+  int status, error;
+
+  pthread_mutex_lock(&future->lock);
+  while (!future->completed) {
+    pthread_cond_wait(&future->done, &future->lock);
+  }
+  status = future->status;
+  error = future->error;
+  pthread_mutex_unlock(&future->lock);
+
+  if (status != 0) errno = error;
+  return status;
+}
+
+int pps_future_then (pps_future *future, pps_future_fn fn, void *ctx) {
+  int ret = 0;
+
+  pthread_mutex_lock(&future->lock);
+  if (future->completed) {
+    ret = 1; // Too late, the caller runs the continuation itself
+  } else if (future->fn != NULL) {
+    errno = EBUSY;
+    ret = -1;
+  } else {
+    future->fn = fn;
+    future->ctx = ctx;
+  }
+  pthread_mutex_unlock(&future->lock);
+  return ret;
+}
+
+void pps_future_release (pps_future *future) {
+  if (future != NULL) future_unref(future);
+}
@@ -0,0 +1,88 @@
+/*
+ * barrier.c
+ * ---------
+ * Atomic alternatives to pthread_barrier_t for the phase boundaries of the engines.
+ *
+ * glibc's pthread_barrier_wait takes a mutex and goes through the futex every time,
+ * which shows up at two crossings per scan on mid-size arrays. The barrier below is
+ * a sense-reversing barrier built on a counter and a generation number:
+ *
+ *      - every arriving thread decrements the counter
+ *      - the last one resets the counter and bumps the generation, which plays
+ *        the role of the sense flag and releases everybody else
+ *      - the others spin until the generation changes
+ *
+ * In hybrid mode a waiter spins for a while and then sleeps on the generation
+ * with a futex, so an oversubscribed host doesn't burn a core per waiting thread.
+ * The last thread only makes the wake-up system call if somebody went to sleep.
+ */
+
+#include <limits.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "internal.h"
+
+#define HYBRID_SPINS 2000 // Spins before a hybrid waiter goes to sleep
+
+/*
+ * Function:  futex_wait
+ * ---------------------
+ * Sleeps as long as *addr holds "value" (may return spuriously)
+ */
+static void futex_wait (_Atomic unsigned *addr, unsigned value) {
+#ifdef __linux__
+  syscall(SYS_futex, (unsigned *) addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+  (void) addr; (void) value;
+  sched_yield();
+#endif
+}
+
+/*
+ * Function:  futex_wake_all
+ * -------------------------
+ * Wakes up every thread sleeping on *addr
+ */
+static void futex_wake_all (_Atomic unsigned *addr) {
+#ifdef __linux__
+  syscall(SYS_futex, (unsigned *) addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+  (void) addr;
+#endif
+}
+
+void pps_spin_barrier_init (pps_spin_barrier *barrier, int nthreads) {
+  barrier->nthreads = nthreads;
+  atomic_store(&barrier->count, nthreads);
+  atomic_store(&barrier->generation, 0);
+  atomic_store(&barrier->sleepers, 0);
+}
+
+void pps_spin_barrier_wait (pps_spin_barrier *barrier, int hybrid) {
+  unsigned generation = atomic_load_explicit(&barrier->generation, memory_order_acquire);
+  unsigned spins = 0;
+
+  if (atomic_fetch_sub_explicit(&barrier->count, 1, memory_order_acq_rel) == 1) { // Last one in
+    atomic_store_explicit(&barrier->count, barrier->nthreads, memory_order_relaxed);
+    atomic_store(&barrier->generation, generation + 1); // Releases the others
+    if (atomic_load(&barrier->sleepers) > 0) {
+      futex_wake_all(&barrier->generation);
+    }
+    return;
+  }
+
+  while (atomic_load_explicit(&barrier->generation, memory_order_acquire) == generation) {
+    if (hybrid && spins >= HYBRID_SPINS) {
+      atomic_fetch_add(&barrier->sleepers, 1);
+      futex_wait(&barrier->generation, generation); // Returns at once if already released
+      atomic_fetch_sub(&barrier->sleepers, 1);
+    } else {
+      pps_cpu_relax(&spins);
+    }
+  }
+}
@@ -0,0 +1,167 @@
+/*
+ * batch.c
+ * -------
+ * Prefix sums of many independent arrays in a single pool job.
+ *
+ * Scanning the arrays one after the other wakes the pool and crosses its barriers
+ * once per array, with cores idling at every one of them. Here all arrays go into
+ * one global schedule of tiles:
+ *
+ *      - the arrays are ordered longest first, so the big ones start early and the
+ *        small ones fill the gaps at the end
+ *      - an array of at most one tile is a single tile, scanned start to end by
+ *        whichever thread pulls it
+ *      - longer arrays are cut into tiles joined by decoupled look-back (see
+ *        lookback.c), each array with its own status entries
+ *
+ * The threads pull tiles from one atomic counter. The tiles of an array are handed
+ * out in order, so look-back can't deadlock, and the only synchronisation of the
+ * whole batch is the end of the pool job.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "internal.h"
+
+// Place of an array in the global schedule
+typedef struct batch_entry {
+  const pps_array *array; // The array
+  size_t first_tile; // Global number of its first tile
+  size_t ntiles; // Number of tiles it is cut into
+} batch_entry;
+
+// Data structure describing one batch of prefix sums, shared by all threads
+typedef struct batch_job {
+  pps_tile_counter counter; // Next global tile to hand out
+  batch_entry *entries; // Arrays in schedule order
+  size_t count; // Number of entries
+  size_t ntiles; // Total number of tiles
+  size_t tile_size; // Elements per tile
+  pps_tile_status *status; // One status per tile
+  const pps_kernels *k; // Inner loops
+  int (*scan) (const int *, int *, size_t, int); // Inclusive or exclusive tile scan
+} batch_job;
+
+// qsort comparison putting the longest arrays first
+static int longest_first (const void *a, const void *b) {
+  size_t x = ((const batch_entry *) a)->array->n, y = ((const batch_entry *) b)->array->n;
+
+  return x < y ? 1 : -(x > y);
+}
+
+/*
+ * Function:  batch_thread
+ * -----------------------
+ * Function that each active worker of the pool executes for a batch
+ *
+ * ctx: the batch_job being computed
+ * id: thread id
+ * nthreads: number of threads taking part
+ */
+static void batch_thread (void *ctx, int id, int nthreads) {
+  batch_job *job = (batch_job *) ctx;
+  const batch_entry *entry;
+  size_t tile, local, start_index, end_index, e = 0;
+
+  (void) id; (void) nthreads;
+
+  for (;;) {
+    tile = atomic_fetch_add_explicit(&job->counter.next, 1, memory_order_relaxed);
+    if (tile >= job->ntiles) break;
+
+    // A thread's tiles only grow, so its entry is found by walking forward
+    while (tile >= job->entries[e].first_tile + job->entries[e].ntiles) e++;
+    entry = &job->entries[e];
+    local = tile - entry->first_tile;
+
+    if (entry->ntiles == 1) { // Whole array on this thread
+      job->scan(entry->array->in, entry->array->out, entry->array->n, 0);
+      continue;
+    }
+
+    start_index = local * job->tile_size;
+    end_index = start_index + job->tile_size;
+    if (end_index > entry->array->n) end_index = entry->array->n;
+    pps_lookback_tile(job->status + entry->first_tile, local, entry->array->in + start_index,
+                      entry->array->out + start_index, end_index - start_index, job->k, job->scan);
+  }
+}
+
+int pps_scan_batch (pps_pool *pool, const pps_array *arrays, size_t count, const pps_options *opts) {
+  size_t i, tiles = 0, items = 0, tile_size;
+  const pps_kernels *k;
+  pps_options defaults;
+  pps_arena *scratch;
+  batch_job job;
+  int nthreads, ret;
+
+  if (pool == NULL || (arrays == NULL && count > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (i = 0; i < count; i++) {
+    if ((arrays[i].in == NULL || arrays[i].out == NULL) && arrays[i].n > 0) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  if (opts == NULL) {
+    pps_options_init(&defaults);
+    opts = &defaults;
+  }
+
+  k = pps_get_kernels(opts->isa);
+  if (k == NULL) return -1; // errno set by pps_get_kernels
+
+  // Arrays up to half the L2 go to one thread, like the tiles of the blocked engine
+  tile_size = opts->tile_size;
+  if (tile_size == 0) {
+    tile_size = pps_cache_size(2) / 2 / sizeof(int);
+    if (tile_size < PPS_MIN_ITEMS_PER_THREAD) tile_size = PPS_MIN_ITEMS_PER_THREAD;
+  }
+
+  scratch = pps_pool_scratch(pool);
+  job.entries = (batch_entry *) pps_arena_alloc(scratch, count * sizeof(batch_entry));
+  if (job.entries == NULL) {
+    pps_pool_scratch_release(pool);
+    return -1; // errno set by pps_arena_alloc
+  }
+  for (i = 0; i < count; i++) {
+    job.entries[i].array = &arrays[i];
+  }
+  qsort(job.entries, count, sizeof(batch_entry), longest_first);
+  for (i = 0; i < count; i++) {
+    job.entries[i].first_tile = tiles;
+    job.entries[i].ntiles = (job.entries[i].array->n + tile_size - 1) / tile_size;
+    tiles += job.entries[i].ntiles;
+    items += job.entries[i].array->n;
+  }
+
+  job.count = count;
+  job.ntiles = tiles;
+  job.tile_size = tile_size;
+  job.k = k;
+  job.scan = pps_scan_kernel(k, opts);
+  atomic_init(&job.counter.next, 0);
+  job.status = (pps_tile_status *) pps_arena_alloc(scratch, tiles * sizeof(pps_tile_status));
+  if (job.status == NULL) {
+    pps_pool_scratch_release(pool);
+    return -1; // errno set by pps_arena_alloc
+  }
+  for (i = 0; i < tiles; i++) {
+    atomic_init(&job.status[i].flag, PPS_TILE_INVALID);
+  }
+
+  nthreads = pps_job_threads(pool, items, opts->nthreads);
+  if ((size_t) nthreads > tiles) nthreads = tiles > 0 ? (int) tiles : 1; // No thread without a tile
+
+  ret = 0;
+  if (nthreads == 1) { // Not worth waking anybody up
+    batch_thread(&job, 0, 1);
+  } else {
+    ret = pps_pool_run(pool, nthreads, batch_thread, &job);
+  }
+  pps_pool_scratch_release(pool);
+  return ret;
+}
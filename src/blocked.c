@@ -0,0 +1,124 @@
+/*
+ * blocked.c
+ * ---------
+ * Cache-blocked, reduce-then-scan variant of the three phase algorithm.
+ *
+ * Every thread still owns one contiguous chunk, but the chunk is walked in tiles
+ * of about half the L2 cache:
+ *
+ *      Phase 1 - sum every tile of the chunk without writing anything, remembering
+ *                the tile sums
+ *      Phase 2 - turn the chunk sums into the carry-in of every chunk (carry.c)
+ *      Phase 3 - scan and write every tile exactly once with its carry-in
+ *
+ * Since the tile sums are known after Phase 1, the carry-in of any tile is known
+ * too and Phase 3 can visit the tiles in reverse order: the tiles Phase 1 read last
+ * are still in L2 when Phase 3 starts on them. Compared to the classic order the
+ * data is written back once instead of twice.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "internal.h"
+
+// Data structure describing one blocked prefix sum, shared by all threads
+typedef struct blocked_job {
+  pps_pool *pool; // Pool running the job
+  const int *in; // Input array pointer
+  int *data; // Global (output) array pointer, may be "in"
+  size_t n; // Number of elements in "data"
+  size_t tile_size; // Elements per tile
+  const size_t *bounds; // Chunk boundaries, see "pps_partition"
+  size_t tiles_per_thread; // Room for tile sums per thread in "tile_sums"
+  int *tile_sums; // Sum of every tile, tiles_per_thread entries per thread
+  pps_carry carry; // Chunk totals and carries of Phase 2
+  const pps_kernels *k; // Inner loops
+  int (*scan) (const int *, int *, size_t, int); // Inclusive or exclusive tile scan
+} blocked_job;
+
+/*
+ * Function:  blocked_thread
+ * -------------------------
+ * Function that each active worker of the pool executes for a blocked prefix sum
+ *
+ * ctx: the blocked_job being computed
+ * id: thread id
+ * nthreads: number of threads taking part
+ */
+static void blocked_thread (void *ctx, int id, int nthreads) {
+  blocked_job *job = (blocked_job *) ctx;
+  int *tile_sums = job->tile_sums + id * job->tiles_per_thread;
+  size_t start_index, end_index, tile_start, tile_end, ntiles, t;
+  int chunk_sum, carry;
+
+  pps_chunk_bounds(job->bounds, id, &start_index, &end_index);
+  ntiles = (end_index - start_index + job->tile_size - 1) / job->tile_size;
+
+  // Phase 1 - Reduce every tile of the chunk, nothing is written to the array
+  PPS_TRACE_TIME(local);
+  chunk_sum = 0;
+  for (t = 0; t < ntiles; t++) {
+    tile_start = start_index + t * job->tile_size;
+    tile_end = tile_start + job->tile_size < end_index ? tile_start + job->tile_size : end_index;
+    tile_sums[t] = job->k->reduce(job->in + tile_start, tile_end - tile_start);
+    chunk_sum += tile_sums[t];
+  }
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_LOCAL, local);
+
+  // Phase 2 - Hierarchical scan of the chunk totals, between two barriers
+  PPS_TRACE_TIME(exchange);
+  carry = pps_carry_exchange(&job->carry, job->pool, id, nthreads, chunk_sum);
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_CARRY, exchange);
+
+  // Phase 3 - Turn tile sums into carry-ins, then scan the tiles last to first
+  // so that the ones Phase 1 touched most recently go first
+  PPS_TRACE_TIME(final);
+  for (t = 0; t < ntiles; t++) {
+    chunk_sum = tile_sums[t];
+    tile_sums[t] = carry;
+    carry += chunk_sum;
+  }
+  for (t = ntiles; t-- > 0; ) {
+    tile_start = start_index + t * job->tile_size;
+    tile_end = tile_start + job->tile_size < end_index ? tile_start + job->tile_size : end_index;
+    job->scan(job->in + tile_start, job->data + tile_start, tile_end - tile_start, tile_sums[t]);
+  }
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_FINAL, final);
+}
+
+int pps_blocked_scan (pps_pool *pool, const int *in, int *out, size_t n, int nthreads,
+                      const pps_options *opts, const pps_kernels *k) {
+  pps_slot slots[PPS_CARRY_SLOTS(nthreads)]; // Scratch space of Phase 2
+  size_t bounds[nthreads + 1], tile_size = opts->tile_size, longest = 0;
+  blocked_job job;
+  int ret, i;
+
+  if (tile_size == 0) tile_size = pps_cache_size(2) / 2 / sizeof(int);
+  if (tile_size == 0) tile_size = 1;
+
+  job.pool = pool;
+  job.in = in;
+  job.data = out;
+  job.k = k;
+  job.scan = pps_scan_kernel(k, opts);
+  job.n = n;
+  job.tile_size = tile_size;
+  pps_partition(pool, n, nthreads, out, opts->chunk_align, bounds);
+  for (i = 0; i < nthreads; i++) {
+    if (bounds[i + 1] - bounds[i] > longest) longest = bounds[i + 1] - bounds[i];
+  }
+  job.bounds = bounds;
+  job.tiles_per_thread = (longest + tile_size - 1) / tile_size;
+  if (job.tiles_per_thread == 0) job.tiles_per_thread = 1;
+  job.tile_sums = (int *) pps_arena_alloc(pps_pool_scratch(pool), nthreads * job.tiles_per_thread * sizeof(int));
+  if (job.tile_sums == NULL) {
+    pps_pool_scratch_release(pool);
+    return -1; // errno set by pps_arena_alloc
+  }
+  pps_carry_init(&job.carry, slots, nthreads, pps_pool_group_size(pool, nthreads));
+
+  ret = pps_pool_run_with(pool, nthreads, blocked_thread, &job, opts->barrier);
+  pps_pool_scratch_release(pool);
+  return ret;
+}
@@ -0,0 +1,89 @@
+/*
+ * cache-info.c
+ * ------------
+ * Detection of the cache hierarchy, used to size the tiles of the blocked and
+ * look-back engines. The sizes are read once and remembered.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "internal.h"
+
+#define FALLBACK_L1_SIZE (32 * 1024) // Used when nothing better can be found
+#define FALLBACK_L2_SIZE (256 * 1024)
+#define FALLBACK_L3_SIZE (8 * 1024 * 1024)
+
+static size_t cache_sizes[4]; // Data/unified cache size per level, in bytes
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Function:  sysfs_cache_size
+ * ---------------------------
+ * Reads the size of a data or unified cache of cpu0 from sysfs
+ *
+ * level: cache level, 1 to 3
+ *
+ * returns: the size in bytes, or 0 if it isn't available
+ */
+static size_t sysfs_cache_size (int level) {
+  char path[128], type[32];
+  unsigned long size;
+  int index, file_level, ok;
+  char unit;
+  FILE *f;
+
+  for (index = 0; index < 8; index++) {
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+    if ((f = fopen(path, "r")) == NULL) break;
+    ok = fscanf(f, "%d", &file_level) == 1;
+    fclose(f);
+    if (!ok || file_level != level) continue;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+    if ((f = fopen(path, "r")) == NULL) continue;
+    ok = fscanf(f, "%31s", type) == 1;
+    fclose(f);
+    if (!ok || type[0] == 'I') continue; // Instruction cache
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+    if ((f = fopen(path, "r")) == NULL) continue;
+    ok = fscanf(f, "%lu%c", &size, &unit);
+    fclose(f);
+    if (ok < 1) continue;
+    if (ok == 2 && unit == 'K') size *= 1024;
+    if (ok == 2 && unit == 'M') size *= 1024 * 1024;
+    return size;
+  }
+  return 0;
+}
+
+/*
+ * Function:  detect_caches
+ * ------------------------
+ * Fills in "cache_sizes", preferring sysconf and falling back to sysfs and then
+ * to typical sizes
+ */
+static void detect_caches (void) {
+  static const size_t fallback[4] = { 0, FALLBACK_L1_SIZE, FALLBACK_L2_SIZE, FALLBACK_L3_SIZE };
+  long size;
+  int level;
+
+  for (level = 1; level <= 3; level++) {
+    size = -1;
+#if defined(_SC_LEVEL1_DCACHE_SIZE)
+    if (level == 1) size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    if (level == 2) size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (level == 3) size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    cache_sizes[level] = size > 0 ? (size_t) size : sysfs_cache_size(level);
+    if (cache_sizes[level] == 0) cache_sizes[level] = fallback[level];
+  }
+}
+
+size_t pps_cache_size (int level) {
+  if (level < 1 || level > 3) return 0;
+  pthread_once(&cache_once, detect_caches);
+  return cache_sizes[level];
+}
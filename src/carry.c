@@ -0,0 +1,153 @@
+/*
+ * carry.c
+ * -------
+ * Phase 2 of the chunked engines: turning the total of every chunk into the
+ * carry-in of every chunk.
+ *
+ * Instead of thread 0 walking all chunk totals while the others wait, the threads
+ * are split into groups of "group_size" consecutive ids (one group per NUMA node
+ * or socket when known, about sqrt(nthreads) otherwise) and do a two-level scan:
+ *
+ *      1. every thread publishes its chunk total in its own cache line
+ *      -- barrier --
+ *      2. every thread adds up the totals of the threads before it in its group;
+ *         the last thread of a group publishes the group's total
+ *      -- barrier --
+ *      3. every thread adds the totals of the groups before its own
+ *
+ * So each thread reads O(sqrt(nthreads)) lines, mostly from its own group (and
+ * socket), the work is spread over all threads and the barrier count stays at two.
+ * The carry is returned to the caller and kept in a register for Phase 3 rather
+ * than being stored in the shared array.
+ *
+ * Segmented scans exchange (flag, value) pairs the same way, combined with
+ *
+ *      (f1, v1) + (f2, v2) = (f1 | f2, f2 ? v2 : v1 + v2)
+ *
+ * which is associative, so the same two levels apply.
+ */
+
+#include "internal.h"
+
+// Barrier of Phase 2, timed when tracing
+static void carry_barrier (pps_pool *pool, int id) {
+  PPS_TRACE_TIME(start);
+  pps_pool_barrier(pool);
+  PPS_TRACE_PHASE(pool, id, PPS_PHASE_BARRIER, start);
+}
+
+// About sqrt(nthreads) groups of sqrt(nthreads)
+static int default_group_size (int nthreads) {
+  int group_size = 1;
+
+  while (group_size * group_size < nthreads) group_size++;
+  return group_size;
+}
+
+int pps_carry_group_size (const pps_pool *pool, int nthreads) {
+  int group_size = pps_pool_group_size(pool, nthreads);
+
+  return group_size > 0 ? group_size : default_group_size(nthreads);
+}
+
+void pps_carry_init (pps_carry *carry, pps_slot *slots, int nthreads, int group_size) {
+  if (group_size <= 0) group_size = default_group_size(nthreads);
+  carry->totals = slots;
+  carry->group_totals = slots + nthreads;
+  carry->group_size = group_size;
+}
+
+int pps_carry_exchange (pps_carry *carry, pps_pool *pool, int id, int nthreads, int total) {
+  int group = id / carry->group_size;
+  int first = group * carry->group_size; // First thread of own group
+  int last = first + carry->group_size - 1; // Last thread of own group
+  int i, prefix = 0;
+
+  if (last > nthreads - 1) last = nthreads - 1;
+
+  carry->totals[id].value = total;
+
+  carry_barrier(pool, id); // All chunk totals are published
+
+  for (i = first; i < id; i++) { // Level 1 - within own group
+    prefix += carry->totals[i].value;
+  }
+  if (id == last) {
+    carry->group_totals[group].value = prefix + total;
+  }
+
+  carry_barrier(pool, id); // All group totals are published
+
+  for (i = 0; i < group; i++) { // Level 2 - groups before own group
+    prefix += carry->group_totals[i].value;
+  }
+  return prefix;
+}
+
+int64_t pps_carry_exchange64 (pps_carry *carry, pps_pool *pool, int id, int nthreads, int64_t total) {
+  int group = id / carry->group_size;
+  int first = group * carry->group_size; // First thread of own group
+  int last = first + carry->group_size - 1; // Last thread of own group
+  int64_t prefix = 0;
+  int i;
+
+  if (last > nthreads - 1) last = nthreads - 1;
+
+  carry->totals[id].wide = total;
+
+  carry_barrier(pool, id); // All chunk totals are published
+
+  for (i = first; i < id; i++) { // Level 1 - within own group
+    prefix += carry->totals[i].wide;
+  }
+  if (id == last) {
+    carry->group_totals[group].wide = prefix + total;
+  }
+
+  carry_barrier(pool, id); // All group totals are published
+
+  for (i = 0; i < group; i++) { // Level 2 - groups before own group
+    prefix += carry->group_totals[i].wide;
+  }
+  return prefix;
+}
+
+int pps_carry_total (const pps_carry *carry, int nthreads) {
+  int groups = (nthreads + carry->group_size - 1) / carry->group_size, i, total = 0;
+
+  for (i = 0; i < groups; i++) {
+    total += carry->group_totals[i].value;
+  }
+  return total;
+}
+
+int pps_carry_exchange_segmented (pps_carry *carry, pps_pool *pool, int id, int nthreads, int total, int head) {
+  int group = id / carry->group_size;
+  int first = group * carry->group_size; // First thread of own group
+  int last = first + carry->group_size - 1; // Last thread of own group
+  int i, prefix = 0, flag = 0, group_prefix = 0;
+
+  if (last > nthreads - 1) last = nthreads - 1;
+
+  carry->totals[id].value = total;
+  carry->totals[id].flag = head;
+
+  carry_barrier(pool, id); // All chunk pairs are published
+
+  for (i = first; i < id; i++) { // Level 1 - within own group
+    prefix = carry->totals[i].flag ? carry->totals[i].value : prefix + carry->totals[i].value;
+    flag |= carry->totals[i].flag;
+  }
+  if (id == last) {
+    carry->group_totals[group].value = head ? total : prefix + total;
+    carry->group_totals[group].flag = flag | head;
+  }
+
+  carry_barrier(pool, id); // All group pairs are published
+
+  if (flag) return prefix; // A head in own group hides the groups before
+  for (i = 0; i < group; i++) { // Level 2 - groups before own group
+    group_prefix = carry->group_totals[i].flag ? carry->group_totals[i].value : group_prefix + carry->group_totals[i].value;
+  }
+  return group_prefix + prefix;
+}
@@ -0,0 +1,112 @@
+/*
+ * file-io.c
+ * ---------
+ * Prefix sums of flat binary files of ints, through memory mappings.
+ *
+ * The input file is mapped and scanned in place, or into a second file mapped next
+ * to it, so loading, scanning and writing back cost no copy through read() and
+ * write() buffers. The kernel reads the pages in as the workers first touch them
+ * and writes the dirty ones back from the page cache. The mappings are advised as
+ * sequential (aggressive read-ahead) and, where available, as huge pages.
+ *
+ * The chunk starts are page aligned, so with the chunked engines every worker
+ * faults in, scans and dirties only the pages of its own chunk.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "internal.h"
+
+/*
+ * Function:  map_file
+ * -------------------
+ * Maps "bytes" bytes of an open file and advises the kernel of a sequential pass
+ *
+ * returns: the mapping, or MAP_FAILED with errno set
+ */
+static void *map_file (int fd, size_t bytes, int writable) {
+  void *map = mmap(NULL, bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+  if (map == MAP_FAILED) return map;
+  madvise(map, bytes, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+  madvise(map, bytes, MADV_HUGEPAGE); // Only honoured by some file systems, harmless otherwise
+#endif
+  return map;
+}
+
+int pps_scan_file (pps_pool *pool, const char *input, const char *output, const pps_options *opts) {
+  int in_fd, out_fd = -1, status = -1, saved;
+  void *in_map = MAP_FAILED, *out_map = MAP_FAILED;
+  pps_options file_opts;
+  struct stat st, out_st;
+  size_t bytes;
+  long page;
+
+  if (pool == NULL || input == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (opts != NULL) {
+    file_opts = *opts;
+  } else {
+    pps_options_init(&file_opts);
+  }
+  if (file_opts.chunk_align == 0) { // One page never belongs to two workers
+    page = sysconf(_SC_PAGESIZE);
+    file_opts.chunk_align = page > 0 ? (size_t) page : 4096;
+  }
+
+  in_fd = open(input, output == NULL ? O_RDWR : O_RDONLY);
+  if (in_fd < 0) return -1;
+  if (fstat(in_fd, &st) != 0) goto out;
+  bytes = (size_t) st.st_size;
+  if (bytes % sizeof(int) != 0) { // Not a flat array of ints
+    errno = EINVAL;
+    goto out;
+  }
+
+  // Not truncated before knowing it isn't the input under another name
+  if (output != NULL) {
+    out_fd = open(output, O_RDWR | O_CREAT, 0644);
+    if (out_fd < 0 || fstat(out_fd, &out_st) != 0) goto out;
+    if (out_st.st_dev == st.st_dev && out_st.st_ino == st.st_ino) { // In place, through the writable descriptor
+      close(in_fd);
+      in_fd = out_fd;
+      out_fd = -1;
+      output = NULL;
+    }
+  }
+
+  if (bytes == 0) { // Nothing to map, but the output must still exist, empty
+    status = out_fd >= 0 ? ftruncate(out_fd, 0) : 0;
+    goto out;
+  }
+
+  in_map = map_file(in_fd, bytes, output == NULL);
+  if (in_map == MAP_FAILED) goto out;
+
+  if (output == NULL) { // In place on the input file
+    status = pps_scan_opts(pool, (int *) in_map, bytes / sizeof(int), &file_opts);
+    goto out;
+  }
+
+  if (ftruncate(out_fd, 0) != 0 || ftruncate(out_fd, (off_t) bytes) != 0) goto out;
+  out_map = map_file(out_fd, bytes, 1);
+  if (out_map == MAP_FAILED) goto out;
+
+  status = pps_scan_into(pool, (const int *) in_map, (int *) out_map, bytes / sizeof(int), &file_opts);
+
+out:
+  saved = errno; // Keep the error of the failing call through the clean-up
+  if (out_map != MAP_FAILED) munmap(out_map, bytes);
+  if (in_map != MAP_FAILED) munmap(in_map, bytes);
+  if (out_fd >= 0) close(out_fd);
+  close(in_fd);
+  errno = saved;
+  return status;
+}
@@ -0,0 +1,119 @@
+/*
+ * first-touch.c
+ * -------------
+ * Parallel allocation and initialisation of arrays.
+ *
+ * Linux puts a page on the NUMA node of the thread that writes it first. An array
+ * malloc'ed and filled by the main thread therefore ends up on a single socket and
+ * half the workers of a two socket machine scan it across the interconnect. Here
+ * every worker writes the chunk it will own in the scans, using the same thread
+ * count and chunk bounds, so with a pool pinned by node the chunk goes to the
+ * worker's own node. Large arrays are moreover put on transparent huge pages.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "internal.h"
+
+#define HUGE_PAGE ((size_t) 2 << 20) // Alignment of large arrays
+
+// Data structure describing one parallel initialisation, shared by all threads
+typedef struct touch_job {
+  int *data; // Array being initialised
+  size_t n; // Number of elements in "data"
+  const size_t *bounds; // Chunk boundaries, as in the scans
+  pps_fill_fn fill; // Writes a chunk, NULL to zero it
+  void *ctx; // Argument of "fill"
+} touch_job;
+
+/*
+ * Function:  touch_chunk
+ * ----------------------
+ * Initialises the elements [start_index, end_index) of the array
+ */
+static void touch_chunk (touch_job *job, size_t start_index, size_t end_index) {
+  if (job->fill != NULL) {
+    job->fill(job->data + start_index, start_index, end_index - start_index, job->ctx);
+  } else {
+    memset(job->data + start_index, 0, (end_index - start_index) * sizeof(int));
+  }
+}
+
+/*
+ * Function:  touch_function
+ * -------------------------
+ * Function that each active worker of the pool executes to initialise its chunk
+ *
+ * ctx: the touch_job being computed
+ * id: thread id
+ * nthreads: number of threads taking part
+ */
+static void touch_function (void *ctx, int id, int nthreads) {
+  touch_job *job = (touch_job *) ctx;
+  size_t start_index, end_index;
+
+  pps_chunk_bounds(job->bounds, id, &start_index, &end_index);
+  touch_chunk(job, start_index, end_index);
+}
+
+int pps_init (pps_pool *pool, int *data, size_t n, int nthreads, pps_fill_fn fill, void *ctx) {
+  touch_job job;
+
+  if (pool == NULL || (data == NULL && n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  job.data = data;
+  job.n = n;
+  job.fill = fill;
+  job.ctx = ctx;
+
+  nthreads = pps_job_threads(pool, n, nthreads);
+  if (nthreads == 1) { // The scan won't wake anybody up either
+    touch_chunk(&job, 0, n);
+    return 0;
+  }
+
+  size_t bounds[nthreads + 1];
+
+  pps_partition(pool, n, nthreads, data, 0, bounds);
+  job.bounds = bounds;
+  return pps_pool_run(pool, nthreads, touch_function, &job);
+}
+
+int *pps_alloc (pps_pool *pool, size_t n, int nthreads) {
+  size_t page = (size_t) sysconf(_SC_PAGESIZE), bytes;
+  int *data;
+
+  if ((long) page <= 0) page = 4096;
+  if (n > ((size_t) -1 - HUGE_PAGE) / sizeof(int)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (n * sizeof(int) >= HUGE_PAGE) page = HUGE_PAGE; // One TLB entry per 2MB
+  bytes = (n * sizeof(int) + page - 1) / page * page; // aligned_alloc wants a multiple
+  if (bytes == 0) bytes = page;
+
+  data = (int *) aligned_alloc(page, bytes);
+  if (data == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+#ifdef MADV_HUGEPAGE
+  if (page == HUGE_PAGE) madvise(data, bytes, MADV_HUGEPAGE); // Before the workers touch it
+#endif
+  if (pps_init(pool, data, n, nthreads, NULL, NULL) != 0) {
+    free(data);
+    return NULL;
+  }
+  return data;
+}
+
+void pps_free (int *data) {
+  free(data);
+}
@@ -0,0 +1,28 @@
+/*
+ * generic.c
+ * ---------
+ * Instantiations of PPS_DEFINE_SCAN for the typed scans declared in prefixsum.h.
+ */
+
+#include "prefixsum-generic.h"
+
+PPS_DEFINE_SCAN(pps_scan_i64_sum, int64_t, PPS_OP_SUM)
+PPS_DEFINE_SCAN(pps_scan_u64_sum, uint64_t, PPS_OP_SUM)
+PPS_DEFINE_SCAN(pps_scan_f32_sum, float, PPS_OP_SUM)
+PPS_DEFINE_SCAN(pps_scan_f64_sum, double, PPS_OP_SUM)
+
+PPS_DEFINE_SCAN(pps_scan_i32_max, int32_t, PPS_OP_MAX)
+PPS_DEFINE_SCAN(pps_scan_i64_max, int64_t, PPS_OP_MAX)
+PPS_DEFINE_SCAN(pps_scan_u64_max, uint64_t, PPS_OP_MAX)
+PPS_DEFINE_SCAN(pps_scan_f32_max, float, PPS_OP_MAX)
+PPS_DEFINE_SCAN(pps_scan_f64_max, double, PPS_OP_MAX)
+
+PPS_DEFINE_SCAN(pps_scan_i32_min, int32_t, PPS_OP_MIN)
+PPS_DEFINE_SCAN(pps_scan_i64_min, int64_t, PPS_OP_MIN)
+PPS_DEFINE_SCAN(pps_scan_u64_min, uint64_t, PPS_OP_MIN)
+PPS_DEFINE_SCAN(pps_scan_f32_min, float, PPS_OP_MIN)
+PPS_DEFINE_SCAN(pps_scan_f64_min, double, PPS_OP_MIN)
+
+PPS_DEFINE_SCAN(pps_scan_i32_xor, int32_t, PPS_OP_XOR)
+PPS_DEFINE_SCAN(pps_scan_i64_xor, int64_t, PPS_OP_XOR)
+PPS_DEFINE_SCAN(pps_scan_u64_xor, uint64_t, PPS_OP_XOR)
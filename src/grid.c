@@ -0,0 +1,160 @@
+/*
+ * grid.c
+ * ------
+ * 2D prefix sums (summed-area tables, integral images) of pitched grids.
+ *
+ * Element (r, c) of the table is the sum of all elements (r', c') with r' <= r and
+ * c' <= c, which is a scan of every row followed by a scan of every column. Run as
+ * 1D scans that is a job per row, and columns that stride through memory a pitch
+ * at a time. Here the grid is cut into bands of consecutive rows, one per thread,
+ * and the three phases run on bands the way the 1D engines run on chunks:
+ *
+ *      Phase 1 - every thread adds up the rows of its band, vector by vector
+ *                ("accumulate"), and scans the resulting row: the last row of the
+ *                band's own table
+ *      -- barrier --
+ *      Phase 2 - every thread adds up the total rows of the bands before its own,
+ *                the row carried into its band
+ *      Phase 3 - every row is scanned tile by tile and the table row above it
+ *                added to it while both are in L1, the carried row for the first
+ *                row of a band
+ *
+ * So the column pass never strides: it adds whole rows with SIMD, reading them in
+ * order, and each element is read twice and written once, as in the 1D engines.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "internal.h"
+
+// Data structure describing one table, shared by all threads
+typedef struct grid_job {
+  pps_pool *pool; // Pool running the job
+  const int *in; // First element of the input grid
+  size_t in_pitch; // Elements from one input row to the next
+  int *out; // First element of the output grid
+  size_t out_pitch; // Elements from one output row to the next
+  size_t width; // Elements per row
+  size_t height; // Number of rows
+  size_t row_size; // Ints per row of "totals" and "carries", a multiple of a cache line
+  int *totals; // Last row of every band's own table, written in Phase 1
+  int *carries; // Row carried into every band, written in Phase 2
+  size_t tile_size; // Elements per tile of the row scans
+  const pps_kernels *k; // Inner loops
+} grid_job;
+
+/*
+ * Function:  scan_row
+ * -------------------
+ * Phase 3: writes row r of the table from the input row and the table row above
+ * it ("above", NULL for none)
+ */
+static void scan_row (const grid_job *job, size_t r, const int *above) {
+  const int *in = job->in + r * job->in_pitch;
+  int *out = job->out + r * job->out_pitch;
+  size_t start, count;
+  int carry = 0;
+
+  for (start = 0; start < job->width; start += count) {
+    count = job->width - start < job->tile_size ? job->width - start : job->tile_size;
+    carry = job->k->scan(in + start, out + start, count, carry);
+    if (above != NULL) job->k->accumulate(above + start, out + start, count);
+  }
+}
+
+/*
+ * Function:  grid_thread
+ * ----------------------
+ * Function that each active worker of the pool executes for a table
+ *
+ * ctx: the grid_job being computed
+ * id: thread id
+ * nthreads: number of threads taking part
+ */
+static void grid_thread (void *ctx, int id, int nthreads) {
+  grid_job *job = (grid_job *) ctx;
+  size_t first = job->height * id / nthreads, last = job->height * (id + 1) / nthreads, r;
+  int *total, *carry = NULL;
+  int i;
+
+  if (nthreads > 1) {
+    // Phase 1 - Sum the rows of the band and scan the sum
+    PPS_TRACE_TIME(local);
+    total = job->totals + id * job->row_size;
+    memset(total, 0, job->width * sizeof(int));
+    for (r = first; r < last; r++) job->k->accumulate(job->in + r * job->in_pitch, total, job->width);
+    job->k->scan(total, total, job->width, 0);
+    PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_LOCAL, local);
+
+    // Phase 2 - Add up the total rows of the bands above
+    PPS_TRACE_TIME(exchange);
+    pps_pool_barrier(job->pool);
+    if (id > 0) {
+      carry = job->carries + id * job->row_size;
+      memcpy(carry, job->totals, job->width * sizeof(int));
+      for (i = 1; i < id; i++) job->k->accumulate(job->totals + i * job->row_size, carry, job->width);
+    }
+    PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_CARRY, exchange);
+  }
+
+  // Phase 3 - Scan every row and add the table row above
+  PPS_TRACE_TIME(final);
+  for (r = first; r < last; r++) {
+    scan_row(job, r, r > first ? job->out + (r - 1) * job->out_pitch : carry);
+  }
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_FINAL, final);
+}
+
+int pps_scan_2d (pps_pool *pool, const int *in, size_t in_pitch, int *out, size_t out_pitch, size_t width,
+                 size_t height, const pps_options *opts) {
+  pps_options defaults;
+  grid_job job;
+  int nthreads, ret;
+
+  if (opts == NULL) {
+    pps_options_init(&defaults);
+    opts = &defaults;
+  }
+  if (pool == NULL || ((in == NULL || out == NULL) && width > 0 && height > 0) ||
+      (height > 1 && (in_pitch < width || out_pitch < width)) || opts->mode != PPS_INCLUSIVE) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (width == 0 || height == 0) return 0;
+  if (height == 1) return pps_scan_into(pool, in, out, width, opts); // A single row is split across threads
+
+  job.k = pps_get_kernels(opts->isa);
+  if (job.k == NULL) return -1; // errno set by pps_get_kernels
+
+  job.pool = pool;
+  job.in = in;
+  job.in_pitch = in_pitch;
+  job.out = out;
+  job.out_pitch = out_pitch;
+  job.width = width;
+  job.height = height;
+  job.row_size = (width + 15) / 16 * 16;
+  job.totals = NULL;
+  job.carries = NULL;
+  // A tile of input, output and the row above take three quarters of the L1
+  job.tile_size = opts->tile_size > 0 ? opts->tile_size : pps_cache_size(1) / 4 / sizeof(int);
+  if (job.tile_size == 0) job.tile_size = 1;
+
+  nthreads = pps_job_threads(pool, width * height, opts->nthreads);
+  if ((size_t) nthreads > height) nthreads = (int) height;
+  if (nthreads == 1) { // Not worth waking anybody up, a single pass
+    grid_thread(&job, 0, 1);
+    return 0;
+  }
+
+  job.totals = (int *) pps_arena_alloc(pps_pool_scratch(pool), 2 * nthreads * job.row_size * sizeof(int));
+  if (job.totals == NULL) {
+    pps_pool_scratch_release(pool);
+    return -1; // errno set by pps_arena_alloc
+  }
+  job.carries = job.totals + nthreads * job.row_size;
+  ret = pps_pool_run_with(pool, nthreads, grid_thread, &job, opts->barrier);
+  pps_pool_scratch_release(pool);
+  return ret;
+}
@@ -0,0 +1,246 @@
+/*
+ * index.c
+ * -------
+ * Prefix sums kept up to date under point updates.
+ *
+ * The array is cut into blocks of "block" elements, which play the part of the
+ * chunks of the three phase algorithm:
+ *
+ *      - "sums" holds the inclusive prefix sums of every block on its own, the
+ *        result of Phase 1
+ *      - a Fenwick tree over the block totals stands in for Phase 2, so the sum of
+ *        all blocks before any block is found, and changed, in O(log(n / block))
+ *      - Phase 3 is never written out, a query adds the two parts instead
+ *
+ * An update changes the value and the Fenwick tree at once and only marks its block
+ * dirty. A query in a dirty block sums the values of the block up to the element
+ * instead of reading "sums", at most one block's worth of vector adds. Flushing
+ * rescans all dirty blocks as one pool job ("pps_scan_batch"), and so does a bulk
+ * rebuild for every block, so piled up updates cost one parallel pass.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+#define DEFAULT_BLOCK ((size_t) 1024) // Elements per block, 4KB of ints
+
+struct pps_index {
+  pps_pool *pool; // Pool running flushes and rebuilds
+  pps_options opts; // Thread count, instruction set and mode of the scans
+  const pps_kernels *k; // Inner loops of the queries in dirty blocks
+  size_t n; // Number of elements
+  size_t block; // Elements per block
+  size_t nblocks; // Number of blocks
+  int *values; // The elements themselves
+  int *sums; // Inclusive prefix sums within every block, stale in dirty blocks
+  int *tree; // Fenwick tree of the block totals, entries 1 to nblocks
+  unsigned char *dirty; // Whether a block has been updated since its last scan
+  size_t *dirty_list; // Dirty blocks, in the order they were dirtied
+  size_t ndirty; // Number of dirty blocks
+  pps_array *arrays; // Blocks of a flush, "nblocks" entries
+};
+
+/*
+ * Function:  block_length
+ * -----------------------
+ * returns: the number of elements of block "b"
+ */
+static size_t block_length (const pps_index *index, size_t b) {
+  size_t start = b * index->block;
+
+  return index->n - start < index->block ? index->n - start : index->block;
+}
+
+/*
+ * Function:  scan_blocks
+ * ----------------------
+ * Rescans the blocks listed in "blocks" (all of them if NULL) as one batch job and
+ * clears their dirty marks
+ */
+static int scan_blocks (pps_index *index, const size_t *blocks, size_t count) {
+  pps_options opts = index->opts;
+  size_t i, b;
+
+  for (i = 0; i < count; i++) {
+    b = blocks != NULL ? blocks[i] : i;
+    index->arrays[i].in = index->values + b * index->block;
+    index->arrays[i].out = index->sums + b * index->block;
+    index->arrays[i].n = block_length(index, b);
+  }
+  opts.mode = PPS_INCLUSIVE; // The mode only applies to "pps_index_export"
+  opts.tile_size = 0; // Every block on a single thread
+  if (pps_scan_batch(index->pool, index->arrays, count, &opts) != 0) return -1;
+
+  for (i = 0; i < count; i++) index->dirty[blocks != NULL ? blocks[i] : i] = 0;
+  return 0;
+}
+
+/*
+ * Function:  build_tree
+ * ---------------------
+ * Builds the Fenwick tree from the block totals in "sums", in O(nblocks)
+ */
+static void build_tree (pps_index *index) {
+  size_t i, parent;
+
+  for (i = 1; i <= index->nblocks; i++) {
+    index->tree[i] = index->sums[(i - 1) * index->block + block_length(index, i - 1) - 1];
+  }
+  for (i = 1; i <= index->nblocks; i++) { // Every node passes its sum on to its parent
+    parent = i + (i & -i);
+    if (parent <= index->nblocks) index->tree[parent] += index->tree[i];
+  }
+}
+
+/*
+ * Function:  blocks_before
+ * ------------------------
+ * returns: the sum of all elements of the blocks before block "b"
+ */
+static int blocks_before (const pps_index *index, size_t b) {
+  int sum = 0;
+
+  for (; b > 0; b -= b & -b) sum += index->tree[b];
+  return sum;
+}
+
+pps_index *pps_index_create (pps_pool *pool, const int *values, size_t n, const pps_options *opts) {
+  pps_index *index;
+
+  if (pool == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  index = (pps_index *) calloc(1, sizeof(pps_index));
+  if (index == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (opts != NULL) {
+    index->opts = *opts;
+  } else {
+    pps_options_init(&index->opts);
+  }
+  index->k = pps_get_kernels(index->opts.isa);
+  if (index->k == NULL) { // errno set by pps_get_kernels
+    free(index);
+    return NULL;
+  }
+
+  index->pool = pool;
+  index->n = n;
+  index->block = index->opts.tile_size > 0 ? index->opts.tile_size : DEFAULT_BLOCK;
+  index->nblocks = (n + index->block - 1) / index->block;
+  index->values = pps_alloc(pool, n, index->opts.nthreads);
+  index->sums = pps_alloc(pool, n, index->opts.nthreads);
+  index->tree = (int *) calloc(index->nblocks + 1, sizeof(int));
+  index->dirty = (unsigned char *) calloc(index->nblocks + 1, 1);
+  index->dirty_list = (size_t *) malloc((index->nblocks + 1) * sizeof(size_t));
+  index->arrays = (pps_array *) malloc((index->nblocks + 1) * sizeof(pps_array));
+  if ((n > 0 && (index->values == NULL || index->sums == NULL)) || index->tree == NULL || index->dirty == NULL ||
+      index->dirty_list == NULL || index->arrays == NULL) {
+    pps_index_destroy(index);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  if (n > 0 && pps_index_rebuild(index, values) != 0) { // pps_alloc zeroed the values for NULL
+    pps_index_destroy(index);
+    return NULL;
+  }
+  return index;
+}
+
+int pps_index_rebuild (pps_index *index, const int *values) {
+  if (index == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (values != NULL) memcpy(index->values, values, index->n * sizeof(int));
+
+  if (scan_blocks(index, NULL, index->nblocks) != 0) return -1;
+  build_tree(index);
+  index->ndirty = 0;
+  return 0;
+}
+
+int pps_index_add (pps_index *index, size_t i, int delta) {
+  size_t b, node;
+
+  if (index == NULL || i >= index->n) {
+    errno = EINVAL;
+    return -1;
+  }
+  b = i / index->block;
+  index->values[i] += delta;
+  for (node = b + 1; node <= index->nblocks; node += node & -node) index->tree[node] += delta;
+
+  if (!index->dirty[b]) {
+    index->dirty[b] = 1;
+    index->dirty_list[index->ndirty++] = b;
+  }
+  return 0;
+}
+
+int pps_index_set (pps_index *index, size_t i, int value) {
+  if (index == NULL || i >= index->n) {
+    errno = EINVAL;
+    return -1;
+  }
+  return value != index->values[i] ? pps_index_add(index, i, value - index->values[i]) : 0;
+}
+
+int pps_index_get (const pps_index *index, size_t i) {
+  return index->values[i];
+}
+
+int pps_index_prefix (const pps_index *index, size_t i) {
+  size_t b = i / index->block, start = b * index->block;
+
+  if (index->dirty[b]) return blocks_before(index, b) + index->k->reduce(index->values + start, i - start + 1);
+  return blocks_before(index, b) + index->sums[i];
+}
+
+int pps_index_range (const pps_index *index, size_t first, size_t last) {
+  if (first >= last) return 0;
+  return pps_index_prefix(index, last - 1) - (first > 0 ? pps_index_prefix(index, first - 1) : 0);
+}
+
+int pps_index_flush (pps_index *index) {
+  if (index == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (index->ndirty == 0) return 0;
+  if (scan_blocks(index, index->dirty_list, index->ndirty) != 0) return -1;
+  index->ndirty = 0;
+  return 0;
+}
+
+size_t pps_index_pending (const pps_index *index) {
+  return index->ndirty;
+}
+
+size_t pps_index_size (const pps_index *index) {
+  return index->n;
+}
+
+int pps_index_export (const pps_index *index, int *out) {
+  if (index == NULL || (out == NULL && index->n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  return pps_scan_into(index->pool, index->values, out, index->n, &index->opts);
+}
+
+void pps_index_destroy (pps_index *index) {
+  if (index == NULL) return;
+
+  pps_free(index->values); pps_free(index->sums);
+  free(index->tree); free(index->dirty); free(index->dirty_list); free(index->arrays);
+  free(index);
+}
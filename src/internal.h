@@ -0,0 +1,471 @@
+/*
+ * internal.h
+ * ----------
+ * Declarations shared between the translation units of libprefixsum. Nothing in
+ * here is part of the public interface in include/prefixsum.h.
+ */
+
+#ifndef PPS_INTERNAL_H
+#define PPS_INTERNAL_H
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "prefixsum.h"
+
+/*
+ * Function:  pps_pool_run_with
+ * ----------------------------
+ * Same as "pps_pool_run", with the kind of barrier "pps_pool_barrier" uses for this
+ * job (PPS_BARRIER_DEFAULT for the pool's own)
+ */
+int pps_pool_run_with (pps_pool *pool, int nthreads, pps_task_fn fn, void *ctx, pps_barrier barrier);
+
+typedef struct pps_trace pps_trace; // Measurements of the workers of a pool (trace.c)
+
+/*
+ * Function:  pps_trace_create
+ * ---------------------------
+ * returns: empty measurements for nthreads workers, NULL with errno set on failure
+ */
+pps_trace *pps_trace_create (int nthreads);
+
+/*
+ * Function:  pps_trace_destroy
+ * ----------------------------
+ * Frees the measurements and closes the counters (NULL is ignored)
+ */
+void pps_trace_destroy (pps_trace *trace);
+
+/*
+ * Function:  pps_trace_now
+ * ------------------------
+ * returns: a monotonic timestamp in nanoseconds
+ */
+uint64_t pps_trace_now (void);
+
+/*
+ * Function:  pps_trace_job
+ * -----------------------
+ * Called by a worker as it starts on a job, records its wake-up latency and opens
+ * or closes its counters as asked for by "pps_pool_enable_counters"
+ *
+ * submitted: "pps_trace_now" when the job was submitted
+ */
+void pps_trace_job (pps_trace *trace, int id, uint64_t submitted);
+
+/*
+ * Function:  pps_trace_record
+ * ---------------------------
+ * Records that worker "id" spent [start, now) in a phase
+ */
+void pps_trace_record (pps_trace *trace, int id, pps_phase phase, uint64_t start);
+
+/*
+ * Function:  pps_pool_trace
+ * -------------------------
+ * returns: the measurements of the pool, NULL unless built with PPS_TRACE
+ */
+pps_trace *pps_pool_trace (const pps_pool *pool);
+
+// Hooks timing a phase of worker "id", nothing unless built with PPS_TRACE:
+//
+//      PPS_TRACE_TIME(t);
+//      ... phase ...
+//      PPS_TRACE_PHASE(pool, id, PPS_PHASE_LOCAL, t);
+#ifdef PPS_TRACE
+#define PPS_TRACE_TIME(t) uint64_t t = pps_trace_now()
+#define PPS_TRACE_PHASE(pool, id, phase, t) pps_trace_record(pps_pool_trace(pool), id, phase, t)
+#else
+#define PPS_TRACE_TIME(t)
+#define PPS_TRACE_PHASE(pool, id, phase, t) ((void) 0)
+#endif
+
+// Sense-reversing barrier built on atomics (barrier.c)
+typedef struct pps_spin_barrier {
+  _Atomic int count __attribute__((aligned(64))); // Threads still to arrive
+  int nthreads; // Threads taking part
+  _Atomic unsigned generation __attribute__((aligned(64))); // Bumped by the last thread in, waiters spin on it
+  _Atomic int sleepers; // Hybrid waiters sleeping on the futex
+} pps_spin_barrier;
+
+/*
+ * Function:  pps_spin_barrier_init
+ * --------------------------------
+ * Prepares a barrier for "nthreads" threads, must not be called while one waits on it
+ */
+void pps_spin_barrier_init (pps_spin_barrier *barrier, int nthreads);
+
+/*
+ * Function:  pps_spin_barrier_wait
+ * --------------------------------
+ * Waits until all threads have reached the barrier. The barrier is reusable.
+ *
+ * hybrid: whether to fall asleep on a futex after spinning for a while
+ */
+void pps_spin_barrier_wait (pps_spin_barrier *barrier, int hybrid);
+
+/*
+ * Function:  pps_cpu_relax
+ * ------------------------
+ * Body of a spin-wait loop. Pauses the core for a moment and, every so often,
+ * yields it so that a spinning thread can't starve the one it is waiting for
+ * on an oversubscribed host
+ *
+ * spins: number of times the caller has already spun, reset on progress
+ */
+static inline void pps_cpu_relax (unsigned *spins) {
+  if (++*spins % 64 == 0) {
+    sched_yield();
+  } else {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+}
+
+// Inner loops of the engines for one instruction set (simd.c)
+typedef struct pps_kernels {
+  pps_isa isa; // Instruction set of the kernels
+  const char *name; // Printable name of the instruction set
+  int (*scan) (const int *in, int *out, size_t n, int carry); // Inclusive scan from a carry-in, returns the carry-out
+  int (*scan_exclusive) (const int *in, int *out, size_t n, int carry); // Same, exclusive
+  void (*add) (const int *in, int *out, size_t n, int value); // Adds a value to every element
+  int (*reduce) (const int *data, size_t n); // Sum of the elements
+  void (*widen_u8) (const uint8_t *in, int *out, size_t n); // Zero extends every element
+  void (*widen_u16) (const uint16_t *in, int *out, size_t n); // Same for uint16 elements
+  int64_t (*reduce_u8) (const uint8_t *data, size_t n); // Sum of the elements, never widened to int first
+  int64_t (*reduce_u16) (const uint16_t *data, size_t n); // Same for uint16 elements
+  void (*accumulate) (const int *in, int *out, size_t n); // Adds every element of "in" to that of "out"
+} pps_kernels;
+
+/*
+ * Function:  pps_get_kernels
+ * --------------------------
+ * returns: the kernels of an instruction set (PPS_ISA_AUTO for the best one), or
+ *          NULL with errno set to ENOTSUP if the CPU can't run them
+ */
+const pps_kernels *pps_get_kernels (pps_isa isa);
+
+/*
+ * Function:  pps_streaming_kernels
+ * --------------------------------
+ * returns: the kernels of the same instruction set with non-temporal stores in the
+ *          scans and the add (the same kernels for the scalar ones)
+ */
+const pps_kernels *pps_streaming_kernels (const pps_kernels *k);
+
+/*
+ * Function:  pps_lookback_scan
+ * ----------------------------
+ * Single pass prefix sum with decoupled look-back (lookback.c)
+ *
+ * opts->engine: PPS_ENGINE_DYNAMIC to pull tiles from a shared counter
+ * opts->tile_size: elements per tile, 0 to derive it from the L1 size
+ */
+int pps_lookback_scan (pps_pool *pool, const int *in, int *out, size_t n, int nthreads,
+                       const pps_options *opts, const pps_kernels *k);
+
+// Values of a tile's status flag in the look-back engines
+enum { PPS_TILE_INVALID, PPS_TILE_AGGREGATE, PPS_TILE_INCLUSIVE };
+
+// Status of a tile, one per cache line so that spinning threads don't disturb writers
+typedef struct pps_tile_status {
+  _Atomic int flag; // PPS_TILE_INVALID until one of the values below is valid
+  int aggregate; // Sum of the tile's own elements
+  int inclusive; // Sum of all elements up to and including the tile
+} __attribute__((aligned(64))) pps_tile_status;
+
+// Next tile to hand out from a shared counter, alone in its cache line
+typedef struct pps_tile_counter {
+  _Atomic size_t next;
+} __attribute__((aligned(64))) pps_tile_counter;
+
+/*
+ * Function:  pps_look_back
+ * ------------------------
+ * Computes the sum of all elements before a tile from the status of its predecessors
+ *
+ * status: status array of the array being scanned
+ * tile: index of the tile looking back
+ */
+int pps_look_back (pps_tile_status *status, size_t tile);
+
+/*
+ * Function:  pps_lookback_tile
+ * ----------------------------
+ * Does the whole look-back step for tile number "tile" of an array: sums the tile,
+ * publishes its aggregate, looks back, publishes its inclusive prefix and scans it
+ *
+ * in, out, n: the elements of the tile
+ * scan: inclusive or exclusive scan kernel of "k"
+ *
+ * returns: the inclusive prefix of the tile
+ */
+int pps_lookback_tile (pps_tile_status *status, size_t tile, const int *in, int *out, size_t n,
+                       const pps_kernels *k, int (*scan) (const int *, int *, size_t, int));
+
+/*
+ * Function:  pps_blocked_scan
+ * ---------------------------
+ * Cache-blocked reduce-then-scan prefix sum (blocked.c)
+ *
+ * opts->tile_size: elements per tile, 0 to derive it from the L2 size
+ */
+int pps_blocked_scan (pps_pool *pool, const int *in, int *out, size_t n, int nthreads,
+                      const pps_options *opts, const pps_kernels *k);
+
+/*
+ * Function:  pps_cache_size
+ * -------------------------
+ * Size of the data (or unified) cache at a level of the hierarchy (cache-info.c)
+ *
+ * level: 1, 2 or 3
+ *
+ * returns: the size in bytes, a typical size if it can't be detected
+ */
+size_t pps_cache_size (int level);
+
+/*
+ * Function:  pps_scan_kernel
+ * --------------------------
+ * returns: the scan kernel (inclusive or exclusive) asked for by opts->mode
+ */
+static inline int (*pps_scan_kernel (const pps_kernels *k, const pps_options *opts)) (const int *, int *, size_t, int) {
+  return opts->mode == PPS_EXCLUSIVE ? k->scan_exclusive : k->scan;
+}
+
+/*
+ * Function:  pps_scan_threads
+ * ---------------------------
+ * Runs the engine asked for by opts on exactly nthreads workers (1 for the
+ * calling thread alone)
+ */
+int pps_scan_threads (pps_pool *pool, const int *in, int *out, size_t n, int nthreads,
+                      const pps_options *opts, const pps_kernels *k);
+
+#define PPS_MAX_CROSSOVERS 32 // Entries of a crossover table
+
+// Crossover table of a pool, measured by "pps_pool_calibrate" or loaded from a file
+// (tuning.c). A job on n elements runs on the most threads[i] with min_items[i] <= n.
+typedef struct pps_tuning {
+  size_t simd_min; // Arrays shorter than this use the scalar loop
+  int count; // Number of entries below
+  int threads[PPS_MAX_CROSSOVERS]; // Thread count of an entry
+  size_t min_items[PPS_MAX_CROSSOVERS]; // Shortest array worth threads[i] threads
+} pps_tuning;
+
+/*
+ * Function:  pps_pool_tuning
+ * --------------------------
+ * returns: the crossover table of the pool, NULL if it has none
+ */
+const pps_tuning *pps_pool_tuning (const pps_pool *pool);
+
+/*
+ * Function:  pps_pool_store_tuning
+ * --------------------------------
+ * Replaces the crossover table of the pool (NULL to drop it)
+ */
+void pps_pool_store_tuning (pps_pool *pool, const pps_tuning *tuning);
+
+/*
+ * Function:  pps_tuned_threads
+ * ----------------------------
+ * returns: the thread count the table picks for n elements, at most max_threads
+ */
+int pps_tuned_threads (const pps_tuning *tuning, size_t n, int max_threads);
+
+/*
+ * Function:  pps_job_threads
+ * --------------------------
+ * Number of workers a job on n elements runs with, from the caller's bound
+ * (0 or too large for the whole pool) and the pool's crossover table, or
+ * "pps_choose_threads" if it has none
+ */
+int pps_job_threads (const pps_pool *pool, size_t n, int nthreads);
+
+/*
+ * Function:  pps_partition
+ * ------------------------
+ * Splits n elements into the contiguous chunks of nthreads workers (partition.c).
+ * The remainder of the division is spread over the workers, chunk sizes follow the
+ * pool's worker weights ("pps_pool_set_weights") and chunk starts are rounded to
+ * "align" bytes of "base" so that neighbouring workers don't write the same line.
+ *
+ * base: array the chunks are written to (only its address is used)
+ * align: alignment of the chunk starts in bytes, 0 for a cache line (a page when
+ *        the pool is pinned by NUMA node)
+ * bounds: receives nthreads + 1 indices, chunk i is [bounds[i], bounds[i + 1])
+ */
+void pps_partition (const pps_pool *pool, size_t n, int nthreads, const void *base, size_t align, size_t *bounds);
+
+/*
+ * Function:  pps_partition_sized
+ * ------------------------------
+ * Same as "pps_partition" for an array of elements of "size" bytes rather than ints
+ */
+void pps_partition_sized (const pps_pool *pool, size_t n, int nthreads, const void *base, size_t size,
+                          size_t align, size_t *bounds);
+
+// "pps_chunk_bounds" reads the bounds of "pps_partition" too, see prefixsum.h
+
+/*
+ * Function:  pps_cpu_topology
+ * ---------------------------
+ * Lists the CPUs the process may run on, node after node, from the NUMA nodes in
+ * sysfs (topology.c). Everything is on node 0 when the nodes aren't known.
+ *
+ * cpus: receives the CPU ids
+ * nodes: receives the node of every CPU
+ * max: room in both arrays
+ *
+ * returns: the number of CPUs listed
+ */
+int pps_cpu_topology (int *cpus, int *nodes, int max);
+
+/*
+ * Function:  pps_pool_group_size
+ * ------------------------------
+ * returns: the Phase 2 group size for a job of nthreads workers, the number of
+ *          workers on the first node when the pool is pinned by NUMA node and
+ *          the job spans several nodes, 0 (the default) otherwise
+ */
+int pps_pool_group_size (const pps_pool *pool, int nthreads);
+
+/*
+ * Function:  pps_pool_weights
+ * ---------------------------
+ * returns: the relative speed of every worker, NULL when they are all equal
+ */
+const double *pps_pool_weights (const pps_pool *pool);
+
+/*
+ * Function:  pps_pool_scratch
+ * ---------------------------
+ * Takes the scratch arena of the pool for the duration of one call, emptied.
+ * Concurrent callers wait for "pps_pool_scratch_release". Nothing taken from it
+ * may be kept across calls.
+ */
+pps_arena *pps_pool_scratch (pps_pool *pool);
+
+/*
+ * Function:  pps_pool_scratch_release
+ * -----------------------------------
+ * Gives back the arena taken by "pps_pool_scratch"
+ */
+void pps_pool_scratch_release (pps_pool *pool);
+
+/*
+ * Function:  pps_pool_offload
+ * ---------------------------
+ * returns: the offload function a scan of n elements goes to, with its argument in
+ *          "ctx", NULL if it stays on the pool
+ */
+pps_offload_fn pps_pool_offload (pps_pool *pool, size_t n, void **ctx);
+
+typedef struct pps_async pps_async; // Dispatcher of the asynchronous scans of a pool (async.c)
+
+/*
+ * Function:  pps_async_create
+ * ---------------------------
+ * Starts the dispatcher thread of a pool
+ *
+ * returns: the dispatcher, NULL with errno set on failure
+ */
+pps_async *pps_async_create (pps_pool *pool);
+
+/*
+ * Function:  pps_async_destroy
+ * ----------------------------
+ * Runs the scans still queued, then stops the dispatcher (NULL is ignored)
+ */
+void pps_async_destroy (pps_async *async);
+
+/*
+ * Function:  pps_pool_async
+ * -------------------------
+ * returns: the dispatcher of the pool, started on the first call, NULL with errno
+ *          set if it can't be started
+ */
+pps_async *pps_pool_async (pps_pool *pool);
+
+/*
+ * Function:  pps_pool_affinity
+ * ----------------------------
+ * returns: how the workers of the pool are pinned
+ */
+pps_affinity pps_pool_affinity (const pps_pool *pool);
+
+// Value alone in its cache line, so that threads publishing side by side don't
+// false share
+typedef struct pps_slot {
+  int value;
+  int flag; // Segmented scans: whether a segment starts in the chunk (or group)
+  int64_t wide; // Value of "pps_carry_exchange64"
+} __attribute__((aligned(64))) pps_slot;
+
+// State of the hierarchical carry propagation of a chunked engine (carry.c)
+typedef struct pps_carry {
+  pps_slot *totals; // Chunk total of every thread
+  pps_slot *group_totals; // Total of every group of threads
+  int group_size; // Number of consecutive threads per group
+} pps_carry;
+
+// Number of slots "pps_carry_init" needs for a job of nthreads threads
+#define PPS_CARRY_SLOTS(nthreads) (2 * (nthreads))
+
+/*
+ * Function:  pps_carry_init
+ * -------------------------
+ * Prepares the carry propagation of one job
+ *
+ * slots: PPS_CARRY_SLOTS(nthreads) slots of scratch space
+ * group_size: threads per group, 0 for about sqrt(nthreads)
+ */
+void pps_carry_init (pps_carry *carry, pps_slot *slots, int nthreads, int group_size);
+
+/*
+ * Function:  pps_carry_exchange
+ * -----------------------------
+ * Phase 2 of a chunked engine, called by every active worker between Phase 1 and
+ * Phase 3. Contains the two barriers of the algorithm.
+ *
+ * total: sum of the calling thread's chunk
+ *
+ * returns: the sum of all chunks before the calling thread's one
+ */
+int pps_carry_exchange (pps_carry *carry, pps_pool *pool, int id, int nthreads, int total);
+
+/*
+ * Function:  pps_carry_total
+ * --------------------------
+ * Sum of all chunks, valid in every thread from the return of
+ * "pps_carry_exchange" to the end of the job
+ */
+int pps_carry_total (const pps_carry *carry, int nthreads);
+
+/*
+ * Function:  pps_carry_exchange64
+ * -------------------------------
+ * Same as "pps_carry_exchange" with int64 totals, for the engines whose sums must
+ * not wrap at the width of an int
+ */
+int64_t pps_carry_exchange64 (pps_carry *carry, pps_pool *pool, int id, int nthreads, int64_t total);
+
+/*
+ * Function:  pps_carry_exchange_segmented
+ * ---------------------------------------
+ * Phase 2 of a segmented scan, the (flag, value) pairs of the chunks are combined
+ * so that a chunk containing a segment head cuts off everything before it
+ *
+ * total: sum of the calling thread's chunk after its last segment head (the whole
+ *        chunk if it has none)
+ * head: whether a segment starts in the chunk
+ *
+ * returns: the sum of the open segment's elements before the calling thread's chunk
+ */
+int pps_carry_exchange_segmented (pps_carry *carry, pps_pool *pool, int id, int nthreads, int total, int head);
+
+#endif
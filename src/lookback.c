@@ -0,0 +1,163 @@
+/*
+ * lookback.c
+ * ----------
+ * Single pass prefix sum with decoupled look-back.
+ *
+ * The array is cut into fixed size tiles which are dealt out to the threads in
+ * round-robin order, so every thread walks its tiles from left to right. For each
+ * tile a thread:
+ *
+ *      1. sums the tile without writing it and publishes the sum as the tile's
+ *         AGGREGATE
+ *      2. looks back at the tiles to its left, adding up their aggregates until it
+ *         meets one that has already published its INCLUSIVE prefix
+ *      3. publishes its own inclusive prefix, so that later tiles can stop here
+ *      4. scans the tile, which is still in cache, with the carry from step 2
+ *
+ * Each element is therefore read once from memory and written once, and the
+ * threads never meet at a barrier: a thread only spins when the tile right before
+ * its own hasn't even been summed yet. Publishing the aggregate before looking back
+ * is what keeps this deadlock-free, since no tile waits on a tile to its right.
+ *
+ * With a static round-robin deal a preempted or throttled thread still owns every
+ * nthreads-th tile and holds up everything after its next one. In dynamic mode
+ * (PPS_ENGINE_DYNAMIC) the threads instead pull the next tile from a shared atomic
+ * counter. Tiles are still claimed from left to right, so a tile only ever waits
+ * for tiles that are already being worked on, and a late thread simply does fewer
+ * tiles.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "internal.h"
+
+// Data structure describing one look-back prefix sum, shared by all threads
+typedef struct lookback_job {
+  pps_tile_counter counter; // Tile dispenser of dynamic mode
+  pps_pool *pool; // Pool running the job
+  const int *in; // Input array pointer
+  int *data; // Global (output) array pointer, may be "in"
+  size_t n; // Number of elements in "data"
+  size_t tile_size; // Elements per tile
+  size_t ntiles; // Number of tiles
+  int dynamic; // Whether tiles come from "counter" rather than round-robin
+  pps_tile_status *status; // One status per tile
+  const pps_kernels *k; // Inner loops
+  int (*scan) (const int *, int *, size_t, int); // Inclusive or exclusive tile scan
+} lookback_job;
+
+int pps_look_back (pps_tile_status *status, size_t tile) {
+  size_t j = tile;
+  unsigned spins = 0;
+  int exclusive = 0, flag;
+
+  while (j > 0) {
+    flag = atomic_load_explicit(&status[j-1].flag, memory_order_acquire);
+    if (flag == PPS_TILE_INVALID) { // Predecessor hasn't been summed yet
+      pps_cpu_relax(&spins);
+      continue;
+    }
+    spins = 0;
+    if (flag == PPS_TILE_INCLUSIVE) {
+      return exclusive + status[j-1].inclusive; // Everything further left is folded in
+    }
+    exclusive += status[j-1].aggregate;
+    j--;
+  }
+  return exclusive;
+}
+
+int pps_lookback_tile (pps_tile_status *status, size_t tile, const int *in, int *out, size_t n,
+                       const pps_kernels *k, int (*scan) (const int *, int *, size_t, int)) {
+  int aggregate, exclusive;
+
+  aggregate = k->reduce(in, n);
+
+  if (tile == 0) { // Nothing to look back at
+    exclusive = 0;
+  } else {
+    status[tile].aggregate = aggregate;
+    atomic_store_explicit(&status[tile].flag, PPS_TILE_AGGREGATE, memory_order_release);
+    exclusive = pps_look_back(status, tile);
+  }
+
+  status[tile].inclusive = exclusive + aggregate;
+  atomic_store_explicit(&status[tile].flag, PPS_TILE_INCLUSIVE, memory_order_release);
+
+  scan(in, out, n, exclusive);
+  return exclusive + aggregate;
+}
+
+/*
+ * Function:  next_tile
+ * --------------------
+ * returns: the tile a thread works on after "tile" (ntiles or more when done)
+ */
+static size_t next_tile (lookback_job *job, size_t tile, int nthreads) {
+  if (job->dynamic) {
+    return atomic_fetch_add_explicit(&job->counter.next, 1, memory_order_relaxed);
+  }
+  return tile + nthreads;
+}
+
+/*
+ * Function:  lookback_thread
+ * --------------------------
+ * Function that each active worker of the pool executes for a look-back prefix sum
+ *
+ * ctx: the lookback_job being computed
+ * id: thread id
+ * nthreads: number of threads taking part
+ */
+static void lookback_thread (void *ctx, int id, int nthreads) {
+  lookback_job *job = (lookback_job *) ctx;
+  size_t tile, start_index, end_index;
+
+  tile = job->dynamic ? next_tile(job, 0, nthreads) : (size_t) id;
+  for (; tile < job->ntiles; tile = next_tile(job, tile, nthreads)) {
+    start_index = tile * job->tile_size;
+    end_index = start_index + job->tile_size;
+    if (end_index > job->n) end_index = job->n;
+
+    PPS_TRACE_TIME(local); // Tiles show up one by one in the timeline
+    pps_lookback_tile(job->status, tile, job->in + start_index, job->data + start_index,
+                      end_index - start_index, job->k, job->scan);
+    PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_LOCAL, local);
+  }
+}
+
+int pps_lookback_scan (pps_pool *pool, const int *in, int *out, size_t n, int nthreads,
+                       const pps_options *opts, const pps_kernels *k) {
+  size_t i, tile_size = opts->tile_size;
+  lookback_job job;
+  int ret;
+
+  if (tile_size == 0) tile_size = pps_cache_size(1) / sizeof(int); // Re-read from L1/L2 in step 4
+
+  job.pool = pool;
+  job.in = in;
+  job.data = out;
+  job.k = k;
+  job.scan = pps_scan_kernel(k, opts);
+  job.n = n;
+  job.tile_size = tile_size;
+  job.ntiles = (n + tile_size - 1) / tile_size;
+  job.dynamic = opts->engine == PPS_ENGINE_DYNAMIC;
+  atomic_init(&job.counter.next, 0);
+  job.status = (pps_tile_status *) pps_arena_alloc(pps_pool_scratch(pool), job.ntiles * sizeof(pps_tile_status));
+  if (job.status == NULL) {
+    pps_pool_scratch_release(pool);
+    return -1; // errno set by pps_arena_alloc
+  }
+  for (i = 0; i < job.ntiles; i++) {
+    atomic_init(&job.status[i].flag, PPS_TILE_INVALID);
+  }
+
+  if ((size_t) nthreads > job.ntiles) nthreads = (int) job.ntiles; // No thread without a tile
+
+  ret = pps_pool_run(pool, nthreads, lookback_thread, &job);
+  pps_pool_scratch_release(pool);
+  return ret;
+}
@@ -0,0 +1,283 @@
+/*
+ * narrow.c
+ * --------
+ * Prefix sums of narrow and bit-packed input into int or int64 output.
+ *
+ * Widening the input into a temporary int array and scanning that would move the
+ * data through memory one more time than needed, at four times the size of an
+ * uint8 input. Here the decode is fused into the phases of the three phase engine
+ * instead, chunk by chunk:
+ *
+ *      Phase 1 - every thread sums its chunk as it is: uint8 and uint16 input by
+ *                the narrow reduce kernels, without widening anything, packed
+ *                input by decoding tiles into a buffer that stays in L1
+ *      Phase 2 - hierarchical scan of the chunk totals as int64 (carry.c), so
+ *                that they don't wrap before the int64 output sees them
+ *      Phase 3 - every tile is widened (or decoded) straight into the output and
+ *                scanned in place from its carry while still in L1, or into the
+ *                buffer first for int64 output
+ *
+ * So the output is written once and the input read twice, at its own width. Packed
+ * input holds value i in bits [i * bits, (i + 1) * bits) of the byte array, least
+ * significant bit first.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#include "internal.h"
+
+// Kinds of input
+enum { NARROW_U8, NARROW_U16, NARROW_PACKED };
+
+// Data structure describing one scan, shared by all threads
+typedef struct narrow_job {
+  pps_pool *pool; // Pool running the job
+  int kind; // NARROW_U8, NARROW_U16 or NARROW_PACKED
+  const void *in; // Input elements
+  int bits; // Bits per element of packed input
+  size_t nbytes; // Bytes of packed input
+  int *out; // Output of int sums, NULL for int64
+  int64_t *out64; // Output of int64 sums, NULL for int
+  size_t n; // Number of elements
+  int exclusive; // Whether the prefix sum is exclusive
+  const size_t *bounds; // Chunk boundaries, see "pps_partition"
+  size_t tile_size; // Elements per tile and per buffer
+  size_t sum_tile; // Elements per int sum of packed input in Phase 1, at most "tile_size"
+  int *buffers; // One buffer of "tile_size" ints per thread
+  pps_carry carry; // Chunk totals and carries of Phase 2
+  const pps_kernels *k; // Inner loops
+} narrow_job;
+
+/*
+ * Function:  decode_packed
+ * ------------------------
+ * Writes the elements [start, start + count) of packed input to "dst"
+ */
+static void decode_packed (const narrow_job *job, int *dst, size_t start, size_t count) {
+  const uint8_t *in = (const uint8_t *) job->in;
+  uint32_t mask = ((uint32_t) 1 << job->bits) - 1, word;
+  size_t i, j, bit = start * job->bits, byte;
+
+  for (i = 0; i < count; i++, bit += job->bits) {
+    byte = bit >> 3;
+    if (byte + 4 <= job->nbytes) { // One unaligned load holds the 7 + 16 bits needed at most
+      memcpy(&word, in + byte, 4);
+    } else { // Last bytes of the input
+      for (word = 0, j = 0; byte + j < job->nbytes; j++) word |= (uint32_t) in[byte + j] << 8 * j;
+    }
+    dst[i] = (int) ((word >> (bit & 7)) & mask);
+  }
+}
+
+/*
+ * Function:  widen_tile
+ * ---------------------
+ * Writes the elements [start, start + count) as ints to "dst"
+ */
+static void widen_tile (const narrow_job *job, int *dst, size_t start, size_t count) {
+  switch (job->kind) {
+  case NARROW_U8:
+    job->k->widen_u8((const uint8_t *) job->in + start, dst, count);
+    break;
+  case NARROW_U16:
+    job->k->widen_u16((const uint16_t *) job->in + start, dst, count);
+    break;
+  default:
+    decode_packed(job, dst, start, count);
+  }
+}
+
+/*
+ * Function:  chunk_total
+ * ----------------------
+ * Phase 1: returns the sum of the elements [start, end)
+ */
+static int64_t chunk_total (const narrow_job *job, int *buffer, size_t start, size_t end) {
+  int64_t total = 0;
+  size_t count;
+
+  switch (job->kind) {
+  case NARROW_U8:
+    return job->k->reduce_u8((const uint8_t *) job->in + start, end - start);
+  case NARROW_U16:
+    return job->k->reduce_u16((const uint16_t *) job->in + start, end - start);
+  default: // Tiles short enough for their sum to fit an unsigned
+    for (; start < end; start += count) {
+      count = end - start < job->sum_tile ? end - start : job->sum_tile;
+      decode_packed(job, buffer, start, count);
+      total += (unsigned) job->k->reduce(buffer, count);
+    }
+    return total;
+  }
+}
+
+/*
+ * Function:  scan_chunk
+ * ---------------------
+ * Phase 3: writes the prefix sums of [start, end) from the sum of the elements
+ * before them
+ */
+static void scan_chunk (const narrow_job *job, int *buffer, size_t start, size_t end, int64_t carry) {
+  int (*scan) (const int *, int *, size_t, int) = job->exclusive ? job->k->scan_exclusive : job->k->scan;
+  int64_t *out64;
+  size_t count, i;
+  int *sums;
+
+  for (; start < end; start += count) {
+    count = end - start < job->tile_size ? end - start : job->tile_size;
+    if (job->out != NULL) { // Widened in place, the tile is still in L1 for the scan
+      sums = job->out + start;
+      widen_tile(job, sums, start, count);
+      carry = scan(sums, sums, count, (int) carry); // The int sums wrap like those of int input
+      continue;
+    }
+    widen_tile(job, buffer, start, count);
+    out64 = job->out64 + start;
+    if (job->exclusive) {
+      for (i = 0; i < count; i++) {
+        out64[i] = carry;
+        carry += buffer[i];
+      }
+    } else {
+      for (i = 0; i < count; i++) {
+        carry += buffer[i];
+        out64[i] = carry;
+      }
+    }
+  }
+}
+
+/*
+ * Function:  narrow_thread
+ * ------------------------
+ * Function that each active worker of the pool executes for a scan
+ *
+ * ctx: the narrow_job being computed
+ * id: thread id
+ * nthreads: number of threads taking part
+ */
+static void narrow_thread (void *ctx, int id, int nthreads) {
+  narrow_job *job = (narrow_job *) ctx;
+  int *buffer = job->buffers != NULL ? job->buffers + id * job->tile_size : NULL;
+  size_t start_index, end_index;
+  int64_t carry = 0;
+
+  pps_chunk_bounds(job->bounds, id, &start_index, &end_index);
+
+  if (nthreads > 1) {
+    // Phase 1 - Sum the chunk at the input's own width
+    PPS_TRACE_TIME(local);
+    carry = chunk_total(job, buffer, start_index, end_index);
+    PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_LOCAL, local);
+
+    // Phase 2 - Hierarchical scan of the chunk totals, between two barriers
+    PPS_TRACE_TIME(exchange);
+    carry = pps_carry_exchange64(&job->carry, job->pool, id, nthreads, carry);
+    PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_CARRY, exchange);
+  }
+
+  // Phase 3 - Widen and scan every tile from the carry
+  PPS_TRACE_TIME(final);
+  scan_chunk(job, buffer, start_index, end_index, carry);
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_FINAL, final);
+}
+
+/*
+ * Function:  narrow_scan
+ * ----------------------
+ * Common part of the entry points, into "out" or "out64"
+ */
+static int narrow_scan (pps_pool *pool, int kind, const void *in, int bits, int *out, int64_t *out64, size_t n,
+                        const pps_options *opts) {
+  const pps_kernels *k;
+  pps_options defaults;
+  narrow_job job;
+  int nthreads, ret;
+
+  if (pool == NULL || ((in == NULL || (out == NULL && out64 == NULL)) && n > 0) ||
+      (kind == NARROW_PACKED && (bits < 1 || bits > 16))) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (opts == NULL) {
+    pps_options_init(&defaults);
+    opts = &defaults;
+  }
+  k = pps_get_kernels(opts->isa);
+  if (k == NULL) return -1; // errno set by pps_get_kernels
+
+  job.pool = pool;
+  job.kind = kind;
+  job.in = in;
+  job.bits = bits;
+  job.nbytes = kind == NARROW_PACKED ? (n * bits + 7) / 8 : 0;
+  job.out = out;
+  job.out64 = out64;
+  job.n = n;
+  job.exclusive = opts->mode == PPS_EXCLUSIVE;
+  job.k = k;
+
+  // A tile of output and a tile of buffer never take more than half the L1
+  job.tile_size = opts->tile_size > 0 ? opts->tile_size : pps_cache_size(1) / 4 / sizeof(int);
+  if (job.tile_size == 0) job.tile_size = 1;
+  // The values of a tile added up in an unsigned can't be more than UINT_MAX
+  job.sum_tile = bits > 0 ? UINT_MAX / (((size_t) 1 << bits) - 1) : job.tile_size;
+  if (job.sum_tile > job.tile_size) job.sum_tile = job.tile_size;
+  nthreads = pps_job_threads(pool, n, opts->nthreads);
+
+  pps_slot slots[PPS_CARRY_SLOTS(nthreads)]; // Scratch space of Phase 2
+  size_t bounds[nthreads + 1];
+
+  if (out != NULL) {
+    pps_partition(pool, n, nthreads, out, opts->chunk_align, bounds);
+  } else { // Chunk starts aligned in int64 elements
+    pps_partition_sized(pool, n, nthreads, out64, sizeof(int64_t), opts->chunk_align, bounds);
+  }
+  job.bounds = bounds;
+  pps_carry_init(&job.carry, slots, nthreads, pps_pool_group_size(pool, nthreads));
+
+  // Buffers for the decode of Phase 1 and the int64 sums of Phase 3
+  job.buffers = NULL;
+  if (out64 != NULL || (kind == NARROW_PACKED && nthreads > 1)) {
+    job.buffers = (int *) pps_arena_alloc(pps_pool_scratch(pool), nthreads * job.tile_size * sizeof(int));
+    if (job.buffers == NULL) {
+      pps_pool_scratch_release(pool);
+      return -1; // errno set by pps_arena_alloc
+    }
+  }
+  ret = 0;
+  if (nthreads == 1) { // Not worth waking anybody up
+    narrow_thread(&job, 0, 1);
+  } else {
+    ret = pps_pool_run_with(pool, nthreads, narrow_thread, &job, opts->barrier);
+  }
+  if (job.buffers != NULL) pps_pool_scratch_release(pool);
+  return ret;
+}
+
+int pps_scan_u8 (pps_pool *pool, const uint8_t *in, int *out, size_t n, const pps_options *opts) {
+  return narrow_scan(pool, NARROW_U8, in, 0, out, NULL, n, opts);
+}
+
+int pps_scan_u16 (pps_pool *pool, const uint16_t *in, int *out, size_t n, const pps_options *opts) {
+  return narrow_scan(pool, NARROW_U16, in, 0, out, NULL, n, opts);
+}
+
+int pps_scan_packed (pps_pool *pool, const uint8_t *in, int bits, int *out, size_t n, const pps_options *opts) {
+  return narrow_scan(pool, NARROW_PACKED, in, bits, out, NULL, n, opts);
+}
+
+int pps_scan_u8_i64 (pps_pool *pool, const uint8_t *in, int64_t *out, size_t n, const pps_options *opts) {
+  return narrow_scan(pool, NARROW_U8, in, 0, NULL, out, n, opts);
+}
+
+int pps_scan_u16_i64 (pps_pool *pool, const uint16_t *in, int64_t *out, size_t n, const pps_options *opts) {
+  return narrow_scan(pool, NARROW_U16, in, 0, NULL, out, n, opts);
+}
+
+int pps_scan_packed_i64 (pps_pool *pool, const uint8_t *in, int bits, int64_t *out, size_t n,
+                         const pps_options *opts) {
+  return narrow_scan(pool, NARROW_PACKED, in, bits, NULL, out, n, opts);
+}
@@ -1,101 +1,68 @@
 /*
- * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
- * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ Discussion ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
- * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
- * 
- * 1. Approach
- * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
- * 
- * The method "parallelprefixsum" is responsible for the following three main things:
- * 
- *      - Distribution of array to processes via specified indeces
- *      - Packing of arguments to be used by threads
- *      - Creation of threads
+ * parallel-prefix-sum.c
+ * ---------------------
+ * Driver program for libprefixsum. Creates some random data, computes its prefix
+ * sum both sequentially and on the worker pool and checks that the results match.
+ * The algorithm itself is described at the top of prefix-sum.c.
  *
- * Afterwards, each thread executes the "thread_function" method. This method has been
- * written in a way that provides a level of abstraction so that the algorithm outline
- * is obvious. That is, all calculations have been moved to other methods and are inv-
- * oked through the thread method. This way, the implementation is more reader-friend-
- * ly as it is very easy to follow.
- * 
- * 2. Synchronization
- * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
- * 
- * Threads are synchronized in the "thread_function" method with the use of a barrier.
- * More specifically, we have to synchronize them in two points during execution. Rig-
- * ht before Phase 2 and before Phase 3. The reason for this is that all threads shou-
- * ld have computed their local prefix sum before thread 0 calculates final element v-
- * alues. Additionally, thread 0 has to have finished computing final values of the o-
- * ther threads before they can start updating their local chunks.
- * 
- * For performance reasons another approach was also implemented.  In this case, each 
- * thread calculated its final element on its own  (instead of thread 0 doing all the
- * work).  The synchronization strategy here was that we used an array of semaphores,
- * one for each thread. Each thread, from 0 to the last one, would calculate its last
- * element and release its lock. Then the next one would continue to its own calcula-
- * tion.  Although this sounds like a good approach because it creates this "wave" in
- * synchronization and demonstrates well dependencies,  it comes at a bigger cost in 
- * terms of data structures used (array of semaphores vs one barrier).  Additionally,
- * the performance is almost the same, so there is no point in using semaphores inst-
- * ead of a barrier.
- * 
- * 3. Correctness and Performance
- * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
- * 
- * The correctness of the parallel execution was ensured since the algorithm produces
- * the exact same output in all cases. An automated script was created to execute the
- * code for every number of threads (1 to 32) and for an increasing number of elemen-
- * ts from the number of threads to the maximum allowed value.
- * 
- * Moreover, the performance of the algorithm was calculated with the use of <time.h>
- * library. It seems that in almost all cases the serial implementation performs bet-
- * ter than the parallel one. The reason for this is that thread creation can be qui-
- * te costly.  Since our calculations are not that demanding we realise that creating 
- * multiple threads becomes an overkill. When strictly timing execution (basically o-
- * nly prefix sum calculation measurement) we are able to achieve approximately a 1.5x
- * speedup by running the parallel version with the maximum allowed number of elements
- * and almost a 2x speedup when running the program multiple times inside a loop, aga-
- * in, with the maximum allowed number of elements.
- * 
- * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Usage: parallelout [-e engine] [-i isa] [-b barrier] [-a affinity] [-S stores] [-s block | -A] [-x] [-o]
+ *                    [-c tuning] [-T trace] [-f input [-w output]] [nitems] [nthreads]
+ *
+ * -e: threephase (default), lookback, blocked or dynamic
+ * -i: auto (default), scalar, sse2, avx2 or avx512
+ * -b: pthread (default), spin or hybrid
+ * -a: none (default), compact or numa pinning of the workers
+ * -S: auto (default), cached or streaming stores in the final write pass
+ * -s: scan as a stream of blocks of this many elements
+ * -A: submit the scan asynchronously and poll for its completion
+ * -x: exclusive instead of inclusive prefix sum
+ * -o: out of place, the input is kept and checked to be untouched
+ * -c: follow the crossovers of a tuning file written by the benchmark's -c option
+ * -T: print the time every worker spent in every phase and write the timeline of
+ *     the scan to a Chrome trace file (needs a library built with make TRACE=1)
+ * -f: scan a binary file of ints through a mapping instead of random data, in place
+ *     unless -w names an output file (nitems is ignored)
  */
 
-// Note that NITEMS, NTHREADS and SHOWDATA should
-// be defined at compile time with -D options to gcc.
-// They are the array length to use, number of threads to use
-// and whether or not to printout array contents (which is
+// Note that SHOWDATA should be defined at compile time with -D options to gcc.
+// It controls whether or not to printout array contents (which is
 // useful for debugging, but not a good idea for large arrays).
+// The array length and the number of threads are given on the command line.
 
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+#include "prefixsum.h"
 
-const int CELLS_PER_THREAD = NITEMS / NTHREADS; // Number of cells per thread (except last thread)
-const int REMAINDER_OF_DIV = NITEMS % NTHREADS; // Remainding elements (for last thread)
+#ifndef SHOWDATA
+#define SHOWDATA 0
+#endif
 
-clock_t start, mid, stop;
+#define DEFAULT_ITEMS 9999999 // Array length when none is given
+#define DEFAULT_THREADS 32 // Number of threads when none is given
 
-pthread_barrier_t barr; // Global barrier for all threads
+double start, mid, stop;
 
-// Data structure for packing all arguments per thread together
-typedef struct arg_pack {
-  int id; // Thread id
-  int *data; // Global array pointer
-  int start_index; // Thread chunk starting index
-  int end_index; // Thread chunk ending index
-} arg_pack;
+// Wall clock time in seconds; clock() would add up the CPU time of every thread
+static double wall_time (void) {
+  struct timespec ts;
 
-typedef arg_pack *argptr;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
 // Print a helpful message followed by the contents of an array
 // Controlled by the value of SHOWDATA, which should be defined
 // at compile time. Useful for debugging.
-void showdata (char *message,  int *data,  int n) {
-  int i; 
+void showdata (char *message,  int *data,  size_t n) {
+  size_t i;
 
   if (SHOWDATA) {
-      printf (message);
+      printf ("%s", message);
       for (i=0; i<n; i++ ){
       printf (" %d", data[i]);
       }
@@ -105,8 +72,8 @@ void showdata (char *message,  int *data,  int n) {
 
 // Check that the contents of two integer arrays of the same length are equal
 // and return a C-style boolean
-int checkresult (int* correctresult,  int *data,  int n) {
-  int i; 
+int checkresult (int* correctresult,  int *data,  size_t n) {
+  size_t i;
 
   for (i=0; i<n; i++ ){
     if (data[i] != correctresult[i]) return 0;
@@ -114,188 +81,383 @@ int checkresult (int* correctresult,  int *data,  int n) {
   return 1;
 }
 
-// Compute the prefix sum of an array **in place** sequentially
-void sequentialprefixsum (int *data, int n) {
+// Map an engine name from the command line to the library's enum
+// and return a C-style boolean telling whether the name is known
+int parseengine (const char *name, pps_engine *engine) {
+  if (strcmp(name, "threephase") == 0) {
+    *engine = PPS_ENGINE_THREE_PHASE;
+  } else if (strcmp(name, "lookback") == 0) {
+    *engine = PPS_ENGINE_LOOKBACK;
+  } else if (strcmp(name, "blocked") == 0) {
+    *engine = PPS_ENGINE_BLOCKED;
+  } else if (strcmp(name, "dynamic") == 0) {
+    *engine = PPS_ENGINE_DYNAMIC;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+// Map an instruction set name from the command line to the library's enum
+// and return a C-style boolean telling whether the name is known
+int parseisa (const char *name, pps_isa *isa) {
+  static const char *names[] = { "auto", "scalar", "sse2", "avx2", "avx512" };
   int i;
 
-  for (i=1; i<n; i++ ) {
-    data[i] = data[i] + data[i-1];
+  for (i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *isa = (pps_isa) i;
+      return 1;
+    }
   }
+  return 0;
 }
 
-/*
- * Function:  thread_prefix_sum 
- * ----------------------------
- * Computes the prefix sum of an array with specified indeces **in place** sequentially
- *
- * data: array with elements whose prefix sum we want to calculate
- * start_index: the index that specifies the beginning of a thread's chunk
- * end_index: the index that specifies the end of a thread's chunk
- */
-void thread_prefix_sum (int *data, int start_index, int end_index) {
+// Map a barrier name from the command line to the library's enum
+// and return a C-style boolean telling whether the name is known
+int parsebarrier (const char *name, pps_barrier *barrier) {
+  static const char *names[] = { "default", "pthread", "spin", "hybrid" };
   int i;
 
-  for (i = start_index+1; i < end_index + 1; i++) {
-    data[i] = data[i] + data[i-1];
+  for (i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *barrier = (pps_barrier) i;
+      return 1;
+    }
   }
+  return 0;
 }
 
-/*
- * Function:  final_element_prefix 
- * -------------------------------
- * Computes the final value of every thread except the first one
- *
- * data: array with elements whose final element prefix value we want to calculate
- */
-void final_element_prefix (int *data) {
-  int i, curr_final_index, next_final_index;
-
-  for (i = 0; i < NTHREADS - 1; i++) {
-    curr_final_index = (i+1) * CELLS_PER_THREAD - 1; // Ending index of current thread's chunk
-    next_final_index = curr_final_index + CELLS_PER_THREAD; // Ending index of next thread's chunk
-    if(i == NTHREADS - 2){
-      next_final_index += REMAINDER_OF_DIV; // Last thread's chunk is larger
+// Map an affinity name from the command line to the library's enum
+// and return a C-style boolean telling whether the name is known
+int parseaffinity (const char *name, pps_affinity *affinity) {
+  static const char *names[] = { "none", "compact", "numa" };
+  int i;
+
+  for (i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *affinity = (pps_affinity) i;
+      return 1;
     }
-    data[next_final_index] += data[curr_final_index];
   }
+  return 0;
 }
 
-/*
- * Function:  update_local_values 
- * ------------------------------
- * Computes the final values of own chunk
- *
- * data: array with elements whose prefix sum final values we want to calculate
- * start_index: the index that specifies the beginning of a thread's chunk
- * end_index: the index that specifies the end of a thread's chunk
- */
-void update_local_values (int *data, int start_index, int end_index) {
-  int i, prev_final_val;
-
-  prev_final_val = data[start_index-1]; // Retrieve previous thread's last value
+// Map a store kind from the command line to the library's enum
+// and return a C-style boolean telling whether the name is known
+int parsestores (const char *name, pps_stores *stores) {
+  static const char *names[] = { "auto", "cached", "streaming" };
+  int i;
 
-  for (i = start_index; i < end_index; i++){
-    data[i] += prev_final_val; // Update all other cells
+  for (i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *stores = (pps_stores) i;
+      return 1;
+    }
   }
+  return 0;
 }
 
-/*
- * Function:  thread_function 
- * --------------------------
- * Pointer function that each thread executes once created
- *
- * args: data structure containing thread's id, pointer to array, starting and ending index of chunk
- */
-void *thread_function(void *args)
-{
-  int i, id, start_index, end_index, *data;
+// Compute the prefix sum of an array as a stream of blocks of "block" elements
+// and return 0 on success, like the library
+int streamscan (pps_pool *pool, const int *in, int *out, size_t n, size_t block, const pps_options *opts) {
+  pps_stream *stream = pps_stream_create(pool, opts);
+  size_t i;
+  int status = 0;
 
-  // Unpack the arguments
-  id = ((arg_pack *)args)->id;
-  data = ((arg_pack *)args)->data;
-  start_index = ((arg_pack *)args)->start_index;
-  end_index = ((arg_pack *)args)->end_index;
+  if (stream == NULL) return -1;
+  for (i = 0; i < n && status == 0; i += block) {
+    status = pps_stream_push(stream, in + i, out + i, n - i < block ? n - i : block, NULL);
+  }
+  if (status == 0) status = pps_stream_finish(stream, NULL);
+  pps_stream_destroy(stream);
+  return status;
+}
 
-  thread_prefix_sum(data, start_index, end_index); // Phase 1 - Local chunk prefix sum calculation
+// Compute the prefix sum of an array on the pool's dispatcher thread, polling
+// until it completes, and return 0 on success, like the library
+int asyncscan (pps_pool *pool, const int *in, int *out, size_t n, const pps_options *opts) {
+  pps_future *future = pps_scan_async(pool, in, out, n, opts);
+  int status;
+
+  if (future == NULL) return -1;
+  while (!pps_future_poll(future)) sched_yield(); // The calling thread stays free
+  status = pps_future_wait(future);
+  pps_future_release(future);
+  return status;
+}
 
-  pthread_barrier_wait(&barr); // All threads completed Phase 1
+// Read a whole binary file of ints into a new array and set *n to its length,
+// return NULL if it can't be read
+int *readfile (const char *path, size_t *n) {
+  FILE *file = fopen(path, "rb");
+  int *data;
+  long bytes;
+
+  if (file == NULL) return NULL;
+  fseek(file, 0, SEEK_END);
+  bytes = ftell(file);
+  rewind(file);
+  *n = bytes > 0 ? (size_t) bytes / sizeof(int) : 0;
+  data = (int *) malloc(*n * sizeof(int) + 1);
+  if (data != NULL && fread(data, sizeof(int), *n, file) != *n) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  return data;
+}
 
-  if (id == 0){ // Phase 2 - Thread 0 computes the prefix sum of final elements
-    final_element_prefix(data);
+// Scan a file through pps_scan_file, checking the result against a sequential
+// prefix sum of the original file contents, and return the exit status
+int filescan (pps_pool *pool, const pps_options *opts, const char *input, const char *output) {
+  int *expected, *result;
+  size_t n, m;
+  int status;
+
+  expected = readfile(input, &n);
+  if (expected == NULL) {
+    perror(input);
+    return EXIT_FAILURE;
+  }
+  pps_sequential (expected, n);
+  if (opts->mode == PPS_EXCLUSIVE && n > 0) { // Shift the inclusive result
+    memmove(expected + 1, expected, (n - 1) * sizeof(int));
+    expected[0] = 0;
   }
 
-  pthread_barrier_wait(&barr); // End of Phase 2 - barrier is reusable since Pthreads re-initialise it once all threads are synchronised
+  start = wall_time();
+  if (pps_scan_file (pool, input, output, opts) != 0) {
+    perror("pps_scan_file");
+    free(expected);
+    return EXIT_FAILURE;
+  }
+  stop = wall_time();
+  printf("Mapped file scan runtime =     %fs (%zu items)\n", stop - start, n);
 
-  if(id != 0){ // Phase 3 - All other threads read their previous thread's final cell and update their chunks (except last value)
-    update_local_values(data, start_index, end_index);
+  result = readfile(output != NULL ? output : input, &m);
+  status = EXIT_SUCCESS;
+  if (result != NULL && m == n && checkresult(expected, result, n)) {
+    printf("Well done, the file was scanned correctly.\n");
+  } else {
+    printf("Error: The scanned file doesn't hold the sequential prefix sum.\n");
+    status = EXIT_FAILURE;
   }
+  free(expected); free(result);
+  return status;
 }
 
-/*
- * Function:  parallelprefixsum 
- * ----------------------------
- * Initialises and invokes necessary components for the parallel computation of the prefix sum algorithm
- *
- * data: array with elements whose prefix sum final values we want to calculate
- * n: number of elements in "data" array
- */
-void parallelprefixsum (int *data, int n) {
-  int i;
-  pthread_barrier_init(&barr, NULL, NTHREADS); // Barrier used for the synchronization of threads after Phase 1 and Phase 2
-  
-  // Setting up threads and their arguments
-  pthread_t  *thread_array;
-  arg_pack   *threadargs;
-  thread_array = (pthread_t *) malloc (NTHREADS * sizeof(pthread_t));
-  threadargs = (arg_pack *)  malloc (NTHREADS * sizeof(arg_pack));
-
-  // Assign values to thread arguments
-  for (i = 0; i < NTHREADS; i++) {
-    threadargs[i].id = i; // Thread id
-    threadargs[i].start_index = i * CELLS_PER_THREAD; // Starting index of chunk
-    threadargs[i].end_index = (i+1) * CELLS_PER_THREAD - 1; // Ending index of chunk
-    threadargs[i].data = data;
-    if (i == NTHREADS - 1){
-      threadargs[i].end_index += REMAINDER_OF_DIV; // Last thread takes the remainding elements in its chunk
-    }
+// Print the per phase times (and cache misses, if counted) of the workers of the
+// last scan and dump its timeline
+int showtrace (pps_pool *pool, const char *path, int counters) {
+  int size = pps_pool_size(pool), i, p;
+  pps_thread_stats stats[size];
+  uint64_t misses;
+
+  if (pps_pool_stats(pool, stats) != 0 || pps_pool_dump_trace(pool, path) != 0) {
+    perror(path);
+    return -1;
   }
-  
-  // Create the threads
-  for (i = 0; i < NTHREADS; i++) {
-    pthread_create (&thread_array[i], PTHREAD_CREATE_JOINABLE, thread_function, (void *) &threadargs[i]);
+  printf("thread");
+  for (p = 0; p < PPS_NPHASES; p++) printf(" %10s", pps_phase_name((pps_phase) p));
+  printf("%s   (microseconds)\n", counters ? "     misses" : "");
+  for (i = 0; i < size; i++) {
+    if (stats[i].count[PPS_PHASE_WAKE] == 0) continue; // Took no part
+    printf("%6d", i);
+    for (p = 0, misses = 0; p < PPS_NPHASES; p++) {
+      printf(" %10.1f", stats[i].seconds[p] * 1e6);
+      misses += stats[i].counters[p][PPS_COUNTER_CACHE_MISSES];
+    }
+    if (counters) printf(" %10llu", (unsigned long long) misses);
+    printf("\n");
   }
+  printf("Timeline written to %s\n", path);
+  return 0;
+}
 
-  // Wait for the threads to finish
-  for (i = 0; i < NTHREADS; i++) {
-    pthread_join(thread_array[i], NULL);
-  }
+// Print the usage of the program and exit with an error
+void usage (const char *program) {
+  printf ("Usage: %s [-e engine] [-i isa] [-b barrier] [-a affinity] [-S stores] [-s block | -A] [-x] [-o] [-c tuning] [-T trace] [-f input [-w output]] [nitems] [nthreads]\n", program);
+  exit(EXIT_FAILURE);
 }
 
 int main (int argc, char* argv[]) {
 
-  int *arr1, *arr2, i;
+  int *arr1, *arr2, *arr3, nthreads, status, outofplace = 0, async = 0, counters = 0, opt;
+  unsigned seed;
+  size_t nitems, i, block = 0;
+  const char *input = NULL, *output = NULL, *tuning = NULL, *trace = NULL;
+  pps_pool *pool;
+  pps_options opts;
+  pps_affinity affinity = PPS_AFFINITY_NONE;
+
+  pps_options_init(&opts);
+  while ((opt = getopt(argc, argv, "e:i:b:a:S:s:Axoc:T:f:w:")) != -1) {
+    switch (opt) {
+    case 'e':
+      if (!parseengine(optarg, &opts.engine)) {
+        printf ("Unknown engine \"%s\" .... exiting\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'i':
+      if (!parseisa(optarg, &opts.isa)) {
+        printf ("Unknown instruction set \"%s\" .... exiting\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'b':
+      if (!parsebarrier(optarg, &opts.barrier)) {
+        printf ("Unknown barrier \"%s\" .... exiting\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'a':
+      if (!parseaffinity(optarg, &affinity)) {
+        printf ("Unknown affinity \"%s\" .... exiting\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'S':
+      if (!parsestores(optarg, &opts.stores)) {
+        printf ("Unknown stores \"%s\" .... exiting\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 's':
+      block = strtoull(optarg, NULL, 10);
+      break;
+    case 'A':
+      async = 1;
+      break;
+    case 'x':
+      opts.mode = PPS_EXCLUSIVE;
+      break;
+    case 'o':
+      outofplace = 1;
+      break;
+    case 'c':
+      tuning = optarg;
+      break;
+    case 'T':
+      trace = optarg;
+      break;
+    case 'f':
+      input = optarg;
+      break;
+    case 'w':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  nitems = optind < argc ? strtoull(argv[optind], NULL, 10) : DEFAULT_ITEMS;
+  nthreads = optind + 1 < argc ? atoi(argv[optind + 1]) : DEFAULT_THREADS;
+  if (nthreads < 1) {
+    printf ("The number of threads must be positive .... exiting\n");
+    exit(EXIT_FAILURE);
+  }
+  opts.nthreads = nthreads;
 
-  // Check that the compile time constants are sensible for this exercise
-  if ((NITEMS>10000000) || (NTHREADS>32)) {
-    printf ("So much data or so many threads may not be a good idea! .... exiting\n");
+  pool = pps_pool_create(nthreads);
+  if (pool == NULL) {
+    perror("pps_pool_create");
+    exit(EXIT_FAILURE);
+  }
+  if (affinity != PPS_AFFINITY_NONE && pps_pool_set_affinity(pool, affinity) != 0) {
+    perror("pps_pool_set_affinity");
+  }
+  if (tuning != NULL && pps_pool_load_tuning(pool, tuning) != 0) {
+    perror(tuning);
     exit(EXIT_FAILURE);
   }
 
-  // Create two copies of some random data
-  arr1 = (int *) malloc(NITEMS*sizeof(int));
-  arr2 = (int *) malloc(NITEMS*sizeof(int));
-  srand((int)time(NULL));
-  for (i=0; i<NITEMS; i++) {
+  if (input != NULL) { // File mode, no random data
+    status = filescan(pool, &opts, input, output);
+    pps_pool_destroy(pool);
+    return status;
+  }
+
+  // Create two copies of some random data, and an output array if out of place.
+  // All are first touched by the workers that will scan them, on huge pages if large.
+  arr1 = pps_alloc(pool, nitems, nthreads);
+  arr2 = pps_alloc(pool, nitems, nthreads);
+  arr3 = outofplace ? pps_alloc(pool, nitems, nthreads) : arr2;
+  if (nitems > 0 && (arr1 == NULL || arr2 == NULL || arr3 == NULL)) {
+    printf ("Could not allocate %zu items .... exiting\n", nitems);
+    exit(EXIT_FAILURE);
+  }
+  seed = (unsigned) time(NULL);
+  srand(seed);
+  for (i=0; i<nitems; i++) {
      arr1[i] = arr2[i] = rand()%5;
   }
-  showdata ("initial data          : ", arr1, NITEMS);
-  
-  start = clock(); // Start for serial implementation
-  
+  showdata ("initial data          : ", arr1, nitems);
+
+  start = wall_time(); // Start for serial implementation
+
   // Calculate prefix sum sequentially, to check against later
-  sequentialprefixsum (arr1, NITEMS);
-  showdata ("sequential prefix sum : ", arr1, NITEMS);
-  
-  mid = clock(); // Mid point - end for serial and start for parallel
-  
-  // Calculate prefix sum in parallel on the other copy of the original data
-  parallelprefixsum (arr2, NITEMS);
-  showdata ("parallel prefix sum   : ", arr2, NITEMS);
-  
-  stop = clock(); // End for parallel implementation
-
-  // double serial = ((double) (mid - start)) / CLOCKS_PER_SEC;
-  // double parallel = ((double) (stop - mid)) / CLOCKS_PER_SEC;
-  // printf("Serial execution runtime =     %fs\n", serial);
-  // printf("Parallel execution runtime =   %fs\n", parallel);
+  pps_sequential (arr1, nitems);
+  if (opts.mode == PPS_EXCLUSIVE && nitems > 0) { // Shift the inclusive result
+    memmove(arr1 + 1, arr1, (nitems - 1) * sizeof(int));
+    arr1[0] = 0;
+  }
+  showdata ("sequential prefix sum : ", arr1, nitems);
+
+  if (trace != NULL) { // Only the scan itself, errors are reported by showtrace
+    counters = pps_pool_enable_counters(pool, 1) == 0;
+    pps_pool_reset_stats(pool);
+  }
+  mid = wall_time(); // Mid point - end for serial and start for parallel
+
+  // Calculate prefix sum in parallel on the other copy of the original data,
+  // in one go, as a stream of blocks or asynchronously
+  if (block > 0) {
+    if (streamscan (pool, arr2, arr3, nitems, block, &opts) != 0) {
+      perror("pps_stream_push");
+      exit(EXIT_FAILURE);
+    }
+  } else if (async) {
+    if (asyncscan (pool, arr2, arr3, nitems, &opts) != 0) {
+      perror("pps_scan_async");
+      exit(EXIT_FAILURE);
+    }
+  } else if (pps_scan_into (pool, arr2, arr3, nitems, &opts) != 0) {
+    perror("pps_scan_into");
+    exit(EXIT_FAILURE);
+  }
+  showdata ("parallel prefix sum   : ", arr3, nitems);
+
+  stop = wall_time(); // End for parallel implementation
+
+  // A single cold run, see "make bench" for repeated measurements
+  printf("Serial execution runtime =     %fs\n", mid - start);
+  printf("Parallel execution runtime =   %fs\n", stop - mid);
+  status = EXIT_SUCCESS;
+  if (trace != NULL && showtrace(pool, trace, counters) != 0) status = EXIT_FAILURE;
 
   // Check that the sequential and parallel results match
-  if (checkresult(arr1, arr2, NITEMS))  {
+  if (checkresult(arr1, arr3, nitems))  {
     printf("Well done, the sequential and parallel prefix sum arrays match.\n");
   } else {
     printf("Error: The sequential and parallel prefix sum arrays don't match.\n");
+    status = EXIT_FAILURE;
   }
 
-  free(arr1); free(arr2);
-  return 0;
-}
\ No newline at end of file
+  // The input of an out of place prefix sum must still be the original data
+  if (outofplace) {
+    srand(seed); // Replay the random data
+    for (i=0; i<nitems && arr2[i] == rand()%5; i++);
+    if (i < nitems) {
+      printf("Error: The input of the out of place prefix sum was modified.\n");
+      status = EXIT_FAILURE;
+    }
+    pps_free(arr3);
+  }
+
+  pps_pool_destroy(pool);
+  pps_free(arr1); pps_free(arr2);
+  return status;
+}
@@ -0,0 +1,75 @@
+/*
+ * partition.c
+ * -----------
+ * Chunk boundaries of the chunked engines.
+ *
+ * Giving every thread n / nthreads elements and the last one the remainder makes
+ * the last thread the slowest, and lets chunk boundaries fall in the middle of a
+ * cache line that two threads then write at the same time. Here boundary k is the
+ * element where the first k weights add up to their share of n, rounded to the
+ * nearest aligned element:
+ *
+ *      bounds[k] = round_to_alignment(n * (w[0] + ... + w[k-1]) / (w[0] + ... + w[nthreads-1]))
+ *
+ * With equal weights the remainder is spread one element at a time. Heterogeneous
+ * cores (P-cores and E-cores) get weights proportional to their speed, so the
+ * threads finish together instead of the slowest one deciding the wall time.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "internal.h"
+
+void pps_partition_sized (const pps_pool *pool, size_t n, int nthreads, const void *base, size_t size,
+                          size_t align, size_t *bounds) {
+  const double *weights = pps_pool_weights(pool);
+  double total = 0, sum = 0;
+  size_t step, phase, b;
+  long page;
+  int k;
+
+  if (align == 0) {
+    page = sysconf(_SC_PAGESIZE);
+    align = pps_pool_affinity(pool) == PPS_AFFINITY_NUMA && page > 0 ? (size_t) page : 64;
+  }
+
+  // Chunk starts are multiples of "step" elements after index "phase"
+  step = align / size;
+  if (step <= 1 || align % size != 0 || (uintptr_t) base % size != 0) {
+    step = 1;
+    phase = 0;
+  } else {
+    phase = (align - (uintptr_t) base % align) % align / size;
+  }
+
+  if (weights != NULL) {
+    for (k = 0; k < nthreads; k++) total += weights[k];
+  }
+
+  bounds[0] = 0;
+  for (k = 1; k < nthreads; k++) {
+    if (weights == NULL) { // n * k / nthreads without overflowing
+      b = n / nthreads * k + n % nthreads * k / nthreads;
+    } else {
+      sum += weights[k - 1];
+      b = (size_t) ((double) n * (sum / total));
+    }
+    if (step > 1 && b > phase) {
+      b = phase + (b - phase + step / 2) / step * step; // Nearest aligned element
+    }
+    if (b < bounds[k - 1]) b = bounds[k - 1];
+    if (b > n) b = n;
+    bounds[k] = b;
+  }
+  bounds[nthreads] = n;
+}
+
+void pps_partition (const pps_pool *pool, size_t n, int nthreads, const void *base, size_t align, size_t *bounds) {
+  pps_partition_sized(pool, n, nthreads, base, sizeof(int), align, bounds);
+}
+
+void pps_pool_partition (const pps_pool *pool, size_t n, int nthreads, const void *base, size_t size,
+                         size_t *bounds) {
+  pps_partition_sized(pool, n, nthreads, base, size > 0 ? size : 1, 0, bounds);
+}
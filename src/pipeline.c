@@ -0,0 +1,264 @@
+/*
+ * pipeline.c
+ * ----------
+ * Fused map - scan - scatter pipelines.
+ *
+ * Computing flags with one pass, scanning them with a second and scattering with a
+ * third moves the data through memory three times. Here the three stages are fused
+ * into the phases of the blocked engine (blocked.c), tile by tile through a buffer
+ * of each worker that stays in L1:
+ *
+ *      Phase 1 - every tile is mapped into the buffer and summed, so the mapped
+ *                values are never written to memory
+ *      Phase 2 - hierarchical scan of the chunk totals (carry.c)
+ *      Phase 3 - every tile is mapped again and scanned from its carry, into the
+ *                output array or the buffer, and the sums go straight to the
+ *                consumer (or to the compaction scatter) while still in L1
+ *
+ * So a pipeline reads its input twice, writes its scatter target once, and writes
+ * the prefix sums only if they are asked for. Compaction ("pps_compact") keeps the
+ * elements whose inclusive sum of flags grows, at index sum - 1; partitioning
+ * ("pps_split") puts the others after all kept ones, at kept + index - sum, the
+ * grand total being known to every thread after Phase 2.
+ */
+
+#include <errno.h>
+#include <limits.h>
+
+#include "internal.h"
+
+// What Phase 3 does with the sums of a tile
+enum { PIPE_CONSUME, PIPE_COMPACT, PIPE_SPLIT };
+
+// Data structure describing one pipeline, shared by all threads
+typedef struct pipe_job {
+  pps_pool *pool; // Pool running the job
+  size_t n; // Number of elements
+  pps_fill_fn map; // Writes the mapped values of a range, NULL for the compaction flags
+  void *map_ctx; // Argument of "map"
+  int *out; // Prefix sums, or NULL not to store them
+  int stage; // PIPE_CONSUME, PIPE_COMPACT or PIPE_SPLIT
+  pps_consume_fn consume; // Consumer of PIPE_CONSUME, may be NULL
+  void *consume_ctx; // Argument of "consume"
+  const int *in; // Input of the compaction stages
+  int *target; // Output of the compaction stages
+  pps_predicate_fn keep; // Predicate of the compaction stages, NULL for non zero
+  void *keep_ctx; // Argument of "keep"
+  const size_t *bounds; // Chunk boundaries, see "pps_partition"
+  size_t tile_size; // Elements per tile and per buffer
+  int *buffers; // One buffer of "tile_size" ints per thread
+  pps_carry carry; // Chunk totals and carries of Phase 2
+  const pps_kernels *k; // Inner loops
+  int (*scan) (const int *, int *, size_t, int); // Inclusive or exclusive tile scan
+  int total; // Sum of all mapped values, set by the last thread
+} pipe_job;
+
+/*
+ * Function:  map_tile
+ * -------------------
+ * Writes the mapped values of [start, start + count) to "dst"
+ */
+static void map_tile (pipe_job *job, int *dst, size_t start, size_t count) {
+  const int *in = job->in + start;
+  size_t i;
+
+  if (job->map != NULL) {
+    job->map(dst, start, count, job->map_ctx);
+  } else if (job->keep != NULL) {
+    for (i = 0; i < count; i++) dst[i] = job->keep(in[i], job->keep_ctx) != 0;
+  } else {
+    for (i = 0; i < count; i++) dst[i] = in[i] != 0;
+  }
+}
+
+/*
+ * Function:  scatter_tile
+ * -----------------------
+ * Compaction stages: moves every element of a tile to its place from the
+ * inclusive sums of its flags
+ *
+ * carry: sum of the flags before the tile
+ * kept: sum of all flags (PIPE_SPLIT only)
+ */
+static void scatter_tile (pipe_job *job, const int *sums, size_t start, size_t count, int carry, int kept) {
+  const int *in = job->in + start;
+  int *target = job->target;
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    if (sums[i] != carry) { // Flag set
+      target[sums[i] - 1] = in[i];
+    } else if (job->stage == PIPE_SPLIT) {
+      target[kept + (start + i) - sums[i]] = in[i];
+    }
+    carry = sums[i];
+  }
+}
+
+/*
+ * Function:  pipe_thread
+ * ----------------------
+ * Function that each active worker of the pool executes for a pipeline
+ *
+ * ctx: the pipe_job being computed
+ * id: thread id
+ * nthreads: number of threads taking part
+ */
+static void pipe_thread (void *ctx, int id, int nthreads) {
+  pipe_job *job = (pipe_job *) ctx;
+  int *buffer = job->buffers + id * job->tile_size, *sums;
+  size_t start_index, end_index, tile_start, count;
+  int total = 0, carry = 0, kept;
+
+  pps_chunk_bounds(job->bounds, id, &start_index, &end_index);
+
+  // Phase 1 - Map and sum every tile, the mapped values stay in the buffer
+  PPS_TRACE_TIME(local);
+  for (tile_start = start_index; tile_start < end_index; tile_start += count) {
+    count = end_index - tile_start < job->tile_size ? end_index - tile_start : job->tile_size;
+    map_tile(job, buffer, tile_start, count);
+    total += job->k->reduce(buffer, count);
+  }
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_LOCAL, local);
+
+  // Phase 2 - Hierarchical scan of the chunk totals, between two barriers
+  kept = total;
+  if (nthreads > 1) {
+    PPS_TRACE_TIME(exchange);
+    carry = pps_carry_exchange(&job->carry, job->pool, id, nthreads, total);
+    kept = pps_carry_total(&job->carry, nthreads);
+    PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_CARRY, exchange);
+  }
+  if (id == nthreads - 1) job->total = carry + total;
+
+  // Phase 3 - Map again, scan from the carry and hand the sums on while in L1
+  PPS_TRACE_TIME(final);
+  for (tile_start = start_index; tile_start < end_index; tile_start += count) {
+    count = end_index - tile_start < job->tile_size ? end_index - tile_start : job->tile_size;
+    map_tile(job, buffer, tile_start, count);
+    sums = job->out != NULL ? job->out + tile_start : buffer;
+    total = job->scan(buffer, sums, count, carry);
+    if (job->stage != PIPE_CONSUME) {
+      scatter_tile(job, sums, tile_start, count, carry, kept);
+    } else if (job->consume != NULL) {
+      job->consume(sums, tile_start, count, carry, job->consume_ctx);
+    }
+    carry = total;
+  }
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_FINAL, final);
+}
+
+/*
+ * Function:  run_pipeline
+ * -----------------------
+ * Common part of the entry points, "job" has its stages filled in
+ */
+static int run_pipeline (pps_pool *pool, pipe_job *job, const pps_options *opts) {
+  const pps_kernels *k;
+  pps_options defaults;
+  int nthreads, ret;
+
+  if (opts == NULL) {
+    pps_options_init(&defaults);
+    opts = &defaults;
+  }
+  k = pps_get_kernels(opts->isa);
+  if (k == NULL) return -1; // errno set by pps_get_kernels
+
+  // Each buffer takes half the L1, next to the tile of output being written
+  job->tile_size = opts->tile_size > 0 ? opts->tile_size : pps_cache_size(1) / 2 / sizeof(int);
+  if (job->tile_size == 0) job->tile_size = 1;
+  nthreads = pps_job_threads(pool, job->n, opts->nthreads);
+
+  pps_slot slots[PPS_CARRY_SLOTS(nthreads)]; // Scratch space of Phase 2
+  size_t bounds[nthreads + 1];
+
+  pps_partition(pool, job->n, nthreads, job->out, opts->chunk_align, bounds);
+  job->pool = pool;
+  job->bounds = bounds;
+  job->k = k;
+  job->scan = job->stage == PIPE_CONSUME ? pps_scan_kernel(k, opts) : k->scan; // Scatters need inclusive sums
+  job->total = 0;
+  pps_carry_init(&job->carry, slots, nthreads, pps_pool_group_size(pool, nthreads));
+
+  job->buffers = (int *) pps_arena_alloc(pps_pool_scratch(pool), nthreads * job->tile_size * sizeof(int));
+  if (job->buffers == NULL) {
+    pps_pool_scratch_release(pool);
+    return -1; // errno set by pps_arena_alloc
+  }
+  ret = 0;
+  if (nthreads == 1) { // Not worth waking anybody up
+    pipe_thread(job, 0, 1);
+  } else {
+    ret = pps_pool_run_with(pool, nthreads, pipe_thread, job, opts->barrier);
+  }
+  pps_pool_scratch_release(pool);
+  return ret;
+}
+
+int pps_scan_transform (pps_pool *pool, size_t n, pps_fill_fn map, void *map_ctx, int *out,
+                        pps_consume_fn consume, void *consume_ctx, int *total, const pps_options *opts) {
+  pipe_job job;
+
+  if (pool == NULL || (map == NULL && n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  job.n = n;
+  job.map = map;
+  job.map_ctx = map_ctx;
+  job.out = out;
+  job.stage = PIPE_CONSUME;
+  job.consume = consume;
+  job.consume_ctx = consume_ctx;
+  job.in = NULL;
+  job.target = NULL;
+  job.keep = NULL;
+  job.keep_ctx = NULL;
+  if (run_pipeline(pool, &job, opts) != 0) return -1;
+  if (total != NULL) *total = job.total;
+  return 0;
+}
+
+/*
+ * Function:  compaction
+ * ---------------------
+ * Common part of "pps_compact" and "pps_split"
+ */
+static int compaction (pps_pool *pool, const int *in, int *out, size_t n, pps_predicate_fn keep, void *ctx,
+                       size_t *kept, int stage, const pps_options *opts) {
+  pipe_job job;
+
+  if (pool == NULL || ((in == NULL || out == NULL) && n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (n > INT_MAX) { // The flags are summed in ints
+    errno = EOVERFLOW;
+    return -1;
+  }
+  job.n = n;
+  job.map = NULL;
+  job.map_ctx = NULL;
+  job.out = NULL;
+  job.stage = stage;
+  job.consume = NULL;
+  job.consume_ctx = NULL;
+  job.in = in;
+  job.target = out;
+  job.keep = keep;
+  job.keep_ctx = ctx;
+  if (run_pipeline(pool, &job, opts) != 0) return -1;
+  if (kept != NULL) *kept = (size_t) job.total;
+  return 0;
+}
+
+int pps_compact (pps_pool *pool, const int *in, int *out, size_t n, pps_predicate_fn keep, void *ctx,
+                 size_t *kept, const pps_options *opts) {
+  return compaction(pool, in, out, n, keep, ctx, kept, PIPE_COMPACT, opts);
+}
+
+int pps_split (pps_pool *pool, const int *in, int *out, size_t n, pps_predicate_fn keep, void *ctx,
+               size_t *kept, const pps_options *opts) {
+  return compaction(pool, in, out, n, keep, ctx, kept, PIPE_SPLIT, opts);
+}
@@ -0,0 +1,361 @@
+/*
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ Discussion ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * 
+ * 1. Approach
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * 
+ * The method "pps_scan" is responsible for the following three main things:
+ * 
+ *      - Choosing how many threads the array is worth (see "pps_choose_threads")
+ *      - Packing of arguments to be used by threads
+ *      - Waking up the worker threads of the pool
+ *
+ * The worker threads are created only once, by "pps_pool_create" (thread-pool.c).
+ * Between calls they are parked on a condition variable, so that each call only pays
+ * for a wake-up and the two barrier crossings instead of the creation and joining of
+ * every thread. The pool is torn down explicitly by "pps_pool_destroy". Arrays too
+ * small to give every thread PPS_MIN_ITEMS_PER_THREAD elements use fewer threads,
+ * and arrays that only deserve one thread are scanned sequentially by the caller.
+ *
+ * Afterwards, each thread executes the "thread_function" method, which looks up the
+ * indices of the thread's own chunk from its id. The chunks are cut by
+ * "pps_partition" (partition.c): the remainder is spread evenly instead of landing
+ * on the last thread, chunk starts are cache line aligned and sizes can be weighted
+ * for cores of different speeds. This method has been written in a way that
+ * provides a level of abstraction so that the algorithm outline is obvious. That
+ * is, all calculations have been moved to other methods and are invoked through the
+ * thread method. This way, the implementation is more reader-friendly as it is very
+ * easy to follow.
+ * 
+ * 2. Synchronization
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * 
+ * Threads are synchronized in the "thread_function" method with the use of a barrier.
+ * More specifically, we have to synchronize them in two points during execution. Rig-
+ * ht before Phase 2 and before Phase 3. The reason for this is that all threads shou-
+ * ld have computed their local prefix sum before the chunk totals are combined. Add-
+ * itionally, the totals of whole groups of threads have to be known before any thr-
+ * ead can work out the value it has to add to its local chunk.
+ * 
+ * Phase 2 used to be done by thread 0 alone, walking the last element of every chu-
+ * nk while the other threads idled. It is now a two-level scan (carry.c): threads
+ * publish their chunk totals in a padded array, sum the totals of the earlier thre-
+ * ads of their group, and then the totals of the earlier groups. Each thread reads
+ * about sqrt(nthreads) cache lines and keeps its carry in a register for Phase 3.
+ * 
+ * The barrier itself is selectable (pps_options.barrier): the pthread one, a sense-
+ * reversing barrier on atomics that spins, or a hybrid that spins and then sleeps on
+ * a futex (barrier.c). The atomic ones save the mutex pthread_barrier_wait takes on
+ * every crossing.
+ * 
+ * On NUMA machines the workers can be pinned node by node (thread-pool.c) and the
+ * arrays first touched in parallel with the same chunks (first-touch.c), so that
+ * every thread streams its chunk from local memory and Phase 2 groups follow the
+ * nodes.
+ * 
+ * For performance reasons another approach was also implemented.  In this case, each 
+ * thread calculated its final element on its own  (instead of thread 0 doing all the
+ * work).  The synchronization strategy here was that we used an array of semaphores,
+ * one for each thread. Each thread, from 0 to the last one, would calculate its last
+ * element and release its lock. Then the next one would continue to its own calcula-
+ * tion.  Although this sounds like a good approach because it creates this "wave" in
+ * synchronization and demonstrates well dependencies,  it comes at a bigger cost in 
+ * terms of data structures used (array of semaphores vs one barrier).  Additionally,
+ * the performance is almost the same, so there is no point in using semaphores inst-
+ * ead of a barrier.
+ * 
+ * The three phase algorithm reads and writes every element twice and stops all thr-
+ * eads at two barriers. An alternative engine, PPS_ENGINE_LOOKBACK (lookback.c), do-
+ * es the whole computation in a single pass over cache sized tiles: every tile pub-
+ * lishes its sum through a status flag and later tiles spin on those flags instead
+ * of waiting at a barrier. PPS_ENGINE_BLOCKED (blocked.c) keeps the three phases,
+ * but only sums the chunks in Phase 1 and writes every element once in Phase 3, ti-
+ * le by tile, while the data is still in L2. PPS_ENGINE_DYNAMIC is the look-back
+ * engine with tiles handed out by a shared counter instead of round-robin, so that
+ * a preempted thread just ends up doing fewer tiles. The engine is picked through
+ * "pps_scan_opts".
+ * 
+ * In every engine the inner loops (local scan, carry update, tile sums) are vector
+ * kernels picked at runtime from CPUID, see simd.c. The local scan is a log-step
+ * shuffle scan inside the vector registers and the carry update is a broadcast-add.
+ * 
+ * All engines read from an input array and write to an output array, which is the
+ * same one for in place prefix sums, and can leave element i out of its own sum
+ * (exclusive mode).
+ * 
+ * 3. Correctness and Performance
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * 
+ * The correctness of the parallel execution was ensured since the algorithm produces
+ * the exact same output in all cases. An automated script was created to execute the
+ * code for every number of threads (1 to 32) and for an increasing number of elemen-
+ * ts from the number of threads to the maximum allowed value.
+ * 
+ * Moreover, the performance of the algorithm was calculated with the use of <time.h>
+ * library. It seems that in almost all cases the serial implementation performs bet-
+ * ter than the parallel one. The reason for this is that thread creation can be qui-
+ * te costly.  Since our calculations are not that demanding we realise that creating 
+ * multiple threads becomes an overkill. When strictly timing execution (basically o-
+ * nly prefix sum calculation measurement) we are able to achieve approximately a 1.5x
+ * speedup by running the parallel version with the maximum allowed number of elements
+ * and almost a 2x speedup when running the program multiple times inside a loop, aga-
+ * in, with the maximum allowed number of elements.
+ * 
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "internal.h"
+
+// Data structure describing one parallel prefix sum, shared by all threads
+typedef struct scan_job {
+  pps_pool *pool; // Pool running the job
+  const int *in; // Input array pointer
+  int *data; // Global (output) array pointer, may be "in"
+  size_t n; // Number of elements in "data"
+  int exclusive; // Whether element i leaves out in[i]
+  const size_t *bounds; // Chunk boundaries, see "pps_partition"
+  pps_carry carry; // Chunk totals and carries of Phase 2
+  const pps_kernels *k; // Inner loops
+  const pps_kernels *final; // Inner loops of Phase 3, streaming for large arrays
+} scan_job;
+
+/*
+ * Function:  chunk_bounds 
+ * -----------------------
+ * Computes the chunk of a thread, see "pps_partition"
+ *
+ * bounds: chunk boundaries of the job
+ * id: thread id
+ * start_index: set to the index that specifies the beginning of the thread's chunk
+ * end_index: set to the index that specifies the end of the thread's chunk (inclusive)
+ */
+static void chunk_bounds (const size_t *bounds, int id, size_t *start_index, size_t *end_index) {
+  pps_chunk_bounds(bounds, id, start_index, end_index);
+  *end_index -= 1;
+}
+
+/*
+ * Function:  thread_prefix_sum 
+ * ----------------------------
+ * Computes the prefix sum of an array with specified indeces sequentially
+ *
+ * job: the prefix sum being computed
+ * start_index: the index that specifies the beginning of a thread's chunk
+ * end_index: the index that specifies the end of a thread's chunk
+ *
+ * returns: the total of the chunk
+ */
+static int thread_prefix_sum (scan_job *job, size_t start_index, size_t end_index) {
+  size_t n = end_index - start_index + 1;
+
+  if (job->exclusive) {
+    return job->k->scan_exclusive(job->in + start_index, job->data + start_index, n, 0);
+  }
+  return job->k->scan(job->in + start_index, job->data + start_index, n, 0);
+}
+
+/*
+ * Function:  update_local_values 
+ * ------------------------------
+ * Computes the final values of own chunk
+ *
+ * k: kernels doing the actual work
+ * data: array with elements whose prefix sum final values we want to calculate
+ * start_index: the index that specifies the beginning of a thread's chunk
+ * end_index: the index that specifies the end of a thread's chunk
+ * prev_final_val: sum of all elements before the chunk
+ */
+static void update_local_values (const pps_kernels *k, int *data, size_t start_index, size_t end_index, int prev_final_val) {
+  k->add(data + start_index, data + start_index, end_index - start_index + 1, prev_final_val); // Update all cells
+}
+
+/*
+ * Function:  thread_function 
+ * --------------------------
+ * Function that each active worker of the pool executes for a prefix sum
+ *
+ * ctx: the scan_job being computed
+ * id: thread id
+ * nthreads: number of threads taking part
+ */
+static void thread_function (void *ctx, int id, int nthreads) {
+  scan_job *job = (scan_job *) ctx;
+  size_t start_index, end_index;
+  int total, prev_final_val;
+
+  chunk_bounds(job->bounds, id, &start_index, &end_index);
+
+  PPS_TRACE_TIME(local);
+  total = thread_prefix_sum(job, start_index, end_index); // Phase 1 - Local chunk prefix sum calculation
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_LOCAL, local);
+
+  // Phase 2 - Hierarchical scan of the chunk totals, between two barriers
+  PPS_TRACE_TIME(carry);
+  prev_final_val = pps_carry_exchange(&job->carry, job->pool, id, nthreads, total);
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_CARRY, carry);
+
+  if(id != 0){ // Phase 3 - All other threads add the sum of the previous chunks to their own
+    PPS_TRACE_TIME(final);
+    update_local_values(job->final, job->data, start_index, end_index, prev_final_val);
+    PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_FINAL, final);
+  }
+}
+
+int pps_choose_threads (size_t n, int max_threads) {
+  size_t worth = n / PPS_MIN_ITEMS_PER_THREAD; // Threads the array can keep busy
+
+  if (max_threads < 1) max_threads = 1;
+  if (worth < 1) return 1;
+  return worth < (size_t) max_threads ? (int) worth : max_threads;
+}
+
+int pps_job_threads (const pps_pool *pool, size_t n, int nthreads) {
+  const pps_tuning *tuning = pps_pool_tuning(pool);
+
+  if (nthreads <= 0 || nthreads > pps_pool_size(pool)) {
+    nthreads = pps_pool_size(pool);
+  }
+  if (tuning != NULL) { // Measured crossovers instead of the rule of thumb
+    return pps_tuned_threads(tuning, n, nthreads);
+  }
+  return pps_choose_threads(n, nthreads);
+}
+
+int pps_pool_threads (const pps_pool *pool, size_t n, int nthreads) {
+  return pps_job_threads(pool, n, nthreads);
+}
+
+void pps_sequential (int *data, size_t n) {
+  size_t i;
+
+  for (i=1; i<n; i++ ) {
+    data[i] = data[i] + data[i-1];
+  }
+}
+
+void pps_options_init (pps_options *opts) {
+  opts->nthreads = 0;
+  opts->engine = PPS_ENGINE_THREE_PHASE;
+  opts->tile_size = 0;
+  opts->isa = PPS_ISA_AUTO;
+  opts->mode = PPS_INCLUSIVE;
+  opts->barrier = PPS_BARRIER_DEFAULT;
+  opts->chunk_align = 0;
+  opts->stores = PPS_STORES_AUTO;
+}
+
+/*
+ * Function:  final_kernels
+ * ------------------------
+ * Kernels of the pass writing the result: streaming when asked for, or by default
+ * when the arrays read and written don't fit in the last level cache, so that
+ * their lines would be evicted before anybody reads them again anyway
+ */
+static const pps_kernels *final_kernels (const int *in, const int *out, size_t n, const pps_options *opts,
+                                         const pps_kernels *k) {
+  size_t bytes = (in == out ? 1 : 2) * n * sizeof(int);
+
+  if (opts->stores == PPS_STORES_STREAMING || (opts->stores == PPS_STORES_AUTO && bytes > pps_cache_size(3))) {
+    return pps_streaming_kernels(k);
+  }
+  return k;
+}
+
+int pps_scan_threads (pps_pool *pool, const int *in, int *out, size_t n, int nthreads,
+                      const pps_options *opts, const pps_kernels *k) {
+  const pps_kernels *final = final_kernels(in, out, n, opts, k);
+  scan_job job;
+
+  if (nthreads == 1) { // Not worth waking anybody up, a single write pass
+    pps_scan_kernel(final, opts)(in, out, n, 0);
+    return 0;
+  }
+
+  pps_slot slots[PPS_CARRY_SLOTS(nthreads)]; // Scratch space of Phase 2
+  size_t bounds[nthreads + 1];
+
+  switch (opts->engine) {
+  case PPS_ENGINE_THREE_PHASE:
+    pps_partition(pool, n, nthreads, out, opts->chunk_align, bounds);
+    job.pool = pool;
+    job.in = in;
+    job.data = out;
+    job.n = n;
+    job.exclusive = opts->mode == PPS_EXCLUSIVE;
+    job.bounds = bounds;
+    pps_carry_init(&job.carry, slots, nthreads, pps_pool_group_size(pool, nthreads));
+    job.k = k;
+    job.final = final;
+    return pps_pool_run_with(pool, nthreads, thread_function, &job, opts->barrier);
+  case PPS_ENGINE_LOOKBACK: // Both engines below only write in their last pass
+  case PPS_ENGINE_DYNAMIC:
+    return pps_lookback_scan(pool, in, out, n, nthreads, opts, final);
+  case PPS_ENGINE_BLOCKED:
+    return pps_blocked_scan(pool, in, out, n, nthreads, opts, final);
+  }
+
+  errno = EINVAL;
+  return -1;
+}
+
+/*
+ * Function:  pps_scan_into 
+ * ------------------------
+ * Hands an array to the persistent worker pool for the parallel computation of the prefix sum algorithm
+ *
+ * pool: worker pool
+ * in: array with elements whose prefix sum we want to calculate
+ * out: array receiving the prefix sum, may be "in"
+ * n: number of elements in both arrays
+ * opts: engine, mode and tuning, NULL for the defaults
+ */
+int pps_scan_into (pps_pool *pool, const int *in, int *out, size_t n, const pps_options *opts) {
+  const pps_tuning *tuning;
+  const pps_kernels *k;
+  pps_offload_fn offload;
+  pps_options defaults;
+  void *ctx;
+  int nthreads;
+
+  if (pool == NULL || ((in == NULL || out == NULL) && n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (opts == NULL) {
+    pps_options_init(&defaults);
+    opts = &defaults;
+  }
+
+  // Above the offload threshold the accelerator's bandwidth wins
+  offload = pps_pool_offload(pool, n, &ctx);
+  if (offload != NULL) return offload(ctx, in, out, n, opts);
+
+  // Below the calibrated crossover the plain loop beats the vector kernels
+  tuning = pps_pool_tuning(pool);
+  if (opts->isa == PPS_ISA_AUTO && tuning != NULL && n < tuning->simd_min) {
+    k = pps_get_kernels(PPS_ISA_SCALAR);
+  } else {
+    k = pps_get_kernels(opts->isa);
+  }
+  if (k == NULL) return -1; // errno set by pps_get_kernels
+
+  nthreads = pps_job_threads(pool, n, opts->nthreads);
+  return pps_scan_threads(pool, in, out, n, nthreads, opts, k);
+}
+
+int pps_scan_opts (pps_pool *pool, int *data, size_t n, const pps_options *opts) {
+  return pps_scan_into(pool, data, data, n, opts);
+}
+
+int pps_scan (pps_pool *pool, int *data, size_t n, int nthreads) {
+  pps_options opts;
+
+  pps_options_init(&opts);
+  opts.nthreads = nthreads;
+  return pps_scan_opts(pool, data, n, &opts);
+}
@@ -0,0 +1,300 @@
+/*
+ * primitives.c
+ * ------------
+ * Histograms, bucketing and radix sort, built on the scan of bucket counts.
+ *
+ * All three are the same counting job on a different number of passes. In every
+ * pass over the chunks of the workers:
+ *
+ *      Phase 1 - every thread counts the buckets of its chunk into its own row of
+ *                counters, cache lines apart from the others, then copies them
+ *                once into its column of a [bucket][thread] table
+ *      -- barrier --
+ *      Phase 2 - histogram: every thread adds up the row of a range of buckets;
+ *                otherwise the table is scanned (exclusive) in that order, which
+ *                gives every thread the place of its first element of every bucket
+ *      -- barrier --
+ *      Phase 3 - every thread copies its column of places back into its own row
+ *                and scatters its chunk, in order, to those places, so elements of
+ *                the same bucket keep their order (stable)
+ *
+ * A radix sort runs one pass per byte of the keys, least significant first,
+ * between the array and a buffer of the pool's scratch arena. There is no need to
+ * scatter in a pass whose digit is the same in all keys, so it is skipped: sorting
+ * small values costs the passes of their low bytes only.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#include "internal.h"
+
+#define RADIX_BITS 8 // Bits of a radix sort digit
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define BUCKET_TILE 512 // Elements whose buckets are computed by one call
+
+// What a counting job computes
+enum { COUNT_HISTOGRAM, COUNT_BUCKET, COUNT_RADIX };
+
+// Data structure describing one counting job, shared by all threads
+typedef struct count_job {
+  pps_pool *pool; // Pool running the job
+  int kind; // COUNT_HISTOGRAM, COUNT_BUCKET or COUNT_RADIX
+  const int *in; // Input of the histogram and the bucketing
+  int *out; // Output of the bucketing
+  int *data; // Keys of the radix sort
+  int *buffer; // Second array of the radix sort, n ints
+  size_t n; // Number of elements
+  pps_bucket_fn bucket; // Buckets of a range of elements, NULL for the elements themselves
+  void *ctx; // Argument of "bucket"
+  size_t nbuckets; // Number of buckets
+  size_t *counts; // Result of the histogram, or bucket starts of the bucketing
+  const size_t *bounds; // Chunk boundaries, see "pps_partition"
+  int *table; // Counts, then places, of every bucket and thread, [bucket][thread]
+  int *rows; // Counters of every thread while counting and scattering, "row_size" ints each
+  size_t row_size; // "nbuckets" rounded up to a multiple of a cache line
+  int skip; // Whether the current radix pass has nothing to move
+  const pps_kernels *k; // Inner loops
+} count_job;
+
+/*
+ * Function:  buckets_of
+ * ---------------------
+ * returns: the buckets of "count" elements (at most BUCKET_TILE), in "buckets"
+ *          or, without a bucket function, the elements themselves
+ */
+static inline const unsigned *buckets_of (const count_job *job, const int *values, unsigned *buckets, size_t count) {
+  if (job->bucket == NULL) return (const unsigned *) values;
+  job->bucket(values, buckets, count, job->ctx);
+  return buckets;
+}
+
+// Bucket index "b" with indices out of range moved to the last bucket
+#define CLAMP(b, last) ((b) < (last) ? (b) : (last))
+
+/*
+ * Function:  digit_of
+ * -------------------
+ * returns: the radix sort digit of "key" at bit "shift", with the sign bit flipped
+ *          so that negative keys come first
+ */
+static inline unsigned digit_of (int key, int shift) {
+  return (((unsigned) key ^ 0x80000000u) >> shift) & (RADIX_BUCKETS - 1);
+}
+
+// Barrier between phases, nothing to wait for on a single thread
+static void count_barrier (count_job *job, int nthreads) {
+  if (nthreads > 1) pps_pool_barrier(job->pool);
+}
+
+/*
+ * Function:  count_pass
+ * ---------------------
+ * One pass of a counting job, from "src" to "dst" (radix sort), or from "in" to
+ * "out"
+ *
+ * shift: bit of the radix sort digit
+ */
+static void count_pass (count_job *job, int id, int nthreads, const int *src, int *dst, int shift) {
+  int *table = job->table, *column = table + id, *row = job->rows + id * job->row_size;
+  size_t start_index, end_index, i, j, b, first, last, count, stride = nthreads;
+  unsigned buckets[BUCKET_TILE], top = (unsigned) job->nbuckets - 1;
+  int radix = job->kind == COUNT_RADIX;
+  const unsigned *tile;
+
+  pps_chunk_bounds(job->bounds, id, &start_index, &end_index);
+
+  // Phase 1 - Count the buckets of the chunk
+  PPS_TRACE_TIME(local);
+  memset(row, 0, job->nbuckets * sizeof(int));
+  if (radix) {
+    for (i = start_index; i < end_index; i++) row[digit_of(src[i], shift)]++;
+  } else {
+    for (i = start_index; i < end_index; i += count) {
+      count = end_index - i < BUCKET_TILE ? end_index - i : BUCKET_TILE;
+      tile = buckets_of(job, src + i, buckets, count);
+      for (j = 0; j < count; j++) row[CLAMP(tile[j], top)]++;
+    }
+  }
+  for (b = 0; b < job->nbuckets; b++) column[b * stride] = row[b];
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_LOCAL, local);
+
+  // Phase 2 - Counts of every bucket, or places of every thread in every bucket
+  PPS_TRACE_TIME(exchange);
+  count_barrier(job, nthreads);
+  if (job->kind == COUNT_HISTOGRAM) {
+    first = job->nbuckets * id / nthreads;
+    last = job->nbuckets * (id + 1) / nthreads;
+    for (b = first; b < last; b++) job->counts[b] = (unsigned) job->k->reduce(table + b * stride, stride);
+    PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_CARRY, exchange);
+    return;
+  }
+  if (id == 0) {
+    job->skip = 0;
+    for (b = 0; radix && b < job->nbuckets; b++) { // A single bucket holds everything
+      if ((size_t) job->k->reduce(table + b * stride, stride) == job->n) job->skip = 1;
+    }
+    if (!job->skip) job->k->scan_exclusive(table, table, job->nbuckets * stride, 0);
+    if (job->counts != NULL) {
+      for (b = 0; b < job->nbuckets; b++) job->counts[b] = (unsigned) table[b * stride];
+      job->counts[job->nbuckets] = job->n;
+    }
+  }
+  count_barrier(job, nthreads);
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_CARRY, exchange);
+  if (job->skip) return;
+
+  // Phase 3 - Scatter the chunk to its places, in order
+  PPS_TRACE_TIME(final);
+  for (b = 0; b < job->nbuckets; b++) row[b] = column[b * stride];
+  if (radix) {
+    for (i = start_index; i < end_index; i++) dst[row[digit_of(src[i], shift)]++] = src[i];
+  } else {
+    for (i = start_index; i < end_index; i += count) { // Buckets computed again rather than stored
+      count = end_index - i < BUCKET_TILE ? end_index - i : BUCKET_TILE;
+      tile = buckets_of(job, src + i, buckets, count);
+      for (j = 0; j < count; j++) dst[row[CLAMP(tile[j], top)]++] = src[i + j];
+    }
+  }
+  PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_FINAL, final);
+}
+
+/*
+ * Function:  count_thread
+ * -----------------------
+ * Function that each active worker of the pool executes for a counting job
+ *
+ * ctx: the count_job being computed
+ * id: thread id
+ * nthreads: number of threads taking part
+ */
+static void count_thread (void *ctx, int id, int nthreads) {
+  count_job *job = (count_job *) ctx;
+  int *src = job->data, *dst = job->buffer, *swap;
+  size_t start_index, end_index;
+  int shift;
+
+  if (job->kind != COUNT_RADIX) {
+    count_pass(job, id, nthreads, job->in, job->out, 0);
+    return;
+  }
+  for (shift = 0; shift < (int) (sizeof(int) * CHAR_BIT); shift += RADIX_BITS) {
+    count_pass(job, id, nthreads, src, dst, shift);
+    if (!job->skip) {
+      swap = src; src = dst; dst = swap;
+    }
+    count_barrier(job, nthreads); // The next pass counts what this one scattered
+  }
+  if (src != job->data) { // An odd number of passes moved the keys
+    pps_chunk_bounds(job->bounds, id, &start_index, &end_index);
+    memcpy(job->data + start_index, src + start_index, (end_index - start_index) * sizeof(int));
+  }
+}
+
+/*
+ * Function:  run_count
+ * --------------------
+ * Common part of the entry points, "job" has its arrays and buckets filled in
+ */
+static int run_count (pps_pool *pool, count_job *job, const pps_options *opts) {
+  pps_options defaults;
+  pps_arena *arena;
+  int nthreads, ret;
+
+  if (opts == NULL) {
+    pps_options_init(&defaults);
+    opts = &defaults;
+  }
+  if (job->n > INT_MAX || job->nbuckets > INT_MAX) { // The counts are scanned in ints
+    errno = EOVERFLOW;
+    return -1;
+  }
+  job->k = pps_get_kernels(opts->isa);
+  if (job->k == NULL) return -1; // errno set by pps_get_kernels
+
+  nthreads = pps_job_threads(pool, job->n, opts->nthreads);
+  if (job->nbuckets * nthreads > INT_MAX) nthreads = 1;
+
+  size_t bounds[nthreads + 1];
+
+  pps_partition(pool, job->n, nthreads, job->kind == COUNT_RADIX ? job->data : job->in, opts->chunk_align, bounds);
+  job->pool = pool;
+  job->bounds = bounds;
+  job->skip = 0;
+
+  arena = pps_pool_scratch(pool);
+  job->row_size = (job->nbuckets + 15) / 16 * 16;
+  job->table = (int *) pps_arena_alloc(arena, job->nbuckets * nthreads * sizeof(int));
+  job->rows = job->table != NULL ? (int *) pps_arena_alloc(arena, job->row_size * nthreads * sizeof(int)) : NULL;
+  if (job->rows != NULL && job->kind == COUNT_RADIX) {
+    job->buffer = (int *) pps_arena_alloc(arena, job->n * sizeof(int));
+  }
+  if (job->rows == NULL || (job->kind == COUNT_RADIX && job->buffer == NULL)) {
+    pps_pool_scratch_release(pool);
+    return -1; // errno set by pps_arena_alloc
+  }
+  ret = 0;
+  if (nthreads == 1) { // Not worth waking anybody up
+    count_thread(job, 0, 1);
+  } else {
+    ret = pps_pool_run_with(pool, nthreads, count_thread, job, opts->barrier);
+  }
+  pps_pool_scratch_release(pool);
+  return ret;
+}
+
+int pps_histogram (pps_pool *pool, const int *in, size_t n, pps_bucket_fn bucket, void *ctx, size_t nbuckets,
+                   size_t *counts, const pps_options *opts) {
+  count_job job;
+
+  if (pool == NULL || (in == NULL && n > 0) || nbuckets == 0 || counts == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(&job, 0, sizeof(job));
+  job.kind = COUNT_HISTOGRAM;
+  job.in = in;
+  job.n = n;
+  job.bucket = bucket;
+  job.ctx = ctx;
+  job.nbuckets = nbuckets;
+  job.counts = counts;
+  return run_count(pool, &job, opts);
+}
+
+int pps_bucket (pps_pool *pool, const int *in, int *out, size_t n, pps_bucket_fn bucket, void *ctx,
+                size_t nbuckets, size_t *starts, const pps_options *opts) {
+  count_job job;
+
+  if (pool == NULL || ((in == NULL || out == NULL) && n > 0) || nbuckets == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(&job, 0, sizeof(job));
+  job.kind = COUNT_BUCKET;
+  job.in = in;
+  job.out = out;
+  job.n = n;
+  job.bucket = bucket;
+  job.ctx = ctx;
+  job.nbuckets = nbuckets;
+  job.counts = starts;
+  return run_count(pool, &job, opts);
+}
+
+int pps_radix_sort (pps_pool *pool, int *data, size_t n, const pps_options *opts) {
+  count_job job;
+
+  if (pool == NULL || (data == NULL && n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (n < 2) return 0;
+  memset(&job, 0, sizeof(job));
+  job.kind = COUNT_RADIX;
+  job.data = data;
+  job.n = n;
+  job.nbuckets = RADIX_BUCKETS;
+  return run_count(pool, &job, opts);
+}
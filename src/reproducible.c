@@ -0,0 +1,216 @@
+/*
+ * reproducible.c
+ * --------------
+ * Floating point prefix sums whose result doesn't depend on the thread count.
+ *
+ * Floating point addition isn't associative, so the typed sums of generic.c round
+ * differently whenever the chunks move, i.e. for every thread count. Here the array
+ * is cut into tiles of PPS_FP_TILE elements instead, which never move, and every
+ * result is defined by the tiles alone:
+ *
+ *      local(i)  = x[t] + ... + x[i], left to right from the start t of the tile
+ *      carry(0)  = 0, carry(t + 1) = carry(t) + local(last element of tile t)
+ *      out[i]    = carry(tile of i) + local(i)
+ *
+ * Threads only decide who computes which tile:
+ *
+ *      Phase 1 - every thread sums its own run of tiles into the tile totals
+ *      -- barrier --
+ *      Phase 2 - every thread adds up the totals of the tiles before its run, left
+ *                to right, the same additions whichever thread does them
+ *      Phase 3 - every thread rescans its tiles from their carries
+ *
+ * The compensated mode keeps every sum above as a (sum, error) pair, adding with
+ * Neumaier's variant of Kahan summation, and rounds the pair only when storing an
+ * element, so the error stays near one rounding instead of growing with n.
+ *
+ * Only additions are involved, so there is no contraction into FMAs, and the loops
+ * keep their order unless built with -ffast-math or -fassociative-math.
+ */
+
+#include <errno.h>
+
+#include "internal.h"
+
+/*
+ * Macro:  DEFINE_FP_SCAN
+ * ----------------------
+ * Defines the reproducible scan of one floating point type, "name##_scan", with
+ * its helpers prefixed by "name"
+ */
+#define DEFINE_FP_SCAN(name, T)                                                         \
+                                                                                        \
+  /* Compensated sum, "comp" stays 0 in the plain mode */                               \
+  typedef struct name##_pair {                                                          \
+    T sum;                                                                              \
+    T comp;                                                                             \
+  } name##_pair;                                                                        \
+                                                                                        \
+  /* Data structure describing one prefix sum, shared by all threads */                 \
+  typedef struct name##_job {                                                           \
+    pps_pool *pool; /* Pool running the job */                                          \
+    T *data; /* Global array pointer */                                                 \
+    size_t n; /* Number of elements in "data" */                                        \
+    size_t ntiles; /* Number of tiles */                                                \
+    int compensated; /* Whether the sums are compensated */                             \
+    name##_pair *totals; /* Total of every tile, written in Phase 1 */                  \
+  } name##_job;                                                                         \
+                                                                                        \
+  /* Neumaier step, adds x to the pair */                                               \
+  static inline void name##_add (name##_pair *p, T x) {                                 \
+    T t = p->sum + x;                                                                   \
+    if ((p->sum < 0 ? -p->sum : p->sum) >= (x < 0 ? -x : x)) {                          \
+      p->comp += (p->sum - t) + x;                                                      \
+    } else {                                                                            \
+      p->comp += (x - t) + p->sum;                                                      \
+    }                                                                                   \
+    p->sum = t;                                                                         \
+  }                                                                                     \
+                                                                                        \
+  /* Sum of two pairs, a the earlier */                                                 \
+  static inline name##_pair name##_combine (name##_pair a, name##_pair b, int compensated) {\
+    if (!compensated) {                                                                 \
+      a.sum += b.sum;                                                                   \
+      return a;                                                                         \
+    }                                                                                   \
+    name##_add(&a, b.sum);                                                              \
+    a.comp += b.comp;                                                                   \
+    return a;                                                                           \
+  }                                                                                     \
+                                                                                        \
+  /* Phase 1 - local() of the last element of a tile */                                \
+  static name##_pair name##_tile_total (const T *data, size_t count, int compensated) { \
+    name##_pair total = { 0, 0 };                                                       \
+    size_t i;                                                                           \
+                                                                                        \
+    if (compensated) {                                                                  \
+      for (i = 0; i < count; i++) name##_add(&total, data[i]);                          \
+    } else {                                                                            \
+      for (i = 0; i < count; i++) total.sum += data[i];                                 \
+    }                                                                                   \
+    return total;                                                                       \
+  }                                                                                     \
+                                                                                        \
+  /* Phase 3 - Prefix sum of a tile in place from its carry */                          \
+  static void name##_tile_scan (T *data, size_t count, name##_pair carry, int compensated) {\
+    name##_pair local = { 0, 0 }, sum;                                                  \
+    size_t i;                                                                           \
+                                                                                        \
+    if (compensated) {                                                                  \
+      for (i = 0; i < count; i++) {                                                     \
+        name##_add(&local, data[i]);                                                    \
+        sum = name##_combine(carry, local, 1);                                          \
+        data[i] = sum.sum + sum.comp;                                                   \
+      }                                                                                 \
+    } else {                                                                            \
+      for (i = 0; i < count; i++) {                                                     \
+        local.sum += data[i];                                                           \
+        data[i] = carry.sum + local.sum;                                                \
+      }                                                                                 \
+    }                                                                                   \
+  }                                                                                     \
+                                                                                        \
+  /* Elements of tile t */                                                              \
+  static size_t name##_tile_length (const name##_job *job, size_t t) {                  \
+    return t + 1 < job->ntiles ? PPS_FP_TILE : job->n - t * PPS_FP_TILE;                \
+  }                                                                                     \
+                                                                                        \
+  static void name##_thread_function (void *ctx, int id, int nthreads) {                \
+    name##_job *job = (name##_job *) ctx;                                               \
+    size_t first = job->ntiles * id / nthreads, last = job->ntiles * (id + 1) / nthreads;\
+    name##_pair carry = { 0, 0 };                                                       \
+    size_t t;                                                                           \
+                                                                                        \
+    PPS_TRACE_TIME(local);                                                              \
+    for (t = first; t < last; t++) {                                                    \
+      job->totals[t] = name##_tile_total(job->data + t * PPS_FP_TILE,                   \
+                                         name##_tile_length(job, t), job->compensated); \
+    }                                                                                   \
+    PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_LOCAL, local);                             \
+                                                                                        \
+    PPS_TRACE_TIME(exchange);                                                           \
+    pps_pool_barrier(job->pool);                                                        \
+    for (t = 0; t < first; t++) carry = name##_combine(carry, job->totals[t], job->compensated);\
+    PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_CARRY, exchange);                          \
+                                                                                        \
+    PPS_TRACE_TIME(final);                                                              \
+    for (t = first; t < last; t++) {                                                    \
+      name##_tile_scan(job->data + t * PPS_FP_TILE, name##_tile_length(job, t), carry,  \
+                       job->compensated);                                               \
+      carry = name##_combine(carry, job->totals[t], job->compensated);                  \
+    }                                                                                   \
+    PPS_TRACE_PHASE(job->pool, id, PPS_PHASE_FINAL, final);                             \
+  }                                                                                     \
+                                                                                        \
+  static int name##_scan (pps_pool *pool, T *data, size_t n, int nthreads, int compensated) {\
+    name##_pair carry = { 0, 0 }, total;                                                \
+    name##_job job;                                                                     \
+    size_t t;                                                                           \
+    int ret;                                                                            \
+                                                                                        \
+    job.pool = pool;                                                                    \
+    job.data = data;                                                                    \
+    job.n = n;                                                                          \
+    job.ntiles = (n + PPS_FP_TILE - 1) / PPS_FP_TILE;                                   \
+    job.compensated = compensated;                                                      \
+    nthreads = pps_job_threads(pool, n, nthreads);                                      \
+    if ((size_t) nthreads > job.ntiles) nthreads = job.ntiles > 0 ? (int) job.ntiles : 1;\
+                                                                                        \
+    if (nthreads == 1) { /* Tile by tile, the total read while the tile is in L1 */     \
+      for (t = 0; t < job.ntiles; t++) {                                                \
+        total = name##_tile_total(data + t * PPS_FP_TILE, name##_tile_length(&job, t),  \
+                                  compensated);                                         \
+        name##_tile_scan(data + t * PPS_FP_TILE, name##_tile_length(&job, t), carry,    \
+                         compensated);                                                  \
+        carry = name##_combine(carry, total, compensated);                              \
+      }                                                                                 \
+      return 0;                                                                         \
+    }                                                                                   \
+                                                                                        \
+    job.totals = (name##_pair *) pps_arena_alloc(pps_pool_scratch(pool),                \
+                                                 job.ntiles * sizeof(name##_pair));     \
+    if (job.totals == NULL) {                                                           \
+      pps_pool_scratch_release(pool);                                                   \
+      return -1; /* errno set by pps_arena_alloc */                                     \
+    }                                                                                   \
+    ret = pps_pool_run(pool, nthreads, name##_thread_function, &job);                   \
+    pps_pool_scratch_release(pool);                                                     \
+    return ret;                                                                         \
+  }
+
+DEFINE_FP_SCAN(f32, float)
+DEFINE_FP_SCAN(f64, double)
+
+int pps_scan_f32_sum_with (pps_pool *pool, float *data, size_t n, int nthreads, pps_fp_mode mode) {
+  if (pool == NULL || (data == NULL && n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  switch (mode) {
+  case PPS_FP_FAST:
+    return pps_scan_f32_sum(pool, data, n, nthreads);
+  case PPS_FP_REPRODUCIBLE:
+  case PPS_FP_COMPENSATED:
+    return f32_scan(pool, data, n, nthreads, mode == PPS_FP_COMPENSATED);
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+}
+
+int pps_scan_f64_sum_with (pps_pool *pool, double *data, size_t n, int nthreads, pps_fp_mode mode) {
+  if (pool == NULL || (data == NULL && n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  switch (mode) {
+  case PPS_FP_FAST:
+    return pps_scan_f64_sum(pool, data, n, nthreads);
+  case PPS_FP_REPRODUCIBLE:
+  case PPS_FP_COMPENSATED:
+    return f64_scan(pool, data, n, nthreads, mode == PPS_FP_COMPENSATED);
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+}
@@ -0,0 +1,185 @@
+/*
+ * segmented.c
+ * -----------
+ * Segmented prefix sums: many independent prefix sums over consecutive segments of
+ * one array, in one parallel pass instead of one call per segment.
+ *
+ * Segment heads are given either as a flag per element or as the sorted start
+ * offsets of the segments (the row pointers of a CSR matrix). Element 0 is always a
+ * head. The three phases of prefix-sum.c carry over with (flag, value) pairs:
+ *
+ *      Phase 1 - every thread scans the segments inside its chunk with the vector
+ *                kernels, from 0 at every head, and notes whether its chunk has a
+ *                head and the sum after the last one
+ *      Phase 2 - the pairs are combined (carry.c), a head cuts off everything
+ *                before it
+ *      Phase 3 - every thread adds its carry to the elements before the first head
+ *                of its chunk only, the rest of the chunk is already final
+ */
+
+#include <errno.h>
+
+#include "internal.h"
+
+// Data structure describing one segmented prefix sum, shared by all threads
+typedef struct segmented_job {
+  pps_pool *pool; // Pool running the job
+  const int *in; // Input array pointer
+  int *data; // Global (output) array pointer, may be "in"
+  size_t n; // Number of elements in "data"
+  const uint8_t *flags; // Non zero at every segment head, or NULL
+  const size_t *offsets; // Start of every segment, or NULL
+  size_t nsegments; // Number of entries in "offsets"
+  const size_t *bounds; // Chunk boundaries, see "pps_partition"
+  pps_carry carry; // Chunk pairs and carries of Phase 2
+  const pps_kernels *k; // Inner loops
+  int (*scan) (const int *, int *, size_t, int); // Inclusive or exclusive segment scan
+} segmented_job;
+
+/*
+ * Function:  next_head
+ * --------------------
+ * Finds the first segment head at or after index "i", before "end"
+ *
+ * segment: for offsets, index of the first offset that may be >= i, advanced
+ *
+ * returns: the index of the head, or "end" if there is none
+ */
+static size_t next_head (const segmented_job *job, size_t i, size_t end, size_t *segment) {
+  if (job->flags != NULL) {
+    while (i < end && !job->flags[i]) i++;
+    return i;
+  }
+  while (*segment < job->nsegments && job->offsets[*segment] < i) (*segment)++;
+  if (*segment < job->nsegments && job->offsets[*segment] < end) return job->offsets[*segment];
+  return end;
+}
+
+/*
+ * Function:  first_segment
+ * ------------------------
+ * returns: the index of the first offset that is >= i (binary search)
+ */
+static size_t first_segment (const segmented_job *job, size_t i) {
+  size_t low = 0, high = job->nsegments, mid;
+
+  if (job->offsets == NULL) return 0;
+  while (low < high) {
+    mid = low + (high - low) / 2;
+    if (job->offsets[mid] < i) low = mid + 1; else high = mid;
+  }
+  return low;
+}
+
+/*
+ * Function:  segmented_thread
+ * ---------------------------
+ * Function that each active worker of the pool executes for a segmented prefix sum
+ *
+ * ctx: the segmented_job being computed
+ * id: thread id
+ * nthreads: number of threads taking part
+ */
+static void segmented_thread (void *ctx, int id, int nthreads) {
+  segmented_job *job = (segmented_job *) ctx;
+  size_t start_index, end_index, head, next, first_head, segment;
+  int total, carry;
+
+  pps_chunk_bounds(job->bounds, id, &start_index, &end_index);
+  segment = first_segment(job, start_index);
+
+  // Phase 1 - scan the part before the first head and every segment after it
+  first_head = next_head(job, start_index, end_index, &segment);
+  if (id == 0) first_head = start_index; // Element 0 starts a segment
+  total = job->scan(job->in + start_index, job->data + start_index, first_head - start_index, 0);
+  for (head = first_head; head < end_index; head = next) {
+    next = next_head(job, head + 1, end_index, &segment);
+    total = job->scan(job->in + head, job->data + head, next - head, 0);
+  }
+
+  // Phase 2 - Hierarchical scan of the (flag, value) pairs, between two barriers
+  carry = 0;
+  if (nthreads > 1) {
+    carry = pps_carry_exchange_segmented(&job->carry, job->pool, id, nthreads, total, first_head < end_index);
+  }
+
+  // Phase 3 - only the open segment coming from the chunks before needs the carry
+  if (id != 0 && carry != 0) {
+    job->k->add(job->data + start_index, job->data + start_index, first_head - start_index, carry);
+  }
+}
+
+/*
+ * Function:  segmented_scan
+ * -------------------------
+ * Common part of the two segmented entry points
+ */
+static int segmented_scan (pps_pool *pool, const int *in, int *out, size_t n, const uint8_t *flags,
+                           const size_t *offsets, size_t nsegments, const pps_options *opts) {
+  const pps_kernels *k;
+  pps_options defaults;
+  segmented_job job;
+  int nthreads;
+
+  if (pool == NULL || ((in == NULL || out == NULL) && n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (opts == NULL) {
+    pps_options_init(&defaults);
+    opts = &defaults;
+  }
+
+  k = pps_get_kernels(opts->isa);
+  if (k == NULL) return -1; // errno set by pps_get_kernels
+
+  nthreads = pps_job_threads(pool, n, opts->nthreads);
+
+  pps_slot slots[PPS_CARRY_SLOTS(nthreads)]; // Scratch space of Phase 2
+  size_t bounds[nthreads + 1];
+
+  pps_partition(pool, n, nthreads, out, opts->chunk_align, bounds);
+  job.pool = pool;
+  job.in = in;
+  job.data = out;
+  job.n = n;
+  job.flags = flags;
+  job.offsets = offsets;
+  job.nsegments = nsegments;
+  job.bounds = bounds;
+  job.k = k;
+  job.scan = pps_scan_kernel(k, opts);
+  pps_carry_init(&job.carry, slots, nthreads, pps_pool_group_size(pool, nthreads));
+
+  if (nthreads == 1) { // Not worth waking anybody up
+    segmented_thread(&job, 0, 1);
+    return 0;
+  }
+  return pps_pool_run_with(pool, nthreads, segmented_thread, &job, opts->barrier);
+}
+
+int pps_scan_segmented_flags (pps_pool *pool, const int *in, int *out, size_t n, const uint8_t *flags,
+                              const pps_options *opts) {
+  if (flags == NULL && n > 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return segmented_scan(pool, in, out, n, flags, NULL, 0, opts);
+}
+
+int pps_scan_segmented_offsets (pps_pool *pool, const int *in, int *out, size_t n, const size_t *offsets,
+                                size_t nsegments, const pps_options *opts) {
+  size_t s;
+
+  if (offsets == NULL && nsegments > 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (s = 1; s < nsegments; s++) { // The binary searches need sorted offsets
+    if (offsets[s] < offsets[s - 1]) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  return segmented_scan(pool, in, out, n, NULL, offsets, nsegments, opts);
+}
@@ -0,0 +1,653 @@
+/*
+ * simd.c
+ * ------
+ * Vectorised kernels for the inner loops of every engine, selected at runtime
+ * from what CPUID reports:
+ *
+ *      scan   - Phase 1, in-register log-step scan: a vector of w elements is
+ *               added to itself shifted by 1, 2, 4, ... elements, which leaves its
+ *               own prefix sum in it, then the carry of the previous vector is
+ *               broadcast and added. log2(w) shifts and adds per w elements replace
+ *               the w loop-carried adds of the scalar code. The exclusive variant
+ *               subtracts the input vector from the inclusive one before storing
+ *      add    - Phase 3, broadcast the carry-in once and add it to every vector.
+ *               Pure streaming, no dependency between iterations
+ *      reduce - sum without writing, used by the tiled engines
+ *      accumulate - adds one array to another element by element, the column
+ *                   pass of the 2D scans (grid.c)
+ *      widen  - uint8 or uint16 elements zero extended to int, for the scans of
+ *               narrow input (narrow.c), with a reduce of the narrow elements that
+ *               never widens them: SAD against zero sums 8 bytes per 64-bit lane,
+ *               and uint16 lanes are widened and summed in runs short enough for
+ *               32-bit lanes
+ *
+ * The scans and the add read from one array and write to another, which may be
+ * the same one for in place prefix sums.
+ *
+ * Every vector ISA also has streaming variants of the scans and the add for the
+ * final write pass over arrays larger than the last level cache. They store with
+ * non-temporal moves, which write whole lines to memory without first reading them
+ * for ownership and without evicting the data still to be read. The output is
+ * brought to a vector boundary with ordinary stores first, since the streaming
+ * stores need aligned addresses, and an sfence at the end orders the weakly
+ * ordered stores before the worker reports back, so they are visible to whoever
+ * reads the result.
+ *
+ * The functions are compiled with target attributes, so the library builds without
+ * any -m flags and runs on every x86-64 machine; other architectures only get the
+ * scalar kernels.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PPS_X86 1
+#endif
+
+#include "internal.h"
+
+// Every scan kernel below is written once for both modes: the wrappers pass
+// "exclusive" as a constant and the compiler drops the unused branch. The input
+// may be the output array, each vector is loaded before it is stored.
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ Scalar ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static ALWAYS_INLINE int scan_scalar_impl (const int *in, int *out, size_t n, int carry, int exclusive) {
+  size_t i;
+  int value;
+
+  for (i = 0; i < n; i++) {
+    value = in[i];
+    if (exclusive) out[i] = carry;
+    carry += value;
+    if (!exclusive) out[i] = carry;
+  }
+  return carry;
+}
+
+static int scan_scalar (const int *in, int *out, size_t n, int carry) {
+  return scan_scalar_impl(in, out, n, carry, 0);
+}
+
+static int scan_exclusive_scalar (const int *in, int *out, size_t n, int carry) {
+  return scan_scalar_impl(in, out, n, carry, 1);
+}
+
+static void add_scalar (const int *in, int *out, size_t n, int value) {
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    out[i] = in[i] + value;
+  }
+}
+
+static int reduce_scalar (const int *data, size_t n) {
+  size_t i;
+  int sum = 0;
+
+  for (i = 0; i < n; i++) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+static void widen_u8_scalar (const uint8_t *in, int *out, size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    out[i] = in[i];
+  }
+}
+
+static void widen_u16_scalar (const uint16_t *in, int *out, size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    out[i] = in[i];
+  }
+}
+
+static int64_t reduce_u8_scalar (const uint8_t *data, size_t n) {
+  int64_t sum = 0;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+static int64_t reduce_u16_scalar (const uint16_t *data, size_t n) {
+  int64_t sum = 0;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+static void accumulate_scalar (const int *in, int *out, size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    out[i] += in[i];
+  }
+}
+
+// uint16 elements a 32-bit lane can sum without overflowing, 4 per lane per pass
+// of a 4 lane vector: 16384 / 4 * 65535 < 2^31
+#define U16_RUN ((size_t) 16384)
+
+#ifdef PPS_X86
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ SSE2 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+__attribute__((target("sse2")))
+static ALWAYS_INLINE int scan_sse2_impl (const int *in, int *out, size_t n, int carry, int exclusive, int stream) {
+  __m128i v, x, c = _mm_set1_epi32(carry);
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    v = _mm_loadu_si128((const __m128i *) (in + i));
+    x = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi32(x, c);
+    if (stream) {
+      _mm_stream_si128((__m128i *) (out + i), exclusive ? _mm_sub_epi32(x, v) : x);
+    } else {
+      _mm_storeu_si128((__m128i *) (out + i), exclusive ? _mm_sub_epi32(x, v) : x);
+    }
+    c = _mm_shuffle_epi32(x, 0xFF); // Broadcast the last element
+  }
+  return scan_scalar_impl(in + i, out + i, n - i, _mm_cvtsi128_si32(c), exclusive);
+}
+
+__attribute__((target("sse2")))
+static int scan_sse2 (const int *in, int *out, size_t n, int carry) {
+  return scan_sse2_impl(in, out, n, carry, 0, 0);
+}
+
+__attribute__((target("sse2")))
+static int scan_exclusive_sse2 (const int *in, int *out, size_t n, int carry) {
+  return scan_sse2_impl(in, out, n, carry, 1, 0);
+}
+
+__attribute__((target("sse2")))
+static ALWAYS_INLINE void add_sse2_impl (const int *in, int *out, size_t n, int value, int stream) {
+  __m128i v = _mm_set1_epi32(value);
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    if (stream) {
+      _mm_stream_si128((__m128i *) (out + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *) (in + i)), v));
+    } else {
+      _mm_storeu_si128((__m128i *) (out + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *) (in + i)), v));
+    }
+  }
+  add_scalar(in + i, out + i, n - i, value);
+}
+
+__attribute__((target("sse2")))
+static void add_sse2 (const int *in, int *out, size_t n, int value) {
+  add_sse2_impl(in, out, n, value, 0);
+}
+
+__attribute__((target("sse2")))
+static int reduce_sse2 (const int *data, size_t n) {
+  __m128i acc = _mm_setzero_si128();
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    acc = _mm_add_epi32(acc, _mm_loadu_si128((const __m128i *) (data + i)));
+  }
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+  return _mm_cvtsi128_si32(acc) + reduce_scalar(data + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void widen_u8_sse2 (const uint8_t *in, int *out, size_t n) {
+  __m128i v, lo, hi, zero = _mm_setzero_si128();
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    v = _mm_loadu_si128((const __m128i *) (in + i));
+    lo = _mm_unpacklo_epi8(v, zero);
+    hi = _mm_unpackhi_epi8(v, zero);
+    _mm_storeu_si128((__m128i *) (out + i), _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *) (out + i + 4), _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *) (out + i + 8), _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128((__m128i *) (out + i + 12), _mm_unpackhi_epi16(hi, zero));
+  }
+  widen_u8_scalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void widen_u16_sse2 (const uint16_t *in, int *out, size_t n) {
+  __m128i v, zero = _mm_setzero_si128();
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    v = _mm_loadu_si128((const __m128i *) (in + i));
+    _mm_storeu_si128((__m128i *) (out + i), _mm_unpacklo_epi16(v, zero));
+    _mm_storeu_si128((__m128i *) (out + i + 4), _mm_unpackhi_epi16(v, zero));
+  }
+  widen_u16_scalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static int64_t reduce_u8_sse2 (const uint8_t *data, size_t n) {
+  __m128i acc = _mm_setzero_si128(), zero = _mm_setzero_si128();
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (data + i)), zero));
+  }
+  acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+  return (int64_t) _mm_cvtsi128_si64(acc) + reduce_u8_scalar(data + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static int64_t reduce_u16_sse2 (const uint16_t *data, size_t n) {
+  __m128i acc, v, zero = _mm_setzero_si128();
+  size_t i, end;
+  int64_t sum = 0;
+
+  for (i = 0; i + 8 <= n; ) {
+    acc = _mm_setzero_si128();
+    for (end = i + U16_RUN < n ? i + U16_RUN : n; i + 8 <= end; i += 8) {
+      v = _mm_loadu_si128((const __m128i *) (data + i));
+      acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)));
+    }
+    acc = _mm_add_epi64(_mm_unpacklo_epi32(acc, zero), _mm_unpackhi_epi32(acc, zero)); // Unsigned lanes
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    sum += (int64_t) _mm_cvtsi128_si64(acc);
+  }
+  return sum + reduce_u16_scalar(data + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void accumulate_sse2 (const int *in, int *out, size_t n) {
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    _mm_storeu_si128((__m128i *) (out + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *) (out + i)),
+                                                         _mm_loadu_si128((const __m128i *) (in + i))));
+  }
+  accumulate_scalar(in + i, out + i, n - i);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ AVX2 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+__attribute__((target("avx2")))
+static ALWAYS_INLINE int scan_avx2_impl (const int *in, int *out, size_t n, int carry, int exclusive, int stream) {
+  __m256i v, x, c = _mm256_set1_epi32(carry), last = _mm256_set1_epi32(7);
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    v = _mm256_loadu_si256((const __m256i *) (in + i));
+    x = _mm256_add_epi32(v, _mm256_slli_si256(v, 4)); // Shifts stay within 128-bit lanes
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+    // Carry the low lane's total into the high lane
+    x = _mm256_add_epi32(x, _mm256_permute2x128_si256(_mm256_shuffle_epi32(x, 0xFF), x, 0x08));
+    x = _mm256_add_epi32(x, c);
+    if (stream) {
+      _mm256_stream_si256((__m256i *) (out + i), exclusive ? _mm256_sub_epi32(x, v) : x);
+    } else {
+      _mm256_storeu_si256((__m256i *) (out + i), exclusive ? _mm256_sub_epi32(x, v) : x);
+    }
+    c = _mm256_permutevar8x32_epi32(x, last);
+  }
+  return scan_scalar_impl(in + i, out + i, n - i, _mm256_cvtsi256_si32(c), exclusive);
+}
+
+__attribute__((target("avx2")))
+static int scan_avx2 (const int *in, int *out, size_t n, int carry) {
+  return scan_avx2_impl(in, out, n, carry, 0, 0);
+}
+
+__attribute__((target("avx2")))
+static int scan_exclusive_avx2 (const int *in, int *out, size_t n, int carry) {
+  return scan_avx2_impl(in, out, n, carry, 1, 0);
+}
+
+__attribute__((target("avx2")))
+static ALWAYS_INLINE void add_avx2_impl (const int *in, int *out, size_t n, int value, int stream) {
+  __m256i v = _mm256_set1_epi32(value);
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    if (stream) {
+      _mm256_stream_si256((__m256i *) (out + i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (in + i)), v));
+      _mm256_stream_si256((__m256i *) (out + i + 8), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (in + i + 8)), v));
+    } else {
+      _mm256_storeu_si256((__m256i *) (out + i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (in + i)), v));
+      _mm256_storeu_si256((__m256i *) (out + i + 8), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (in + i + 8)), v));
+    }
+  }
+  add_sse2(in + i, out + i, n - i, value);
+}
+
+__attribute__((target("avx2")))
+static void add_avx2 (const int *in, int *out, size_t n, int value) {
+  add_avx2_impl(in, out, n, value, 0);
+}
+
+__attribute__((target("avx2")))
+static int reduce_avx2 (const int *data, size_t n) {
+  __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+  __m128i acc;
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    acc0 = _mm256_add_epi32(acc0, _mm256_loadu_si256((const __m256i *) (data + i)));
+    acc1 = _mm256_add_epi32(acc1, _mm256_loadu_si256((const __m256i *) (data + i + 8)));
+  }
+  acc0 = _mm256_add_epi32(acc0, acc1);
+  acc = _mm_add_epi32(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+  return _mm_cvtsi128_si32(acc) + reduce_sse2(data + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void widen_u8_avx2 (const uint8_t *in, int *out, size_t n) {
+  __m128i v;
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    v = _mm_loadu_si128((const __m128i *) (in + i));
+    _mm256_storeu_si256((__m256i *) (out + i), _mm256_cvtepu8_epi32(v));
+    _mm256_storeu_si256((__m256i *) (out + i + 8), _mm256_cvtepu8_epi32(_mm_unpackhi_epi64(v, v)));
+  }
+  widen_u8_sse2(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void widen_u16_avx2 (const uint16_t *in, int *out, size_t n) {
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    _mm256_storeu_si256((__m256i *) (out + i), _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (in + i))));
+  }
+  widen_u16_scalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int64_t reduce_u8_avx2 (const uint8_t *data, size_t n) {
+  __m256i acc = _mm256_setzero_si256(), zero = _mm256_setzero_si256();
+  __m128i sum;
+  size_t i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *) (data + i)), zero));
+  }
+  sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+  return (int64_t) _mm_cvtsi128_si64(sum) + reduce_u8_sse2(data + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int64_t reduce_u16_avx2 (const uint16_t *data, size_t n) {
+  __m256i acc, zero = _mm256_setzero_si256();
+  __m128i sum;
+  size_t i, end;
+  int64_t total = 0;
+
+  for (i = 0; i + 8 <= n; ) {
+    acc = _mm256_setzero_si256();
+    for (end = i + U16_RUN < n ? i + U16_RUN : n; i + 8 <= end; i += 8) { // 2 per lane per run of 16
+      acc = _mm256_add_epi32(acc, _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (data + i))));
+    }
+    acc = _mm256_add_epi64(_mm256_unpacklo_epi32(acc, zero), _mm256_unpackhi_epi32(acc, zero));
+    sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    total += (int64_t) _mm_cvtsi128_si64(sum);
+  }
+  return total + reduce_u16_scalar(data + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2 (const int *in, int *out, size_t n) {
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    _mm256_storeu_si256((__m256i *) (out + i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (out + i)),
+                                                               _mm256_loadu_si256((const __m256i *) (in + i))));
+  }
+  accumulate_sse2(in + i, out + i, n - i);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ AVX-512 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+__attribute__((target("avx512f")))
+static ALWAYS_INLINE int scan_avx512_impl (const int *in, int *out, size_t n, int carry, int exclusive, int stream) {
+  __m512i v, x, zero = _mm512_setzero_si512(), c = _mm512_set1_epi32(carry), last = _mm512_set1_epi32(15);
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    v = _mm512_loadu_si512((const void *) (in + i));
+    // alignr with a zero vector shifts x up by 1, 2, 4 and 8 elements
+    x = _mm512_add_epi32(v, _mm512_alignr_epi32(v, zero, 15));
+    x = _mm512_add_epi32(x, _mm512_alignr_epi32(x, zero, 14));
+    x = _mm512_add_epi32(x, _mm512_alignr_epi32(x, zero, 12));
+    x = _mm512_add_epi32(x, _mm512_alignr_epi32(x, zero, 8));
+    x = _mm512_add_epi32(x, c);
+    if (stream) {
+      _mm512_stream_si512((void *) (out + i), exclusive ? _mm512_sub_epi32(x, v) : x);
+    } else {
+      _mm512_storeu_si512((void *) (out + i), exclusive ? _mm512_sub_epi32(x, v) : x);
+    }
+    c = _mm512_permutexvar_epi32(last, x);
+  }
+  return scan_avx2_impl(in + i, out + i, n - i, _mm512_cvtsi512_si32(c), exclusive, 0);
+}
+
+__attribute__((target("avx512f")))
+static int scan_avx512 (const int *in, int *out, size_t n, int carry) {
+  return scan_avx512_impl(in, out, n, carry, 0, 0);
+}
+
+__attribute__((target("avx512f")))
+static int scan_exclusive_avx512 (const int *in, int *out, size_t n, int carry) {
+  return scan_avx512_impl(in, out, n, carry, 1, 0);
+}
+
+__attribute__((target("avx512f")))
+static ALWAYS_INLINE void add_avx512_impl (const int *in, int *out, size_t n, int value, int stream) {
+  __m512i v = _mm512_set1_epi32(value);
+  size_t i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    if (stream) {
+      _mm512_stream_si512((void *) (out + i), _mm512_add_epi32(_mm512_loadu_si512((const void *) (in + i)), v));
+      _mm512_stream_si512((void *) (out + i + 16), _mm512_add_epi32(_mm512_loadu_si512((const void *) (in + i + 16)), v));
+    } else {
+      _mm512_storeu_si512((void *) (out + i), _mm512_add_epi32(_mm512_loadu_si512((const void *) (in + i)), v));
+      _mm512_storeu_si512((void *) (out + i + 16), _mm512_add_epi32(_mm512_loadu_si512((const void *) (in + i + 16)), v));
+    }
+  }
+  add_avx2(in + i, out + i, n - i, value);
+}
+
+__attribute__((target("avx512f")))
+static void add_avx512 (const int *in, int *out, size_t n, int value) {
+  add_avx512_impl(in, out, n, value, 0);
+}
+
+__attribute__((target("avx512f")))
+static int reduce_avx512 (const int *data, size_t n) {
+  __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+  size_t i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    acc0 = _mm512_add_epi32(acc0, _mm512_loadu_si512((const void *) (data + i)));
+    acc1 = _mm512_add_epi32(acc1, _mm512_loadu_si512((const void *) (data + i + 16)));
+  }
+  return _mm512_reduce_add_epi32(_mm512_add_epi32(acc0, acc1)) + reduce_avx2(data + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void widen_u8_avx512 (const uint8_t *in, int *out, size_t n) {
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    _mm512_storeu_si512((void *) (out + i), _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) (in + i))));
+  }
+  widen_u8_scalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void widen_u16_avx512 (const uint16_t *in, int *out, size_t n) {
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    _mm512_storeu_si512((void *) (out + i), _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *) (in + i))));
+  }
+  widen_u16_avx2(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void accumulate_avx512 (const int *in, int *out, size_t n) {
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    _mm512_storeu_si512((void *) (out + i), _mm512_add_epi32(_mm512_loadu_si512((const void *) (out + i)),
+                                                            _mm512_loadu_si512((const void *) (in + i))));
+  }
+  accumulate_avx2(in + i, out + i, n - i);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ Streaming ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+// Number of elements before "out" reaches a multiple of "bytes", at most n
+static size_t stream_head (const int *out, size_t bytes, size_t n) {
+  size_t head = (size_t) (-(uintptr_t) out & (bytes - 1)) / sizeof(int);
+
+  return head < n ? head : n;
+}
+
+// Streaming variants of a vector ISA: ordinary stores up to the first aligned
+// vector, streaming stores from there, and an sfence
+#define STREAMING_KERNELS(isa, target_isa, bytes)                                                  \
+  __attribute__((target(target_isa)))                                                              \
+  static int scan_stream_##isa (const int *in, int *out, size_t n, int carry) {                    \
+    size_t head = stream_head(out, bytes, n);                                                      \
+                                                                                                   \
+    carry = scan_scalar_impl(in, out, head, carry, 0);                                             \
+    carry = scan_##isa##_impl(in + head, out + head, n - head, carry, 0, 1);                       \
+    _mm_sfence();                                                                                  \
+    return carry;                                                                                  \
+  }                                                                                                \
+                                                                                                   \
+  __attribute__((target(target_isa)))                                                              \
+  static int scan_exclusive_stream_##isa (const int *in, int *out, size_t n, int carry) {          \
+    size_t head = stream_head(out, bytes, n);                                                      \
+                                                                                                   \
+    carry = scan_scalar_impl(in, out, head, carry, 1);                                             \
+    carry = scan_##isa##_impl(in + head, out + head, n - head, carry, 1, 1);                       \
+    _mm_sfence();                                                                                  \
+    return carry;                                                                                  \
+  }                                                                                                \
+                                                                                                   \
+  __attribute__((target(target_isa)))                                                              \
+  static void add_stream_##isa (const int *in, int *out, size_t n, int value) {                    \
+    size_t head = stream_head(out, bytes, n);                                                      \
+                                                                                                   \
+    add_scalar(in, out, head, value);                                                              \
+    add_##isa##_impl(in + head, out + head, n - head, value, 1);                                   \
+    _mm_sfence();                                                                                  \
+  }
+
+STREAMING_KERNELS(sse2, "sse2", 16)
+STREAMING_KERNELS(avx2, "avx2", 32)
+STREAMING_KERNELS(avx512, "avx512f", 64)
+
+#endif /* PPS_X86 */
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ Dispatch ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+static const pps_kernels kernel_table[] = {
+  [PPS_ISA_SCALAR] = { PPS_ISA_SCALAR, "scalar", scan_scalar, scan_exclusive_scalar, add_scalar, reduce_scalar,
+                       widen_u8_scalar, widen_u16_scalar, reduce_u8_scalar, reduce_u16_scalar,
+                       accumulate_scalar },
+#ifdef PPS_X86
+  [PPS_ISA_SSE2] = { PPS_ISA_SSE2, "sse2", scan_sse2, scan_exclusive_sse2, add_sse2, reduce_sse2,
+                     widen_u8_sse2, widen_u16_sse2, reduce_u8_sse2, reduce_u16_sse2, accumulate_sse2 },
+  [PPS_ISA_AVX2] = { PPS_ISA_AVX2, "avx2", scan_avx2, scan_exclusive_avx2, add_avx2, reduce_avx2,
+                     widen_u8_avx2, widen_u16_avx2, reduce_u8_avx2, reduce_u16_avx2, accumulate_avx2 },
+  [PPS_ISA_AVX512] = { PPS_ISA_AVX512, "avx512", scan_avx512, scan_exclusive_avx512, add_avx512, reduce_avx512,
+                       widen_u8_avx512, widen_u16_avx512, reduce_u8_avx2, reduce_u16_avx2,
+                       accumulate_avx512 },
+#endif
+};
+
+// Same kernels with streaming stores, the scalar ones have none
+static const pps_kernels streaming_table[] = {
+  [PPS_ISA_SCALAR] = { PPS_ISA_SCALAR, "scalar", scan_scalar, scan_exclusive_scalar, add_scalar, reduce_scalar,
+                       widen_u8_scalar, widen_u16_scalar, reduce_u8_scalar, reduce_u16_scalar,
+                       accumulate_scalar },
+#ifdef PPS_X86
+  [PPS_ISA_SSE2] = { PPS_ISA_SSE2, "sse2", scan_stream_sse2, scan_exclusive_stream_sse2, add_stream_sse2, reduce_sse2,
+                     widen_u8_sse2, widen_u16_sse2, reduce_u8_sse2, reduce_u16_sse2, accumulate_sse2 },
+  [PPS_ISA_AVX2] = { PPS_ISA_AVX2, "avx2", scan_stream_avx2, scan_exclusive_stream_avx2, add_stream_avx2, reduce_avx2,
+                     widen_u8_avx2, widen_u16_avx2, reduce_u8_avx2, reduce_u16_avx2, accumulate_avx2 },
+  [PPS_ISA_AVX512] = { PPS_ISA_AVX512, "avx512", scan_stream_avx512, scan_exclusive_stream_avx512, add_stream_avx512,
+                       reduce_avx512, widen_u8_avx512, widen_u16_avx512, reduce_u8_avx2, reduce_u16_avx2,
+                       accumulate_avx512 },
+#endif
+};
+
+/*
+ * Function:  isa_supported
+ * ------------------------
+ * returns: a C-style boolean telling whether this CPU can run the kernels of an ISA
+ */
+static int isa_supported (pps_isa isa) {
+  switch (isa) {
+  case PPS_ISA_SCALAR:
+    return 1;
+#ifdef PPS_X86
+  case PPS_ISA_SSE2:
+    return __builtin_cpu_supports("sse2");
+  case PPS_ISA_AVX2:
+    return __builtin_cpu_supports("avx2");
+  case PPS_ISA_AVX512:
+    return __builtin_cpu_supports("avx512f");
+#endif
+  default:
+    return 0;
+  }
+}
+
+pps_isa pps_best_isa (void) {
+  pps_isa isa;
+
+  for (isa = PPS_ISA_AVX512; isa > PPS_ISA_SCALAR; isa--) {
+    if (isa_supported(isa)) return isa;
+  }
+  return PPS_ISA_SCALAR;
+}
+
+const pps_kernels *pps_get_kernels (pps_isa isa) {
+  static pps_isa best = PPS_ISA_AUTO; // Racy but idempotent cache of pps_best_isa
+
+  if (isa == PPS_ISA_AUTO) {
+    if (best == PPS_ISA_AUTO) best = pps_best_isa();
+    isa = best;
+  }
+  if (!isa_supported(isa)) {
+    errno = ENOTSUP;
+    return NULL;
+  }
+  return &kernel_table[isa];
+}
+
+const pps_kernels *pps_streaming_kernels (const pps_kernels *k) {
+  return &streaming_table[k->isa];
+}
@@ -0,0 +1,227 @@
+/*
+ * stream.c
+ * --------
+ * Prefix sum of a stream of blocks, for data that never is in memory all at once.
+ *
+ * The running total of everything pushed so far is kept across calls and used as
+ * the carry-in of the next block. Every block goes through the reduce-then-scan
+ * scheme of the blocked engine, software pipelined over two blocks: the pool job of
+ * a push
+ *
+ *      - scans and writes out the chunks of the previous block, whose carries are
+ *        already known, and
+ *      - sums the chunks of the new block, then turns the chunk sums into the
+ *        carry-ins of its chunks (carry.c)
+ *
+ * so block k + 1 is read while block k is written, in a single pass with the two
+ * Phase 2 barriers. A push therefore completes the block pushed before it, and
+ * "pps_stream_finish" completes the last one. The stream never holds more than the
+ * chunk carries of one block, whatever the length of the stream; the blocks
+ * themselves stay in the caller's buffers.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "internal.h"
+
+// Block waiting for its output, or being read in
+typedef struct stream_block {
+  const int *in; // Input of the block, NULL if none
+  int *out; // Where the prefix sum of the block goes
+  int nthreads; // Number of chunks of the block
+  size_t *bounds; // Chunk boundaries, see "pps_partition"
+  int *carries; // Carry-in of every chunk
+} stream_block;
+
+struct pps_stream {
+  pps_pool *pool; // Pool running the blocks
+  pps_options opts; // Mode, thread count and tuning of every block
+  const pps_kernels *k; // Inner loops
+  int (*scan) (const int *, int *, size_t, int); // Inclusive or exclusive chunk scan
+  int running; // Sum of every element pushed so far
+  stream_block blocks[2]; // The pending block and the one being pushed
+  int pending; // Index in "blocks" of the block waiting for its output
+  pps_slot *slots; // Scratch space of Phase 2
+};
+
+// Data structure describing one step of the pipeline, shared by all threads
+typedef struct stream_job {
+  pps_stream *stream; // Stream the step belongs to
+  stream_block *done; // Block to scan and write out, or NULL
+  stream_block *next; // Block to sum, or NULL
+  pps_carry carry; // Chunk totals and carries of Phase 2
+  int block_total; // Sum of the elements of "next"
+} stream_job;
+
+/*
+ * Function:  stream_thread
+ * ------------------------
+ * Function that each active worker of the pool executes for one push
+ *
+ * ctx: the stream_job being computed
+ * id: thread id
+ * nthreads: number of threads taking part
+ */
+static void stream_thread (void *ctx, int id, int nthreads) {
+  stream_job *job = (stream_job *) ctx;
+  pps_stream *stream = job->stream;
+  size_t start_index, end_index;
+  int total = 0, carry = 0;
+
+  // Phase 3 of the previous block - its carries are known since the last push
+  if (job->done != NULL && id < job->done->nthreads) {
+    pps_chunk_bounds(job->done->bounds, id, &start_index, &end_index);
+    stream->scan(job->done->in + start_index, job->done->out + start_index,
+                 end_index - start_index, job->done->carries[id]);
+  }
+
+  if (job->next == NULL) return;
+
+  // Phase 1 of the new block - sum own chunk without writing anything
+  if (id < job->next->nthreads) {
+    pps_chunk_bounds(job->next->bounds, id, &start_index, &end_index);
+    total = stream->k->reduce(job->next->in + start_index, end_index - start_index);
+  }
+
+  // Phase 2 of the new block - hierarchical scan of the chunk totals
+  if (nthreads > 1) {
+    carry = pps_carry_exchange(&job->carry, stream->pool, id, nthreads, total);
+  }
+  if (id < job->next->nthreads) {
+    job->next->carries[id] = stream->running + carry;
+  }
+  if (id == nthreads - 1) {
+    job->block_total = carry + total;
+  }
+}
+
+/*
+ * Function:  stream_step
+ * ----------------------
+ * Runs one step of the pipeline: writes out the pending block, if any, while the
+ * block "next" (may be NULL) is summed
+ */
+static int stream_step (pps_stream *stream, stream_block *next) {
+  stream_block *done = stream->blocks[stream->pending].in != NULL ? &stream->blocks[stream->pending] : NULL;
+  stream_job job;
+  int nthreads = 1;
+
+  if (done != NULL) nthreads = done->nthreads;
+  if (next != NULL && next->nthreads > nthreads) nthreads = next->nthreads;
+
+  job.stream = stream;
+  job.done = done;
+  job.next = next;
+  job.block_total = 0;
+  pps_carry_init(&job.carry, stream->slots, nthreads, pps_pool_group_size(stream->pool, nthreads));
+
+  if (nthreads == 1) { // Not worth waking anybody up
+    stream_thread(&job, 0, 1);
+  } else if (pps_pool_run_with(stream->pool, nthreads, stream_thread, &job, stream->opts.barrier) != 0) {
+    return -1;
+  }
+
+  stream->running += job.block_total;
+  if (done != NULL) done->in = NULL;
+  return 0;
+}
+
+pps_stream *pps_stream_create (pps_pool *pool, const pps_options *opts) {
+  pps_stream *stream;
+  int size, i;
+
+  if (pool == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  stream = (pps_stream *) calloc(1, sizeof(pps_stream));
+  if (stream == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (opts != NULL) {
+    stream->opts = *opts;
+  } else {
+    pps_options_init(&stream->opts);
+  }
+
+  stream->k = pps_get_kernels(stream->opts.isa);
+  if (stream->k == NULL) { // errno set by pps_get_kernels
+    free(stream);
+    return NULL;
+  }
+  stream->pool = pool;
+  stream->scan = pps_scan_kernel(stream->k, &stream->opts);
+
+  // Everything is sized for the whole pool once, so pushes don't allocate
+  size = pps_pool_size(pool);
+  stream->slots = (pps_slot *) aligned_alloc(sizeof(pps_slot), PPS_CARRY_SLOTS(size) * sizeof(pps_slot));
+  for (i = 0; i < 2; i++) {
+    stream->blocks[i].bounds = (size_t *) malloc((size + 1) * sizeof(size_t));
+    stream->blocks[i].carries = (int *) malloc(size * sizeof(int));
+  }
+  if (stream->slots == NULL || stream->blocks[0].bounds == NULL || stream->blocks[0].carries == NULL ||
+      stream->blocks[1].bounds == NULL || stream->blocks[1].carries == NULL) {
+    pps_stream_destroy(stream);
+    errno = ENOMEM;
+    return NULL;
+  }
+  return stream;
+}
+
+int pps_stream_push (pps_stream *stream, const int *in, int *out, size_t n, int **done) {
+  stream_block *next;
+  int *completed;
+
+  if (stream == NULL || in == NULL || out == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  completed = stream->blocks[stream->pending].in != NULL ? stream->blocks[stream->pending].out : NULL;
+
+  next = &stream->blocks[1 - stream->pending];
+  next->in = in;
+  next->out = out;
+  next->nthreads = pps_job_threads(stream->pool, n, stream->opts.nthreads);
+  pps_partition(stream->pool, n, next->nthreads, out, stream->opts.chunk_align, next->bounds);
+
+  if (stream_step(stream, next) != 0) {
+    next->in = NULL;
+    return -1;
+  }
+  stream->pending = 1 - stream->pending; // The new block now waits for its output
+
+  if (done != NULL) *done = completed;
+  return 0;
+}
+
+int pps_stream_finish (pps_stream *stream, int **done) {
+  int *completed;
+
+  if (stream == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  completed = stream->blocks[stream->pending].in != NULL ? stream->blocks[stream->pending].out : NULL;
+  if (completed != NULL && stream_step(stream, NULL) != 0) return -1;
+
+  if (done != NULL) *done = completed;
+  return 0;
+}
+
+int pps_stream_total (const pps_stream *stream) {
+  return stream->running;
+}
+
+void pps_stream_destroy (pps_stream *stream) {
+  if (stream == NULL) return;
+
+  free(stream->blocks[0].bounds); free(stream->blocks[0].carries);
+  free(stream->blocks[1].bounds); free(stream->blocks[1].carries);
+  free(stream->slots);
+  free(stream);
+}
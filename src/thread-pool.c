@@ -0,0 +1,454 @@
+/*
+ * thread-pool.c
+ * -------------
+ * Persistent pool of worker threads. The threads are created once by
+ * "pps_pool_create" and parked on a condition variable between jobs. Each job
+ * publishes a new generation, wakes the workers and waits for the active ones to
+ * report back, so a call costs a wake-up instead of the creation and joining of
+ * every thread.
+ *
+ * The workers can be pinned to CPUs ("pps_pool_set_affinity"). In NUMA mode they
+ * are dealt out to the nodes in blocks of consecutive ids, since consecutive ids
+ * own neighbouring chunks of the array and combine their totals first in Phase 2.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "internal.h"
+
+// Data structure for packing all arguments per thread together, one cache line
+// each so that the workers don't false share the array
+typedef struct arg_pack {
+  int id; // Thread id
+  pps_pool *pool; // Pool the thread belongs to
+} __attribute__((aligned(64))) arg_pack;
+
+struct pps_pool {
+  int size; // Number of worker threads
+  pthread_t *thread_array; // Worker thread handles
+  arg_pack *threadargs; // Per thread arguments
+  pthread_mutex_t run_lock; // Serialises callers of pps_pool_run
+  pthread_mutex_t lock; // Protects the job description and the fields below
+  pthread_cond_t wake; // Signalled when a new job is submitted
+  pthread_cond_t done; // Signalled when the last active worker finishes a job
+  unsigned long generation; // Incremented once per submitted job
+  int pending; // Number of active workers that have not finished the current job
+  int shutdown; // Set by pps_pool_destroy to release the workers
+  pps_task_fn fn; // Current job
+  void *ctx; // Current job data
+  int active; // Number of workers taking part in the current job
+  pthread_barrier_t barr; // Barrier across the active workers
+  int barrier_count; // Number of threads "barr" was initialised for (0 if none)
+  pps_spin_barrier spin_barr; // Atomic barrier across the active workers
+  pps_barrier default_barrier; // Kind used when a job asks for PPS_BARRIER_DEFAULT
+  pps_barrier barrier; // Kind used by the current job
+  pps_affinity affinity; // How the workers are pinned
+  int *node_of; // NUMA node of every worker, 0 unless pinned by node
+  double *weights; // Relative speed of every worker, NULL when all equal
+  pps_tuning tuning; // Crossover table
+  int tuned; // Whether "tuning" is valid
+  pps_arena *scratch; // Scratch space of the scans, reused from call to call
+  pthread_mutex_t scratch_lock; // Held by the call using "scratch"
+  pps_trace *trace; // Measurements of the workers, NULL unless built with PPS_TRACE
+  uint64_t submitted; // Time the current job was submitted, when tracing
+  pps_offload_fn offload; // Where large scans go instead of the workers, NULL if nowhere
+  void *offload_ctx; // Argument of "offload"
+  size_t offload_min; // Smallest scan given to "offload"
+  pps_async *async; // Dispatcher of the asynchronous scans, NULL until the first one
+};
+
+/*
+ * Function:  worker_loop
+ * ----------------------
+ * Pointer function that each pool thread executes once created. The thread sleeps until
+ * a new generation is published, runs the job if it is one of the active workers and
+ * reports back
+ *
+ * args: data structure containing thread's id and pool
+ */
+static void *worker_loop (void *args) {
+  int id = ((arg_pack *)args)->id;
+  pps_pool *pool = ((arg_pack *)args)->pool;
+  unsigned long seen = 0;
+  pps_task_fn fn;
+  void *ctx;
+  int active;
+#ifdef PPS_TRACE
+  uint64_t submitted;
+#endif
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->generation == seen && !pool->shutdown) {
+      pthread_cond_wait(&pool->wake, &pool->lock); // Parked until the next job
+    }
+    if (pool->shutdown) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    seen = pool->generation;
+    fn = pool->fn;
+    ctx = pool->ctx;
+    active = pool->active;
+#ifdef PPS_TRACE
+    submitted = pool->submitted;
+#endif
+    pthread_mutex_unlock(&pool->lock);
+
+    if (id >= active) continue; // Not needed for this job
+
+#ifdef PPS_TRACE
+    pps_trace_job(pool->trace, id, submitted);
+#endif
+
+    fn(ctx, id, active);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) {
+      pthread_cond_signal(&pool->done); // Last worker out wakes up the caller
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+pps_pool *pps_pool_create (int nthreads) {
+  pps_pool *pool;
+  int i;
+
+  if (nthreads <= 0) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = ncpus > 0 ? (int) ncpus : 1;
+  }
+
+  // The atomic barrier wants its cache lines to itself
+  pool = (pps_pool *) aligned_alloc(64, (sizeof(pps_pool) + 63) / 64 * 64);
+  if (pool == NULL) return NULL;
+  memset(pool, 0, sizeof(pps_pool));
+
+  pool->thread_array = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+  pool->threadargs = (arg_pack *) aligned_alloc(sizeof(arg_pack), nthreads * sizeof(arg_pack));
+  pool->node_of = (int *) calloc(nthreads, sizeof(int));
+  pool->scratch = pps_arena_create(0);
+  if (pool->thread_array == NULL || pool->threadargs == NULL || pool->node_of == NULL || pool->scratch == NULL) {
+    free(pool->thread_array); free(pool->threadargs); free(pool->node_of); pps_arena_destroy(pool->scratch);
+    free(pool);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+#ifdef PPS_TRACE
+  pool->trace = pps_trace_create(nthreads);
+  if (pool->trace == NULL) {
+    free(pool->thread_array); free(pool->threadargs); free(pool->node_of); pps_arena_destroy(pool->scratch);
+    free(pool);
+    errno = ENOMEM;
+    return NULL;
+  }
+#endif
+
+  pool->default_barrier = PPS_BARRIER_PTHREAD;
+  pthread_mutex_init(&pool->run_lock, NULL);
+  pthread_mutex_init(&pool->scratch_lock, NULL);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  // Create the threads, they park themselves until the first job
+  for (i = 0; i < nthreads; i++) {
+    pool->threadargs[i].id = i;
+    pool->threadargs[i].pool = pool;
+    if (pthread_create(&pool->thread_array[i], NULL, worker_loop, (void *) &pool->threadargs[i]) != 0) {
+      break;
+    }
+  }
+  pool->size = i;
+
+  if (pool->size < nthreads) { // Could not start every thread, undo
+    pps_pool_destroy(pool);
+    errno = EAGAIN;
+    return NULL;
+  }
+
+  return pool;
+}
+
+void pps_pool_destroy (pps_pool *pool) {
+  int i;
+
+  if (pool == NULL) return;
+
+  pps_async_destroy(pool->async); // Runs the queued scans while the workers are still there
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  // Wait for the threads to finish
+  for (i = 0; i < pool->size; i++) {
+    pthread_join(pool->thread_array[i], NULL);
+  }
+
+  if (pool->barrier_count > 0) {
+    pthread_barrier_destroy(&pool->barr);
+  }
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_mutex_destroy(&pool->run_lock);
+  pthread_mutex_destroy(&pool->scratch_lock);
+  pps_arena_destroy(pool->scratch);
+  free(pool->thread_array); free(pool->threadargs); free(pool->node_of);
+  free(pool->weights);
+  pps_trace_destroy(pool->trace);
+  free(pool);
+}
+
+int pps_pool_size (const pps_pool *pool) {
+  return pool->size;
+}
+
+void pps_pool_set_barrier (pps_pool *pool, pps_barrier barrier) {
+  pthread_mutex_lock(&pool->run_lock);
+  pool->default_barrier = barrier == PPS_BARRIER_DEFAULT ? PPS_BARRIER_PTHREAD : barrier;
+  pthread_mutex_unlock(&pool->run_lock);
+}
+
+/*
+ * Function:  numa_cpu
+ * -------------------
+ * Picks the CPU of a worker in NUMA mode. The workers are split over the nodes in
+ * proportion to their number of CPUs, in blocks of consecutive ids, and round-robin
+ * over the CPUs of their node
+ *
+ * nodes: node of every CPU, node after node as listed by "pps_cpu_topology"
+ * count: number of CPUs
+ * id: worker id
+ * size: number of workers
+ *
+ * returns: the index of the worker's CPU in the list
+ */
+static int numa_cpu (const int *nodes, int count, int id, int size) {
+  int begin, end, first_id, next_id;
+
+  for (begin = 0; begin < count; begin = end) {
+    for (end = begin; end < count && nodes[end] == nodes[begin]; end++);
+    first_id = (int) ((long) size * begin / count);
+    next_id = (int) ((long) size * end / count);
+    if (id < next_id) return begin + (id - first_id) % (end - begin);
+  }
+  return id % count;
+}
+
+int pps_pool_set_affinity (pps_pool *pool, pps_affinity affinity) {
+#ifdef __linux__
+  int cpus[CPU_SETSIZE], nodes[CPU_SETSIZE], count, i, c, status = 0;
+  cpu_set_t set;
+
+  count = pps_cpu_topology(cpus, nodes, CPU_SETSIZE);
+  if (count == 0) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  pthread_mutex_lock(&pool->run_lock); // No job is running while the workers move
+  for (i = 0; i < pool->size; i++) {
+    CPU_ZERO(&set);
+    switch (affinity) {
+    case PPS_AFFINITY_COMPACT:
+      c = i % count;
+      break;
+    case PPS_AFFINITY_NUMA:
+      c = numa_cpu(nodes, count, i, pool->size);
+      break;
+    default: // Any allowed CPU
+      for (c = 0; c < count; c++) CPU_SET(cpus[c], &set);
+      c = -1;
+    }
+    if (c >= 0) CPU_SET(cpus[c], &set);
+    pool->node_of[i] = affinity == PPS_AFFINITY_NUMA ? nodes[c] : 0;
+    if (pthread_setaffinity_np(pool->thread_array[i], sizeof(set), &set) != 0) {
+      status = -1;
+    }
+  }
+  pool->affinity = affinity;
+  pthread_mutex_unlock(&pool->run_lock);
+
+  if (status != 0) errno = EINVAL;
+  return status;
+#else
+  (void) pool; (void) affinity;
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+int pps_pool_group_size (const pps_pool *pool, int nthreads) {
+  int i;
+
+  if (pool->affinity != PPS_AFFINITY_NUMA) return 0;
+  for (i = 1; i < nthreads && pool->node_of[i] == pool->node_of[0]; i++);
+  return i < nthreads ? i : 0; // A job on a single node keeps the default groups
+}
+
+int pps_pool_set_weights (pps_pool *pool, const double *weights) {
+  double *copy = NULL;
+  int i;
+
+  if (weights != NULL) {
+    for (i = 0; i < pool->size; i++) {
+      if (!(weights[i] > 0)) {
+        errno = EINVAL;
+        return -1;
+      }
+    }
+    copy = (double *) malloc(pool->size * sizeof(double));
+    if (copy == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+    memcpy(copy, weights, pool->size * sizeof(double));
+  }
+
+  pthread_mutex_lock(&pool->run_lock); // No job is reading the old weights
+  free(pool->weights);
+  pool->weights = copy;
+  pthread_mutex_unlock(&pool->run_lock);
+  return 0;
+}
+
+const double *pps_pool_weights (const pps_pool *pool) {
+  return pool->weights;
+}
+
+const pps_tuning *pps_pool_tuning (const pps_pool *pool) {
+  return pool->tuned ? &pool->tuning : NULL;
+}
+
+void pps_pool_store_tuning (pps_pool *pool, const pps_tuning *tuning) {
+  pthread_mutex_lock(&pool->run_lock); // No job is reading the old table
+  if (tuning != NULL) pool->tuning = *tuning;
+  pool->tuned = tuning != NULL;
+  pthread_mutex_unlock(&pool->run_lock);
+}
+
+int pps_pool_set_offload (pps_pool *pool, pps_offload_fn fn, void *ctx, size_t min_items) {
+  if (pool == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->offload = fn;
+  pool->offload_ctx = ctx;
+  pool->offload_min = min_items;
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+pps_offload_fn pps_pool_offload (pps_pool *pool, size_t n, void **ctx) {
+  pps_offload_fn fn = NULL;
+
+  pthread_mutex_lock(&pool->lock); // Not run_lock, which a running job holds
+  if (pool->offload != NULL && n >= pool->offload_min) {
+    fn = pool->offload;
+    *ctx = pool->offload_ctx;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return fn;
+}
+
+pps_arena *pps_pool_scratch (pps_pool *pool) {
+  pthread_mutex_lock(&pool->scratch_lock); // Taken before run_lock, never after
+  pps_arena_reset(pool->scratch);
+  return pool->scratch;
+}
+
+void pps_pool_scratch_release (pps_pool *pool) {
+  pthread_mutex_unlock(&pool->scratch_lock);
+}
+
+pps_async *pps_pool_async (pps_pool *pool) {
+  pps_async *async;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->async == NULL) pool->async = pps_async_create(pool); // errno set on failure
+  async = pool->async;
+  pthread_mutex_unlock(&pool->lock);
+  return async;
+}
+
+pps_trace *pps_pool_trace (const pps_pool *pool) {
+  return pool->trace;
+}
+
+pps_affinity pps_pool_affinity (const pps_pool *pool) {
+  return pool->affinity;
+}
+
+int pps_pool_run_with (pps_pool *pool, int nthreads, pps_task_fn fn, void *ctx, pps_barrier barrier) {
+  if (nthreads < 1 || nthreads > pool->size) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  pthread_mutex_lock(&pool->run_lock);
+
+  // No worker is inside a barrier between jobs, so they can be resized safely
+  pool->barrier = barrier == PPS_BARRIER_DEFAULT ? pool->default_barrier : barrier;
+  if (pool->barrier == PPS_BARRIER_PTHREAD && pool->barrier_count != nthreads) {
+    if (pool->barrier_count > 0) {
+      pthread_barrier_destroy(&pool->barr);
+    }
+    pthread_barrier_init(&pool->barr, NULL, nthreads);
+    pool->barrier_count = nthreads;
+  }
+  if (pool->barrier != PPS_BARRIER_PTHREAD) {
+    pps_spin_barrier_init(&pool->spin_barr, nthreads);
+  }
+
+  // Publish a new generation and wake up the workers
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->ctx = ctx;
+  pool->active = nthreads;
+  pool->pending = nthreads;
+  pool->generation++;
+#ifdef PPS_TRACE
+  pool->submitted = pps_trace_now();
+#endif
+  pthread_cond_broadcast(&pool->wake);
+
+  // Wait for the active workers to finish
+  while (pool->pending > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  pthread_mutex_unlock(&pool->run_lock);
+  return 0;
+}
+
+int pps_pool_run (pps_pool *pool, int nthreads, pps_task_fn fn, void *ctx) {
+  return pps_pool_run_with(pool, nthreads, fn, ctx, PPS_BARRIER_DEFAULT);
+}
+
+void pps_pool_barrier (pps_pool *pool) {
+  switch (pool->barrier) {
+  case PPS_BARRIER_SPIN:
+    pps_spin_barrier_wait(&pool->spin_barr, 0);
+    break;
+  case PPS_BARRIER_HYBRID:
+    pps_spin_barrier_wait(&pool->spin_barr, 1);
+    break;
+  default:
+    pthread_barrier_wait(&pool->barr);
+  }
+}
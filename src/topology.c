@@ -0,0 +1,100 @@
+/*
+ * topology.c
+ * ----------
+ * Which CPUs the process may run on and which NUMA node each of them belongs to,
+ * read from /sys/devices/system/node. Nothing beyond sysfs is needed, so the library
+ * doesn't depend on libnuma.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "internal.h"
+
+#define MAX_NODES 1024 // Highest node number looked for
+
+#ifdef __linux__
+
+/*
+ * Function:  read_cpulist
+ * -----------------------
+ * Parses a sysfs CPU list such as "0-3,8-11" into a CPU set
+ *
+ * returns: a C-style boolean telling whether the file could be read
+ */
+static int read_cpulist (const char *path, cpu_set_t *set) {
+  char buffer[4096], *p = buffer, *next;
+  long first, last;
+  FILE *file;
+
+  file = fopen(path, "r");
+  if (file == NULL) return 0;
+  if (fgets(buffer, sizeof(buffer), file) == NULL) buffer[0] = '\0';
+  fclose(file);
+
+  CPU_ZERO(set);
+  while (*p != '\0' && *p != '\n') {
+    first = last = strtol(p, &next, 10);
+    if (next == p) break;
+    if (*next == '-') {
+      p = next + 1;
+      last = strtol(p, &next, 10);
+    }
+    for (; first <= last && first < CPU_SETSIZE; first++) CPU_SET(first, set);
+    p = *next == ',' ? next + 1 : next;
+  }
+  return 1;
+}
+
+int pps_cpu_topology (int *cpus, int *nodes, int max) {
+  cpu_set_t allowed, node_cpus;
+  int count = 0, node, cpu, last_node = 0;
+  long ncpus;
+  char path[64];
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) { // Assume all online CPUs
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    CPU_ZERO(&allowed);
+    for (cpu = 0; cpu < ncpus && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &allowed);
+  }
+
+  for (node = 0; node < MAX_NODES && count < max; node++) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (!read_cpulist(path, &node_cpus)) continue; // Node numbers may have holes
+    for (cpu = 0; cpu < CPU_SETSIZE && count < max; cpu++) {
+      if (CPU_ISSET(cpu, &allowed) && CPU_ISSET(cpu, &node_cpus)) {
+        CPU_CLR(cpu, &allowed);
+        cpus[count] = cpu;
+        nodes[count++] = node;
+        last_node = node;
+      }
+    }
+  }
+
+  // CPUs no node claims (no sysfs at all, typically)
+  for (cpu = 0; cpu < CPU_SETSIZE && count < max; cpu++) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      cpus[count] = cpu;
+      nodes[count++] = last_node;
+    }
+  }
+  return count;
+}
+
+#else
+
+int pps_cpu_topology (int *cpus, int *nodes, int max) {
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int count;
+
+  for (count = 0; count < ncpus && count < max; count++) {
+    cpus[count] = count;
+    nodes[count] = 0;
+  }
+  return count;
+}
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * trace.c
+ * -------
+ * Optional instrumentation of the pool jobs, compiled in with -DPPS_TRACE
+ * ("make TRACE=1").
+ *
+ * The engines mark the boundaries of their phases with PPS_TRACE_TIME and
+ * PPS_TRACE_PHASE (internal.h), the pool marks the wake-up of every worker and
+ * carry.c every barrier. Each worker writes only its own record, one cache line
+ * aligned block per worker, so the hooks take no lock and cost two clock reads per
+ * phase. A record holds
+ *
+ *      - the time and number of entries of every phase (pps_thread_stats)
+ *      - a ring of the last PPS_TRACE_EVENTS phases, dumped as a Chrome trace
+ *      - when enabled, perf_event counters opened by the worker on itself; at the
+ *        end of every phase the events since the worker's previous phase ended
+ *        are added to the phase
+ *
+ * Phase 2 contains the barriers, so CARRY and BARRIER spans nest in the timeline
+ * and BARRIER time shows how much of Phase 2 is waiting for the slowest thread.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "internal.h"
+
+static const char *phase_names[PPS_NPHASES] = { "wake", "local", "carry", "barrier", "final" };
+
+const char *pps_phase_name (pps_phase phase) {
+  return (unsigned) phase < PPS_NPHASES ? phase_names[phase] : "unknown";
+}
+
+uint64_t pps_trace_now (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+#ifdef PPS_TRACE
+
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#define PPS_TRACE_EVENTS 65536 // Phases kept per worker for the timeline
+
+// One span of the timeline
+typedef struct trace_event {
+  uint64_t start, end; // Nanoseconds since the trace was created
+  int phase; // pps_phase of the span
+} trace_event;
+
+// Everything one worker records, in its own cache lines
+typedef struct trace_thread {
+  pps_thread_stats stats; // Accumulated measurements
+  trace_event *events; // Ring of the last PPS_TRACE_EVENTS spans
+  uint64_t nevents; // Spans recorded so far, the ring holds the last ones
+  int fds[PPS_NCOUNTERS]; // perf_event counters of the worker, -1 when closed
+  uint64_t last[PPS_NCOUNTERS]; // Counter values when the previous phase ended
+} __attribute__((aligned(64))) trace_thread;
+
+struct pps_trace {
+  int nthreads; // Number of workers
+  uint64_t epoch; // Time the trace was created, start of the timeline
+  _Atomic int counters; // Whether the workers should count hardware events
+  trace_thread *threads; // One record per worker
+};
+
+pps_trace *pps_trace_create (int nthreads) {
+  pps_trace *trace = (pps_trace *) calloc(1, sizeof(pps_trace));
+  int i, c;
+
+  if (trace == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  trace->threads = (trace_thread *) aligned_alloc(sizeof(trace_thread), nthreads * sizeof(trace_thread));
+  if (trace->threads == NULL) {
+    free(trace);
+    errno = ENOMEM;
+    return NULL;
+  }
+  memset(trace->threads, 0, nthreads * sizeof(trace_thread));
+  trace->nthreads = nthreads;
+  for (i = 0; i < nthreads; i++) {
+    for (c = 0; c < PPS_NCOUNTERS; c++) trace->threads[i].fds[c] = -1;
+    trace->threads[i].events = (trace_event *) malloc(PPS_TRACE_EVENTS * sizeof(trace_event));
+    if (trace->threads[i].events == NULL) {
+      trace->nthreads = i + 1; // Free the ones allocated so far
+      pps_trace_destroy(trace);
+      errno = ENOMEM;
+      return NULL;
+    }
+  }
+  trace->epoch = pps_trace_now();
+  atomic_init(&trace->counters, 0);
+  return trace;
+}
+
+void pps_trace_destroy (pps_trace *trace) {
+  int i, c;
+
+  if (trace == NULL) return;
+
+  for (i = 0; i < trace->nthreads; i++) {
+    for (c = 0; c < PPS_NCOUNTERS; c++) {
+      if (trace->threads[i].fds[c] >= 0) close(trace->threads[i].fds[c]);
+    }
+    free(trace->threads[i].events);
+  }
+  free(trace->threads);
+  free(trace);
+}
+
+/*
+ * Function:  open_counter
+ * -----------------------
+ * Opens a hardware event counter of the calling thread, on any CPU
+ *
+ * returns: the file descriptor, -1 with errno set on failure
+ */
+static int open_counter (int counter) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  switch (counter) {
+  case PPS_COUNTER_CACHE_MISSES:
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    break;
+  case PPS_COUNTER_LLC_LOADS:
+  case PPS_COUNTER_LLC_MISSES:
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  ((counter == PPS_COUNTER_LLC_LOADS ? PERF_COUNT_HW_CACHE_RESULT_ACCESS
+                                                     : PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+    break;
+  }
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Current value of a counter, 0 if it is closed or unreadable
+static uint64_t read_counter (int fd) {
+  uint64_t value;
+
+  if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) return 0;
+  return value;
+}
+
+void pps_trace_job (pps_trace *trace, int id, uint64_t submitted) {
+  trace_thread *thread = &trace->threads[id];
+  int wanted = atomic_load_explicit(&trace->counters, memory_order_relaxed), c;
+
+  for (c = 0; c < PPS_NCOUNTERS; c++) { // Counters belong to the thread they count
+    if (wanted && thread->fds[c] < 0) {
+      thread->fds[c] = open_counter(c);
+    } else if (!wanted && thread->fds[c] >= 0) {
+      close(thread->fds[c]);
+      thread->fds[c] = -1;
+    }
+    thread->last[c] = read_counter(thread->fds[c]);
+  }
+  pps_trace_record(trace, id, PPS_PHASE_WAKE, submitted);
+}
+
+void pps_trace_record (pps_trace *trace, int id, pps_phase phase, uint64_t start) {
+  trace_thread *thread = &trace->threads[id];
+  uint64_t end = pps_trace_now(), value;
+  trace_event *event;
+  int c;
+
+  thread->stats.seconds[phase] += (end - start) * 1e-9;
+  thread->stats.count[phase]++;
+  for (c = 0; c < PPS_NCOUNTERS; c++) {
+    if (thread->fds[c] < 0) continue;
+    value = read_counter(thread->fds[c]);
+    thread->stats.counters[phase][c] += value - thread->last[c];
+    thread->last[c] = value;
+  }
+
+  event = &thread->events[thread->nevents++ % PPS_TRACE_EVENTS];
+  event->start = start - trace->epoch;
+  event->end = end - trace->epoch;
+  event->phase = phase;
+}
+
+int pps_pool_stats (pps_pool *pool, pps_thread_stats *stats) {
+  pps_trace *trace;
+  int i;
+
+  if (pool == NULL || stats == NULL || (trace = pps_pool_trace(pool)) == NULL) {
+    errno = pool == NULL || stats == NULL ? EINVAL : ENOTSUP;
+    return -1;
+  }
+  for (i = 0; i < trace->nthreads; i++) {
+    stats[i] = trace->threads[i].stats;
+  }
+  return 0;
+}
+
+int pps_pool_reset_stats (pps_pool *pool) {
+  pps_trace *trace;
+  int i;
+
+  if (pool == NULL || (trace = pps_pool_trace(pool)) == NULL) {
+    errno = pool == NULL ? EINVAL : ENOTSUP;
+    return -1;
+  }
+  for (i = 0; i < trace->nthreads; i++) {
+    memset(&trace->threads[i].stats, 0, sizeof(pps_thread_stats));
+    trace->threads[i].nevents = 0;
+  }
+  return 0;
+}
+
+int pps_pool_enable_counters (pps_pool *pool, int enable) {
+  pps_trace *trace;
+  int fd;
+
+  if (pool == NULL || (trace = pps_pool_trace(pool)) == NULL) {
+    errno = pool == NULL ? EINVAL : ENOTSUP;
+    return -1;
+  }
+  if (enable) { // The workers open their own, find out here whether they can
+    fd = open_counter(PPS_COUNTER_CACHE_MISSES);
+    if (fd < 0) return -1;
+    close(fd);
+  }
+  atomic_store_explicit(&trace->counters, enable != 0, memory_order_relaxed);
+  return 0;
+}
+
+int pps_pool_dump_trace (pps_pool *pool, const char *path) {
+  const trace_thread *thread;
+  const trace_event *event;
+  pps_trace *trace;
+  uint64_t e, first;
+  const char *separator = "";
+  FILE *file;
+  int i;
+
+  if (pool == NULL || path == NULL || (trace = pps_pool_trace(pool)) == NULL) {
+    errno = pool == NULL || path == NULL ? EINVAL : ENOTSUP;
+    return -1;
+  }
+
+  file = fopen(path, "w");
+  if (file == NULL) return -1;
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for (i = 0; i < trace->nthreads; i++) {
+    thread = &trace->threads[i];
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}",
+            separator, i, i);
+    separator = ",\n";
+    first = thread->nevents > PPS_TRACE_EVENTS ? thread->nevents - PPS_TRACE_EVENTS : 0;
+    for (e = first; e < thread->nevents; e++) { // Complete events, times in microseconds
+      event = &thread->events[e % PPS_TRACE_EVENTS];
+      fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+              phase_names[event->phase], i, event->start * 1e-3, (event->end - event->start) * 1e-3);
+    }
+  }
+  fprintf(file, "\n]}\n");
+  if (fclose(file) != 0) return -1;
+  return 0;
+}
+
+#else // Instrumentation compiled out
+
+pps_trace *pps_trace_create (int nthreads) {
+  (void) nthreads;
+  errno = ENOTSUP;
+  return NULL;
+}
+
+void pps_trace_destroy (pps_trace *trace) {
+  (void) trace;
+}
+
+void pps_trace_job (pps_trace *trace, int id, uint64_t submitted) {
+  (void) trace; (void) id; (void) submitted;
+}
+
+void pps_trace_record (pps_trace *trace, int id, pps_phase phase, uint64_t start) {
+  (void) trace; (void) id; (void) phase; (void) start;
+}
+
+int pps_pool_stats (pps_pool *pool, pps_thread_stats *stats) {
+  (void) pool; (void) stats;
+  errno = ENOTSUP;
+  return -1;
+}
+
+int pps_pool_reset_stats (pps_pool *pool) {
+  (void) pool;
+  errno = ENOTSUP;
+  return -1;
+}
+
+int pps_pool_enable_counters (pps_pool *pool, int enable) {
+  (void) pool; (void) enable;
+  errno = ENOTSUP;
+  return -1;
+}
+
+int pps_pool_dump_trace (pps_pool *pool, const char *path) {
+  (void) pool; (void) path;
+  errno = ENOTSUP;
+  return -1;
+}
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * tuning.c
+ * --------
+ * Calibrated choice between the scalar loop, the vector kernels on one thread and
+ * the engines on k threads.
+ *
+ * PPS_MIN_ITEMS_PER_THREAD is a rule of thumb: waking the pool and crossing two
+ * barriers costs microseconds, and on many machines a single thread with the vector
+ * kernels beats the pool well beyond that size. "pps_pool_calibrate" measures the
+ * crossovers instead:
+ *
+ *      - every size from 256 to 2^24 elements (doubling) is scanned with the
+ *        scalar loop and with 1, 2, 4, ... threads, keeping the median of a few
+ *        repetitions
+ *      - a thread count is used from the smallest size at which it, or a larger
+ *        count, is the fastest for every size from there up
+ *      - the same rule gives the size from which the vector kernels replace the
+ *        scalar loop
+ *
+ * so a tuned pool is never slower than the serial scan at any measured size. The
+ * table can be saved to a text file and loaded again, e.g. from the one written by
+ * the benchmark program:
+ *
+ *      # libprefixsum tuning
+ *      simd 512
+ *      threads 2 262144
+ *      threads 4 1048576
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "internal.h"
+
+#define MIN_SIZE_LOG 8 // Smallest size measured, 2^8
+#define MAX_SIZE_LOG 24 // Largest size measured, 2^24
+#define NSIZES (MAX_SIZE_LOG - MIN_SIZE_LOG + 1)
+#define REPS 7 // Timed repetitions of every measurement, the median is kept
+#define MIN_REP_TIME 100e-6 // Small sizes are scanned repeatedly for this long per repetition
+
+// Wall clock time in seconds
+static double now (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_doubles (const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * Function:  measure
+ * ------------------
+ * Median time of a scan of n elements on exactly nthreads workers
+ *
+ * returns: seconds per scan, or a negative value if the scan failed
+ */
+static double measure (pps_pool *pool, int *data, size_t n, int nthreads, const pps_options *opts,
+                       const pps_kernels *k) {
+  double times[REPS], start, elapsed;
+  size_t scans;
+  int r;
+
+  for (r = -1; r < REPS; r++) { // One warm-up round
+    start = now();
+    scans = 0;
+    do {
+      if (pps_scan_threads(pool, data, data, n, nthreads, opts, k) != 0) return -1;
+      scans++;
+    } while ((elapsed = now() - start) < MIN_REP_TIME);
+    if (r >= 0) times[r] = elapsed / scans;
+  }
+  qsort(times, REPS, sizeof(double), compare_doubles);
+  return times[REPS / 2];
+}
+
+/*
+ * Function:  crossover
+ * --------------------
+ * returns: the smallest measured size from which "wins" holds for every larger
+ *          size, SIZE_MAX if it doesn't hold at the largest one
+ */
+static size_t crossover (const int *wins) {
+  int s = NSIZES;
+
+  while (s > 0 && wins[s - 1]) s--;
+  return s == NSIZES ? SIZE_MAX : (size_t) 1 << (MIN_SIZE_LOG + s);
+}
+
+int pps_pool_calibrate (pps_pool *pool, const pps_options *opts) {
+  int candidates[PPS_MAX_CROSSOVERS], ncandidates = 0, best[NSIZES], wins[NSIZES];
+  double times[PPS_MAX_CROSSOVERS][NSIZES], scalar[NSIZES];
+  const pps_kernels *k, *plain;
+  pps_options defaults;
+  pps_tuning tuning;
+  int size, t, c, s;
+  int *data;
+
+  if (pool == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (opts == NULL) {
+    pps_options_init(&defaults);
+    opts = &defaults;
+  }
+  k = pps_get_kernels(opts->isa);
+  plain = pps_get_kernels(PPS_ISA_SCALAR);
+  if (k == NULL || plain == NULL) return -1; // errno set by pps_get_kernels
+
+  // 1, 2, 4, ... threads and the whole pool
+  size = pps_pool_size(pool);
+  for (t = 1; t < size && ncandidates < PPS_MAX_CROSSOVERS - 1; t *= 2) candidates[ncandidates++] = t;
+  candidates[ncandidates++] = size;
+
+  data = (int *) calloc((size_t) 1 << MAX_SIZE_LOG, sizeof(int)); // Zeros don't overflow
+  if (data == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  for (s = 0; s < NSIZES; s++) {
+    scalar[s] = measure(pool, data, (size_t) 1 << (MIN_SIZE_LOG + s), 1, opts, plain);
+    best[s] = 0;
+    for (c = 0; c < ncandidates; c++) {
+      times[c][s] = measure(pool, data, (size_t) 1 << (MIN_SIZE_LOG + s), candidates[c], opts, k);
+      if (times[c][s] < 0 || scalar[s] < 0) {
+        free(data);
+        return -1;
+      }
+      if (times[c][s] < times[best[s]][s]) best[s] = c;
+    }
+  }
+  free(data);
+
+  for (s = 0; s < NSIZES; s++) wins[s] = times[0][s] <= scalar[s];
+  tuning.simd_min = crossover(wins);
+  tuning.count = 0;
+  for (c = 1; c < ncandidates; c++) {
+    for (s = 0; s < NSIZES; s++) wins[s] = best[s] >= c;
+    tuning.threads[tuning.count] = candidates[c];
+    tuning.min_items[tuning.count++] = crossover(wins);
+  }
+
+  pps_pool_store_tuning(pool, &tuning);
+  return 0;
+}
+
+int pps_tuned_threads (const pps_tuning *tuning, size_t n, int max_threads) {
+  int i, nthreads = 1;
+
+  for (i = 0; i < tuning->count; i++) {
+    if (tuning->min_items[i] <= n && tuning->threads[i] <= max_threads && tuning->threads[i] > nthreads) {
+      nthreads = tuning->threads[i];
+    }
+  }
+  return nthreads;
+}
+
+int pps_pool_save_tuning (pps_pool *pool, const char *path) {
+  const pps_tuning *tuning;
+  FILE *file;
+  int i;
+
+  if (pool == NULL || path == NULL || (tuning = pps_pool_tuning(pool)) == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  file = fopen(path, "w");
+  if (file == NULL) return -1;
+  fprintf(file, "# libprefixsum tuning\n");
+  fprintf(file, "simd %zu\n", tuning->simd_min);
+  for (i = 0; i < tuning->count; i++) {
+    if (tuning->min_items[i] != SIZE_MAX) { // Never worth it, leave out
+      fprintf(file, "threads %d %zu\n", tuning->threads[i], tuning->min_items[i]);
+    }
+  }
+  if (fclose(file) != 0) return -1;
+  return 0;
+}
+
+int pps_pool_load_tuning (pps_pool *pool, const char *path) {
+  char line[256], key[16];
+  pps_tuning tuning;
+  size_t items;
+  FILE *file;
+  int threads;
+
+  if (pool == NULL || path == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  file = fopen(path, "r");
+  if (file == NULL) return -1;
+  tuning.simd_min = 0;
+  tuning.count = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (line[0] == '#' || line[0] == '\n') continue;
+    if (sscanf(line, "%15s", key) != 1) continue;
+    if (strcmp(key, "simd") == 0 && sscanf(line, "%*s %zu", &items) == 1) {
+      tuning.simd_min = items;
+    } else if (strcmp(key, "threads") == 0 && sscanf(line, "%*s %d %zu", &threads, &items) == 2 &&
+               threads > 0 && tuning.count < PPS_MAX_CROSSOVERS) {
+      tuning.threads[tuning.count] = threads;
+      tuning.min_items[tuning.count++] = items;
+    } else {
+      fclose(file);
+      errno = EINVAL; // Not a tuning file
+      return -1;
+    }
+  }
+  fclose(file);
+
+  pps_pool_store_tuning(pool, &tuning);
+  return 0;
+}